@@ -0,0 +1,42 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include "instrument.h"
+
+
+/* Allocation counting for NM_INSTRUMENT builds.
+ *
+ * Include this header in exactly one source file of a program, usually the one with
+ * main(). It replaces the global operator new and delete with versions that pass
+ * every allocation to Estd::count_allocation(), which fills the allocation counters
+ * of Schematic::stats() and Estd::total_allocations(). The library does not replace
+ * them itself, so programs that don't include this (or bring their own replacement)
+ * are unaffected, and their allocation counters stay zero.
+ *
+ * Without NM_INSTRUMENT this header is empty.
+ */
+#ifdef NM_INSTRUMENT
+#include <cstdlib>
+#include <new>
+
+void* operator new(std::size_t size)
+{
+    Estd::count_allocation(size);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {return operator new(size);}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {return operator new(size);}
+    catch(...) {return nullptr;}
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {return operator new(size,std::nothrow);}
+void operator delete(void* p) noexcept {std::free(p);}
+void operator delete[](void* p) noexcept {std::free(p);}
+void operator delete(void* p, std::size_t) noexcept {std::free(p);}
+void operator delete[](void* p, std::size_t) noexcept {std::free(p);}
+#endif
+
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,513 @@
+#include "editlog.h"
+#include "schematicfile.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <array>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using Estd::Vec;
+using Wire = Schematic::Wire;
+using Segment = std::pair<Coordinate2,Coordinate2>;
+
+constexpr char EditLog::MAGIC[8];
+
+namespace
+{
+
+uint32_t crc32(const char* data, size_t size)
+{
+    static const auto table = [] {
+        std::array<uint32_t,256> t{};
+        for(uint32_t i=0; i<256; i++)
+        {
+            uint32_t c = i;
+            for(int k=0; k<8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = 0xFFFFFFFFu;
+    for(size_t i=0; i<size; i++) c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// Write the file's buffers through to the disk
+void sync_file(std::FILE* f)
+{
+    bool ok = std::fflush(f) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    if(!ok) throw std::runtime_error("Could not write edit log.");
+}
+
+// Make a rename in `dir` durable
+void sync_directory(const std::filesystem::path& dir)
+{
+#ifndef _WIN32
+    int fd = open(dir.empty() ? "." : dir.c_str(),O_RDONLY);
+    if(fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+class RecordWriter
+{
+public:
+    std::string data;
+    template<typename T>
+    void put(T v) {data.append(reinterpret_cast<const char*>(&v),sizeof(T));}
+    void put(Coordinate2 p) {put(p.x); put(p.y);}
+    void put(const string& s)
+    {
+        put(static_cast<uint32_t>(s.size()));
+        data.append(s);
+    }
+    void put(Wire w) {put(static_cast<int32_t>(w.first)); put(static_cast<int32_t>(w.second));}
+};
+
+class RecordReader
+{
+public:
+    RecordReader(const char* data, size_t size) : _p{data},_end{data+size} {}
+    template<typename T>
+    T get()
+    {
+        T v;
+        _check(sizeof(T));
+        std::memcpy(&v,_p,sizeof(T));
+        _p += sizeof(T);
+        return v;
+    }
+    Coordinate2 get_coord()
+    {
+        double x = get<double>();
+        double y = get<double>();
+        return Coordinate2(x,y);
+    }
+    string get_string()
+    {
+        uint32_t size = get<uint32_t>();
+        _check(size);
+        string s(_p,size);
+        _p += size;
+        return s;
+    }
+    Wire get_wire()
+    {
+        int first = get<int32_t>();
+        return {first,get<int32_t>()};
+    }
+    // Element count, checked against the bytes left
+    uint32_t get_count(size_t element_size)
+    {
+        uint32_t n = get<uint32_t>();
+        if(n > static_cast<size_t>(_end-_p)/element_size) _malformed();
+        return n;
+    }
+    bool done() const {return _p == _end;}
+
+private:
+    const char* _p;
+    const char* _end;
+    void _check(size_t n) const {if(static_cast<size_t>(_end-_p) < n) _malformed();}
+    [[noreturn]] static void _malformed() {throw std::runtime_error("Edit log record is malformed.");}
+};
+
+RecordWriter begin_record(EditLog::Op op, bool traverse, bool lazy)
+{
+    RecordWriter w;
+    w.put(static_cast<uint8_t>(op));
+    w.put(static_cast<uint8_t>((traverse ? 1 : 0) | (lazy ? 2 : 0)));
+    return w;
+}
+
+} // namespace
+
+
+EditLog::EditLog(const string& path, size_t sync_every) : _path{path},_sync_every{sync_every}
+{
+    if(sync_every == 0) throw std::invalid_argument("Sync batch size must be positive.");
+}
+
+EditLog::~EditLog()
+{
+    try {stop();}
+    catch(std::runtime_error&) {}  // nothing better to do in a destructor
+}
+
+string EditLog::checkpoint_path(const string& path, uint64_t generation)
+{
+    return path + "." + std::to_string(generation) + ".nms";
+}
+
+/*
+ * Start logging `sch`: write a checkpoint of it and an empty log. Continues the
+ * generation count of an existing log at the same path.
+ */
+void EditLog::start(Schematic& sch)
+{
+    stop();
+    if(sch._edit_log) sch._edit_log->stop();
+    uint64_t generation = 0;
+    std::ifstream in(_path,std::ios::binary);
+    Header header;
+    if(in.read(reinterpret_cast<char*>(&header),sizeof(header)) && std::memcmp(header.magic,MAGIC,sizeof(MAGIC)) == 0)
+    {
+        generation = header.generation;
+    }
+    in.close();
+    _generation = generation;
+    _sch = &sch;
+    checkpoint();
+}
+
+/*
+ * Fold the log into a new checkpoint: save the schematic, then replace the log with
+ * an empty one for the new checkpoint. Replacing the log is the commit point; if
+ * this is interrupted, recovery still finds the previous checkpoint and log.
+ */
+void EditLog::checkpoint()
+{
+    if(!_sch) throw std::invalid_argument("Edit log is not started.");
+    sync();
+    Schematic& sch = *_sch;
+    sch._edit_log = nullptr;  // saving can resolve the nets, which the checkpoint covers
+    uint64_t old_generation = _generation;
+    try {
+        SchematicFile::save(sch,checkpoint_path(_path,_generation+1));
+        std::FILE* f = std::fopen(checkpoint_path(_path,_generation+1).c_str(),"rb+");
+        if(!f) throw std::runtime_error("Could not write checkpoint.");
+        sync_file(f);
+        std::fclose(f);
+        _open_new_log(_generation+1);
+    } catch(...) {
+        sch._edit_log = this;
+        throw;
+    }
+    sch._edit_log = this;
+    if(old_generation > 0) std::remove(checkpoint_path(_path,old_generation).c_str());
+}
+
+/*
+ * Write the buffered records and fsync the log.
+ */
+void EditLog::sync()
+{
+    if(!_file || _pending.empty()) return;
+    if(std::fwrite(_pending.data(),1,_pending.size(),_file) != _pending.size())
+        throw std::runtime_error("Could not write edit log.");
+    sync_file(_file);
+    _pending.clear();
+    _pending_records = 0;
+}
+
+/*
+ * Sync and stop logging. The log and checkpoint stay on disk for recovery.
+ */
+void EditLog::stop()
+{
+    if(_sch && _sch->_edit_log == this) _sch->_edit_log = nullptr;
+    _sch = nullptr;
+    if(_file)
+    {
+        try {sync();}
+        catch(...) {_close(); throw;}
+    }
+    _close();
+}
+
+void EditLog::_close()
+{
+    if(_file) std::fclose(_file);
+    _file = nullptr;
+    _pending.clear();
+    _pending_records = 0;
+}
+
+void EditLog::_open_new_log(uint64_t generation)
+{
+    std::filesystem::path path(_path);
+    string tmp = _path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(),"wb");
+    if(!f) throw std::runtime_error("Could not create edit log.");
+    Header header{};
+    std::memcpy(header.magic,MAGIC,sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = SchematicFile::BYTE_ORDER_MARK;
+    header.generation = generation;
+    bool ok = std::fwrite(&header,sizeof(header),1,f) == 1;
+    try {
+        if(!ok) throw std::runtime_error("Could not create edit log.");
+        sync_file(f);
+    } catch(...) {
+        std::fclose(f);
+        throw;
+    }
+    std::fclose(f);
+    std::filesystem::rename(tmp,path);
+    sync_directory(path.parent_path());
+
+    _close();
+    _file = std::fopen(_path.c_str(),"ab");
+    if(!_file) throw std::runtime_error("Could not open edit log.");
+    _generation = generation;
+    _records = 0;
+    _bytes = 0;
+}
+
+void EditLog::_append(const string& payload)
+{
+    uint32_t size = payload.size();
+    uint32_t crc = crc32(payload.data(),payload.size());
+    _pending.append(reinterpret_cast<const char*>(&size),sizeof(size));
+    _pending.append(reinterpret_cast<const char*>(&crc),sizeof(crc));
+    _pending.append(payload);
+    _records++;
+    _bytes += sizeof(size) + sizeof(crc) + payload.size();
+    if(++_pending_records >= _sync_every) sync();
+}
+
+void EditLog::_log_add_wire(Coordinate2 a, Coordinate2 b, bool traverse)
+{
+    RecordWriter w = begin_record(ADD_WIRE,traverse,_sch->lazy());
+    w.put(a);
+    w.put(b);
+    _append(w.data);
+}
+
+void EditLog::_log_add_wires(const Vec<Segment>& segments, bool traverse)
+{
+    RecordWriter w = begin_record(ADD_WIRES,traverse,_sch->lazy());
+    w.put(static_cast<uint32_t>(segments.size()));
+    for(auto& s : segments)
+    {
+        w.put(s.first);
+        w.put(s.second);
+    }
+    _append(w.data);
+}
+
+void EditLog::_log_remove_wire(Wire wire, bool traverse)
+{
+    RecordWriter w = begin_record(REMOVE_WIRE,traverse,_sch->lazy());
+    w.put(wire);
+    _append(w.data);
+}
+
+void EditLog::_log_add_port(const Schematic::Port& port, bool traverse)
+{
+    RecordWriter w = begin_record(ADD_PORT,traverse,_sch->lazy());
+    w.put(port.first);
+    w.put(port.second);
+    _append(w.data);
+}
+
+void EditLog::_log_remove_port(int pid, bool traverse)
+{
+    RecordWriter w = begin_record(REMOVE_PORT,traverse,_sch->lazy());
+    w.put(static_cast<int32_t>(pid));
+    _append(w.data);
+}
+
+void EditLog::_log_remove_ports(const string& port_name, bool traverse)
+{
+    RecordWriter w = begin_record(REMOVE_PORTS,traverse,_sch->lazy());
+    w.put(port_name);
+    _append(w.data);
+}
+
+void EditLog::_log_update_nets()
+{
+    _append(begin_record(UPDATE_NETS,true,_sch->lazy()).data);
+}
+
+void EditLog::_log_compact()
+{
+    _append(begin_record(COMPACT,true,_sch->lazy()).data);
+}
+
+void EditLog::_log_step(const Schematic::EditStep& step, bool inverse)
+{
+    RecordWriter w = begin_record(inverse ? UNDO : REDO,true,_sch->lazy());
+    w.put(static_cast<uint32_t>(step.graph.size()));
+    for(auto& entry : step.graph)
+    {
+        w.put(static_cast<uint8_t>(entry.type));
+        w.put(static_cast<int32_t>(entry.id1));
+        w.put(static_cast<int32_t>(entry.id2));
+        w.put(static_cast<int32_t>(entry.index));
+        w.put(static_cast<uint8_t>(entry.node ? 1 : 0));
+        if(entry.node)
+        {
+            w.put(static_cast<int32_t>(entry.node->get_id()));
+            w.put(entry.node->get_pos());
+        }
+    }
+    w.put(static_cast<uint32_t>(step.ports.size()));
+    for(auto& op : step.ports)
+    {
+        w.put(static_cast<uint8_t>(op.add));
+        w.put(static_cast<int32_t>(op.index));
+        w.put(op.port.first);
+        w.put(op.port.second);
+    }
+    w.put(static_cast<uint32_t>(step.nets.size()));
+    for(auto& op : step.nets)
+    {
+        w.put(static_cast<uint8_t>(op.insert));
+        w.put(static_cast<uint8_t>(op.pooled));
+        w.put(op.name);
+        w.put(static_cast<uint32_t>(op.wires.size()));
+        for(auto& wire : op.wires) w.put(wire);
+    }
+    _append(w.data);
+}
+
+/*
+ * Replace the contents of `sch` with the checkpoint of the log at `path`, and replay
+ * the log onto it. Returns the number of records replayed. Any log following `sch`
+ * is stopped.
+ */
+uint64_t EditLog::recover(Schematic& sch, const string& path)
+{
+    std::ifstream in(path,std::ios::binary);
+    if(!in) throw std::runtime_error("Could not open edit log.");
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    string log = buffer.str();
+    Header header;
+    if(log.size() < sizeof(header)) throw std::runtime_error("Edit log is truncated.");
+    std::memcpy(&header,log.data(),sizeof(header));
+    if(std::memcmp(header.magic,MAGIC,sizeof(MAGIC)) != 0) throw std::runtime_error("Not an edit log.");
+    if(header.byte_order != SchematicFile::BYTE_ORDER_MARK) throw std::runtime_error("Edit log has a different byte order.");
+    if(header.version != VERSION) throw std::runtime_error("Unsupported edit log version.");
+
+    if(sch._edit_log) sch._edit_log->stop();
+    SchematicFile::load(sch,checkpoint_path(path,header.generation));
+    // Steps replayed from the log are not undoable. The limit comes back even if a
+    // record throws.
+    struct UndoLimitGuard
+    {
+        Schematic& sch;
+        size_t limit;
+        ~UndoLimitGuard() {sch.set_undo_limit(limit);}
+    } undo_limit{sch,sch._undo_limit};
+    sch.set_undo_limit(0);
+
+    uint64_t replayed = 0;
+    size_t pos = sizeof(header);
+    while(log.size()-pos >= 2*sizeof(uint32_t))
+    {
+        uint32_t size, crc;
+        std::memcpy(&size,log.data()+pos,sizeof(size));
+        std::memcpy(&crc,log.data()+pos+sizeof(size),sizeof(crc));
+        pos += 2*sizeof(uint32_t);
+        if(log.size()-pos < size || crc32(log.data()+pos,size) != crc) break;  // torn write
+        RecordReader r(log.data()+pos,size);
+        pos += size;
+
+        Op op = static_cast<Op>(r.get<uint8_t>());
+        uint8_t flags = r.get<uint8_t>();
+        bool traverse = flags & 1;
+        if(sch.lazy() != bool(flags & 2)) sch.set_lazy(flags & 2);
+        switch(op)
+        {
+        case ADD_WIRE:
+        {
+            Coordinate2 a = r.get_coord();
+            sch.add_wire(a,r.get_coord(),traverse);
+            break;
+        }
+        case ADD_WIRES:
+        {
+            Vec<Segment> segments(r.get_count(4*sizeof(double)));
+            for(auto& s : segments)
+            {
+                s.first = r.get_coord();
+                s.second = r.get_coord();
+            }
+            sch.add_wires(segments,traverse);
+            break;
+        }
+        case REMOVE_WIRE:
+            sch.remove_wire(r.get_wire(),traverse);
+            break;
+        case ADD_PORT:
+        {
+            Coordinate2 p = r.get_coord();
+            sch.add_port_node({p,r.get_string()},traverse);
+            break;
+        }
+        case REMOVE_PORT:
+            sch.remove_port_node(r.get<int32_t>(),traverse);
+            break;
+        case REMOVE_PORTS:
+            sch.remove_port_nodes(r.get_string(),traverse);
+            break;
+        case UPDATE_NETS:
+            sch.update_nets();
+            break;
+        case COMPACT:
+            sch.compact();
+            break;
+        case UNDO:
+        case REDO:
+        {
+            Schematic::EditStep step;
+            step.graph.resize(r.get_count(14));
+            for(auto& entry : step.graph)
+            {
+                entry.type = static_cast<VertexGraph::JournalEntry::Type>(r.get<uint8_t>());
+                entry.id1 = r.get<int32_t>();
+                entry.id2 = r.get<int32_t>();
+                entry.index = r.get<int32_t>();
+                if(r.get<uint8_t>())
+                {
+                    int id = r.get<int32_t>();
+                    entry.node = std::make_shared<const GraphVertex>(id,r.get_coord());
+                }
+            }
+            step.ports.resize(r.get_count(25));
+            for(auto& port : step.ports)
+            {
+                port.add = r.get<uint8_t>();
+                port.index = r.get<int32_t>();
+                port.port.first = r.get_coord();
+                port.port.second = r.get_string();
+            }
+            step.nets.resize(r.get_count(10));
+            for(auto& net : step.nets)
+            {
+                net.insert = r.get<uint8_t>();
+                net.pooled = r.get<uint8_t>();
+                net.name = r.get_string();
+                net.wires.resize(r.get_count(2*sizeof(int32_t)));
+                for(auto& w : net.wires) w = r.get_wire();
+            }
+            sch._replay(step,op == UNDO);
+            break;
+        }
+        default:
+            throw std::runtime_error("Edit log record is malformed.");
+        }
+        if(!r.done()) throw std::runtime_error("Edit log record is malformed.");
+        replayed++;
+    }
+    return replayed;
+}
@@ -0,0 +1,98 @@
+#ifndef EDITLOG_H
+#define EDITLOG_H
+
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include "schematic.h"
+
+
+/* Append-only edit log for crash-safe autosave.
+ *
+ * Usage: EditLog log(path); log.start(sch) writes a checkpoint of `sch` (a
+ * SchematicFile next to the log, "<path>.<generation>.nms") and from then on appends
+ * every edit of `sch` to the log: the public mutators with their arguments, explicit
+ * and lazy net resolutions, compact(), and undo()/redo() as the step they replayed.
+ * Records are buffered and written with an fsync every `sync_every` records, or on
+ * sync(); a crash loses at most the records since the last sync. Call checkpoint()
+ * now and then (e.g. when log_bytes() gets large) to fold the log into a new
+ * checkpoint, so that autosave cost follows the edits and not the design size.
+ *
+ * EditLog::recover(sch,path) loads the checkpoint the log belongs to and replays the
+ * log onto it. Edits are deterministic, so the result has the same vertex ids, net
+ * names and ports as the logged schematic at its last sync. A torn record at the
+ * end of the log (a crash while writing) ends the replay. The undo history is not
+ * recovered.
+ *
+ * A log follows one schematic at a time. Destroy or stop() it before the
+ * schematic, and start() again after loading a file into the schematic. Errors
+ * writing or reading the log throw std::runtime_error.
+ *
+ * Log layout (native byte order): Header, then records of
+ *   uint32 size, uint32 crc32 of the payload, payload[size]
+ * where the payload starts with the Op and a flags byte (bit 0: traverse, bit 1: lazy).
+ */
+class EditLog
+{
+public:
+    static constexpr char MAGIC[8] = {'N','M','E','D','I','T','L','G'};
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t generation;        // checkpoint this log applies to
+    };
+    enum Op : uint8_t {ADD_WIRE=1, ADD_WIRES, REMOVE_WIRE, ADD_PORT, REMOVE_PORT, REMOVE_PORTS,
+                       UPDATE_NETS, COMPACT, UNDO, REDO};
+
+    EditLog(const std::string& path, size_t sync_every=32);
+    ~EditLog();
+    EditLog(const EditLog&) = delete;
+    EditLog& operator=(const EditLog&) = delete;
+
+    void start(Schematic& sch);
+    void checkpoint();
+    void sync();
+    void stop();
+
+    uint64_t generation() const {return _generation;}
+    uint64_t records() const {return _records;}     // since the last checkpoint
+    uint64_t log_bytes() const {return _bytes;}     // since the last checkpoint
+    std::string checkpoint_path() const {return checkpoint_path(_path,_generation);}
+    static std::string checkpoint_path(const std::string& path, uint64_t generation);
+
+    static uint64_t recover(Schematic& sch, const std::string& path);
+
+private:
+    friend class Schematic;
+    std::string _path;
+    size_t _sync_every;
+    Schematic* _sch = nullptr;
+    std::FILE* _file = nullptr;
+    std::string _pending;           // records not written yet
+    size_t _pending_records = 0;
+    uint64_t _generation = 0;
+    uint64_t _records = 0;
+    uint64_t _bytes = 0;
+
+    void _open_new_log(uint64_t generation);
+    void _close();
+    void _append(const std::string& payload);
+
+    // Called by Schematic after each edit
+    void _log_add_wire(Coordinate2 a, Coordinate2 b, bool traverse);
+    void _log_add_wires(const Estd::Vec<std::pair<Coordinate2,Coordinate2>>& segments, bool traverse);
+    void _log_remove_wire(Schematic::Wire w, bool traverse);
+    void _log_add_port(const Schematic::Port& port, bool traverse);
+    void _log_remove_port(int pid, bool traverse);
+    void _log_remove_ports(const std::string& port_name, bool traverse);
+    void _log_update_nets();
+    void _log_compact();
+    void _log_step(const Schematic::EditStep& step, bool inverse);
+};
+
+
+#endif // EDITLOG_H
@@ -0,0 +1,43 @@
+#include "instrument.h"
+
+namespace
+{
+#ifdef NM_INSTRUMENT
+thread_local Estd::AllocationStats* t_allocations = nullptr;
+std::atomic<uint64_t> g_allocations{0};
+std::atomic<uint64_t> g_bytes{0};
+#endif
+}
+
+#ifdef NM_INSTRUMENT
+Estd::AllocationScope::AllocationScope(AllocationStats& stats) : _outer{t_allocations == nullptr}
+{
+    if(_outer) t_allocations = &stats;
+}
+
+Estd::AllocationScope::~AllocationScope()
+{
+    if(_outer) t_allocations = nullptr;
+}
+
+uint64_t Estd::total_allocations() {return g_allocations.load(std::memory_order_relaxed);}
+uint64_t Estd::total_allocated_bytes() {return g_bytes.load(std::memory_order_relaxed);}
+
+// Called by the operator new of allocationcounter.h
+void Estd::count_allocation(std::size_t size)
+{
+    g_allocations.fetch_add(1,std::memory_order_relaxed);
+    g_bytes.fetch_add(size,std::memory_order_relaxed);
+    if(t_allocations)
+    {
+        t_allocations->allocations += 1;
+        t_allocations->bytes += size;
+    }
+}
+#else
+Estd::AllocationScope::AllocationScope(AllocationStats&) : _outer{false} {}
+Estd::AllocationScope::~AllocationScope() {}
+uint64_t Estd::total_allocations() {return 0;}
+uint64_t Estd::total_allocated_bytes() {return 0;}
+void Estd::count_allocation(std::size_t) {}
+#endif
@@ -0,0 +1,161 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+
+
+/* Hot path counters and timers.
+ *
+ * Build with NM_INSTRUMENT defined (CMake option NM_INSTRUMENT) to count and time
+ * graph traversals, collinear merges, the phases of update_nets(), whole-graph and
+ * spatial scans, wire picking and the allocations of each public Schematic call.
+ * Read them with Schematic::stats() and clear them with Schematic::reset_stats().
+ * Without NM_INSTRUMENT the NM_* macros expand to nothing, so the hot paths are
+ * unchanged, and stats() stays all zeros (SchematicStats::enabled is false).
+ *
+ * Counters are atomic because some of the work runs on a thread pool. Allocations are
+ * counted on the thread that made the outermost Schematic call only, and only in
+ * programs that install the counting operator new of allocationcounter.h.
+ */
+namespace Estd
+{
+
+class Counter
+{
+public:
+    Counter() = default;
+    Counter(const Counter& other) : _value{other.get()} {}
+    Counter& operator=(const Counter& other) {_value.store(other.get(),std::memory_order_relaxed); return *this;}
+    Counter& operator+=(uint64_t n) {_value.fetch_add(n,std::memory_order_relaxed); return *this;}
+    uint64_t get() const {return _value.load(std::memory_order_relaxed);}
+    operator uint64_t() const {return get();}
+private:
+    std::atomic<uint64_t> _value{0};
+};
+
+struct Timer
+{
+    Counter calls;
+    Counter ns;
+};
+
+// Adds the time until it is destroyed to a Timer
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Timer& timer) : _timer{timer},_start{std::chrono::steady_clock::now()} {}
+    ~ScopedTimer()
+    {
+        _timer.calls += 1;
+        _timer.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_start).count();
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+    Timer& _timer;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Times consecutive phases of a function: next() ends the current phase. Used
+// through Timeline::Phases::next(name,&timer), which marks both at once.
+class PhaseTimer
+{
+public:
+    PhaseTimer() : _start{std::chrono::steady_clock::now()} {}
+    ~PhaseTimer() {next(nullptr);}
+    void next(Timer* timer)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if(_timer)
+        {
+            _timer->calls += 1;
+            _timer->ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now-_start).count();
+        }
+        _timer = timer;
+        _start = now;
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+private:
+    Timer* _timer = nullptr;
+    std::chrono::steady_clock::time_point _start;
+};
+
+struct AllocationStats
+{
+    Counter allocations;
+    Counter bytes;
+};
+
+// Counts the allocations of this thread into `stats` until destroyed, unless an
+// outer scope is already counting
+class AllocationScope
+{
+public:
+    explicit AllocationScope(AllocationStats& stats);
+    ~AllocationScope();
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+private:
+    bool _outer;
+};
+
+// Allocations of the whole program so far (with NM_INSTRUMENT and allocationcounter.h)
+uint64_t total_allocations();
+uint64_t total_allocated_bytes();
+
+// Counts one allocation, for a replacement operator new (see allocationcounter.h)
+void count_allocation(std::size_t size);
+
+}  // namespace Estd
+
+
+// Graph side of SchematicStats
+struct GraphStats
+{
+    Estd::Timer traversals;             // _traverse_graph()
+    Estd::Timer merges;                 // merge_unbranched_collinear_edges()
+    Estd::Counter merged_vertices;      // vertices removed by merges
+    Estd::Counter linear_scans;         // passes over every vertex or edge
+    Estd::Counter linear_scan_items;    // vertices or edges visited by those
+    Estd::Counter spatial_queries;      // BulkBuilder lookups
+    Estd::Counter spatial_cells;        // grid cells visited by those
+};
+
+struct SchematicStats
+{
+#ifdef NM_INSTRUMENT
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+    GraphStats graph;
+    Estd::Timer update_nets;            // whole update_nets() calls
+    Estd::Timer nets_merge;             // update_nets() phases: pending collinear merge,
+    Estd::Timer nets_trees;             //   spanning trees and edge trees,
+    Estd::Timer nets_match;             //   matching the old nets to the trees,
+    Estd::Timer nets_ports;             //   naming new trees after ports or numbers,
+    Estd::Timer nets_publish;           //   undo journal, handles, snapshots and events
+    Estd::Counter select_wire;          // wire picks by position, public and internal
+    Estd::Counter net_scans;            // passes over the whole net table
+    Estd::AllocationStats allocations;  // during public calls
+};
+
+
+#ifdef NM_INSTRUMENT
+#define NM_CONCAT_(a,b) a##b
+#define NM_CONCAT(a,b) NM_CONCAT_(a,b)
+#define NM_COUNT(counter,n) ((counter) += (n))
+#define NM_TIME(timer) Estd::ScopedTimer NM_CONCAT(nm_timer_,__LINE__)(timer)
+#define NM_ALLOCATIONS(stats) Estd::AllocationScope NM_CONCAT(nm_allocations_,__LINE__)(stats)
+#else
+#define NM_COUNT(counter,n) ((void)0)
+#define NM_TIME(timer) ((void)0)
+#define NM_ALLOCATIONS(stats) ((void)0)
+#endif
+
+
+#endif // INSTRUMENT_H
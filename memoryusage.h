@@ -0,0 +1,136 @@
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <queue>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include "utils.h"
+
+
+/* Heap bytes owned by a value, not counting the value itself, for memory reports.
+ *
+ * Exact for vectors (from capacity(), including the unused part) and strings (zero
+ * while the string fits in the string object itself). Node-based containers do not
+ * expose their layout, so map and set nodes are counted as the value plus four
+ * pointers (three links and the colour, padded), shared_ptr control blocks as two
+ * counters and a pointer, and deques as whole blocks of 512 bytes plus the block map
+ * (libstdc++ layout, where even an empty deque holds a block). The allocator's own
+ * overhead per allocation is not counted.
+ * Types with a `size_t heap_bytes() const` member are counted with it, other types
+ * own nothing.
+ */
+namespace Estd
+{
+
+constexpr size_t TREE_NODE_OVERHEAD = 4*sizeof(void*);
+constexpr size_t SHARED_OVERHEAD = 2*sizeof(long)+sizeof(void*);
+constexpr size_t DEQUE_BLOCK = 512;
+
+template<typename T> size_t heap_bytes(const T& v);
+inline size_t heap_bytes(const std::string& s);
+template<typename A, typename B> size_t heap_bytes(const std::pair<A,B>& p);
+template<typename T, typename A> size_t heap_bytes(const std::vector<T,A>& v);
+template<typename T, bool C> size_t heap_bytes(const Vec<T,C>& v);
+template<typename K, typename V, typename C, typename A> size_t heap_bytes(const std::map<K,V,C,A>& m);
+template<typename K, typename V, typename C, typename A> size_t heap_bytes(const std::multimap<K,V,C,A>& m);
+template<typename K, typename C, typename A> size_t heap_bytes(const std::set<K,C,A>& s);
+template<typename T, typename A> size_t heap_bytes(const std::deque<T,A>& d);
+template<typename T> size_t heap_bytes(const std::queue<T>& q);
+template<typename T, typename D> size_t heap_bytes(const std::unique_ptr<T,D>& p);
+template<typename T> size_t heap_bytes(const std::shared_ptr<T>& p);
+
+template<typename T, typename = void>
+struct has_heap_bytes : std::false_type {};
+template<typename T>
+struct has_heap_bytes<T,std::void_t<decltype(std::declval<const T&>().heap_bytes())>> : std::true_type {};
+
+template<typename T>
+size_t heap_bytes(const T& v)
+{
+    if constexpr(has_heap_bytes<T>::value) return v.heap_bytes();
+    else return 0;
+}
+
+inline size_t heap_bytes(const std::string& s)
+{
+    const char* p = s.data();
+    bool local = p >= reinterpret_cast<const char*>(&s) && p < reinterpret_cast<const char*>(&s+1);
+    return local ? 0 : s.capacity()+1;
+}
+
+template<typename A, typename B>
+size_t heap_bytes(const std::pair<A,B>& p) {return heap_bytes(p.first)+heap_bytes(p.second);}
+
+template<typename T, typename A>
+size_t heap_bytes(const std::vector<T,A>& v)
+{
+    size_t bytes = v.capacity()*sizeof(T);
+    for(auto& e : v) bytes += heap_bytes(e);
+    return bytes;
+}
+
+template<typename T, bool C>
+size_t heap_bytes(const Vec<T,C>& v) {return heap_bytes(static_cast<const std::vector<T>&>(v));}
+
+template<typename K, typename V, typename C, typename A>
+size_t heap_bytes(const std::map<K,V,C,A>& m)
+{
+    size_t bytes = m.size()*(TREE_NODE_OVERHEAD+sizeof(std::pair<const K,V>));
+    for(auto& e : m) bytes += heap_bytes(e.first)+heap_bytes(e.second);
+    return bytes;
+}
+
+template<typename K, typename V, typename C, typename A>
+size_t heap_bytes(const std::multimap<K,V,C,A>& m)
+{
+    size_t bytes = m.size()*(TREE_NODE_OVERHEAD+sizeof(std::pair<const K,V>));
+    for(auto& e : m) bytes += heap_bytes(e.first)+heap_bytes(e.second);
+    return bytes;
+}
+
+template<typename K, typename C, typename A>
+size_t heap_bytes(const std::set<K,C,A>& s)
+{
+    size_t bytes = s.size()*(TREE_NODE_OVERHEAD+sizeof(K));
+    for(auto& e : s) bytes += heap_bytes(e);
+    return bytes;
+}
+
+template<typename T, typename A>
+size_t heap_bytes(const std::deque<T,A>& d)
+{
+    size_t per_block = std::max<size_t>(1,DEQUE_BLOCK/sizeof(T));
+    size_t blocks = d.size()/per_block+1;
+    size_t bytes = blocks*std::max(DEQUE_BLOCK,sizeof(T))+std::max<size_t>(8,blocks+2)*sizeof(void*);
+    for(auto& e : d) bytes += heap_bytes(e);
+    return bytes;
+}
+
+template<typename T>
+size_t heap_bytes(const std::queue<T>& q)
+{
+    // The underlying container is a protected member
+    struct Access : std::queue<T>
+    {
+        static const typename std::queue<T>::container_type& get(const std::queue<T>& q) {return q.*&Access::c;}
+    };
+    return heap_bytes(Access::get(q));
+}
+
+template<typename T, typename D>
+size_t heap_bytes(const std::unique_ptr<T,D>& p) {return p ? sizeof(T)+heap_bytes(*p) : 0;}
+
+template<typename T>
+size_t heap_bytes(const std::shared_ptr<T>& p) {return p ? SHARED_OVERHEAD+sizeof(T)+heap_bytes(*p) : 0;}
+
+}  // namespace Estd
+
+
+#endif // MEMORYUSAGE_H
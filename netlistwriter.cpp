@@ -0,0 +1,249 @@
+#include "netlistwriter.h"
+#include <fstream>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string_view>
+#include <stdexcept>
+
+using std::string;
+using Format = NetlistWriter::Format;
+
+namespace
+{
+
+// Output buffer that hands full blocks to the sink
+class Buffer
+{
+public:
+    Buffer(const NetlistWriter::Sink& sink) : _sink{sink},_data(1<<16) {}
+    Buffer& operator<<(std::string_view s)
+    {
+        if(s.size() > _data.size()-_used)
+        {
+            flush();
+            if(s.size() > _data.size()) {_sink(s.data(),s.size()); return *this;}
+        }
+        std::memcpy(_data.data()+_used,s.data(),s.size());
+        _used += s.size();
+        return *this;
+    }
+    Buffer& operator<<(char c)
+    {
+        if(_used == _data.size()) flush();
+        _data[_used++] = c;
+        return *this;
+    }
+    Buffer& operator<<(int v) {return _number(v);}
+    Buffer& operator<<(size_t v) {return _number(v);}
+    Buffer& operator<<(double v)
+    {
+        // Grid coordinates are mostly whole numbers, which format much faster as integers
+        if(std::abs(v) < 1e15 && v == static_cast<double>(static_cast<int64_t>(v)) && !(v == 0 && std::signbit(v)))
+            return _number(static_cast<int64_t>(v));
+        return _number(v);
+    }
+
+    void flush()
+    {
+        if(_used > 0) _sink(_data.data(),_used);
+        _used = 0;
+    }
+
+private:
+    const NetlistWriter::Sink& _sink;
+    std::vector<char> _data;
+    size_t _used = 0;
+
+    template<typename T>
+    Buffer& _number(T v)
+    {
+        constexpr size_t longest = 32;  // enough for any double or integer
+        if(_data.size()-_used < longest) flush();
+        auto result = std::to_chars(_data.data()+_used,_data.data()+_data.size(),v);
+        _used = result.ptr-_data.data();
+        return *this;
+    }
+};
+
+void csv_string(Buffer& out, const string& s)
+{
+    if(s.find_first_of(",\"\r\n") == string::npos) {out << s; return;}
+    out << '"';
+    for(char c : s)
+    {
+        if(c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+void json_string(Buffer& out, const string& s)
+{
+    out << '"';
+    for(unsigned char c : s)
+    {
+        if(c == '"' || c == '\\') out << '\\' << char(c);
+        else if(c < 0x20)
+        {
+            const char* hex = "0123456789abcdef";
+            out << "\\u00" << hex[c >> 4] << hex[c & 15];
+        }
+        else out << char(c);
+    }
+    out << '"';
+}
+
+// A SPICE field ends at whitespace and a comment at the end of the line
+bool spice_field(const string& s)
+{
+    if(s.empty()) return false;
+    for(unsigned char c : s)
+    {
+        if(c <= ' ' || c == 0x7f) return false;
+    }
+    return true;
+}
+
+// JSON has no NaN or infinity, those are written as null
+void json_number(Buffer& out, double v)
+{
+    if(std::isfinite(v)) out << v;
+    else out << "null";
+}
+
+void write_spice(const SchematicSnapshot& snap, Buffer& out)
+{
+    // Checked before anything reaches the sink
+    if(snap.name().find_first_of("\r\n") != string::npos) throw std::runtime_error("Schematic name cannot be written to SPICE.");
+    for(auto& net : snap.nets())
+    {
+        if(!spice_field(net.first)) throw std::runtime_error("Net name cannot be written to SPICE.");
+    }
+    for(auto& port : snap.ports())
+    {
+        if(!spice_field(port.second)) throw std::runtime_error("Port name cannot be written to SPICE.");
+    }
+
+    out << "* schematic " << snap.name() << '\n';
+    size_t n = 0;
+    for(auto& net : snap.nets())
+    {
+        out << "* net " << net.first << '\n';
+        const SchematicSnapshot::Net& wires = *net.second;
+        for(size_t i=0; i<wires.wires.size(); i++)
+        {
+            const auto& w = wires.wires[i];
+            const auto& s = wires.segments[i];
+            out << 'W' << n++ << ' ' << net.first << ' ' << w.first << ' ' << w.second << ' '
+                << s.first.x << ' ' << s.first.y << ' ' << s.second.x << ' ' << s.second.y << '\n';
+        }
+    }
+    n = 0;
+    for(auto& port : snap.ports())
+    {
+        out << 'P' << n++ << ' ' << port.second << ' ' << port.first.x << ' ' << port.first.y << '\n';
+    }
+    out << ".end\n";
+}
+
+void write_csv(const SchematicSnapshot& snap, Buffer& out)
+{
+    out << "type,name,id1,id2,x1,y1,x2,y2\n";
+    for(auto& net : snap.nets())
+    {
+        const SchematicSnapshot::Net& wires = *net.second;
+        for(size_t i=0; i<wires.wires.size(); i++)
+        {
+            const auto& w = wires.wires[i];
+            const auto& s = wires.segments[i];
+            out << "wire,";
+            csv_string(out,net.first);
+            out << ',' << w.first << ',' << w.second << ','
+                << s.first.x << ',' << s.first.y << ',' << s.second.x << ',' << s.second.y << '\n';
+        }
+    }
+    for(auto& port : snap.ports())
+    {
+        out << "port,";
+        csv_string(out,port.second);
+        out << ",,," << port.first.x << ',' << port.first.y << ",,\n";
+    }
+}
+
+void write_json(const SchematicSnapshot& snap, Buffer& out)
+{
+    out << "{\"name\":";
+    json_string(out,snap.name());
+    out << ",\"nets\":[";
+    bool first_net = true;
+    for(auto& net : snap.nets())
+    {
+        if(!first_net) out << ',';
+        first_net = false;
+        out << "\n{\"name\":";
+        json_string(out,net.first);
+        out << ",\"wires\":[";
+        const SchematicSnapshot::Net& wires = *net.second;
+        for(size_t i=0; i<wires.wires.size(); i++)
+        {
+            const auto& w = wires.wires[i];
+            const auto& s = wires.segments[i];
+            if(i > 0) out << ',';
+            out << '[' << w.first << ',' << w.second << ',';
+            json_number(out,s.first.x);
+            out << ',';
+            json_number(out,s.first.y);
+            out << ',';
+            json_number(out,s.second.x);
+            out << ',';
+            json_number(out,s.second.y);
+            out << ']';
+        }
+        out << "]}";
+    }
+    out << "],\n\"ports\":[";
+    for(size_t i=0; i<snap.ports().size(); i++)
+    {
+        const auto& port = snap.ports()[i];
+        if(i > 0) out << ',';
+        out << "\n{\"name\":";
+        json_string(out,port.second);
+        out << ",\"x\":";
+        json_number(out,port.first.x);
+        out << ",\"y\":";
+        json_number(out,port.first.y);
+        out << '}';
+    }
+    out << "]}\n";
+}
+
+} // namespace
+
+
+void NetlistWriter::write(const SchematicSnapshot& snap, Format format, const Sink& sink)
+{
+    Buffer out(sink);
+    switch(format)
+    {
+    case Format::SPICE: write_spice(snap,out); break;
+    case Format::CSV: write_csv(snap,out); break;
+    case Format::JSON: write_json(snap,out); break;
+    }
+    out.flush();
+}
+
+void NetlistWriter::write(const SchematicSnapshot& snap, Format format, std::ostream& out)
+{
+    write(snap,format,[&out](const char* data, size_t size) {out.write(data,size);});
+}
+
+void NetlistWriter::write_file(const SchematicSnapshot& snap, Format format, const string& path)
+{
+    std::ofstream out(path,std::ios::binary | std::ios::trunc);
+    if(!out) throw std::runtime_error("Could not open netlist file.");
+    write(snap,format,out);
+    out.flush();
+    if(!out) throw std::runtime_error("Could not write netlist file.");
+}
@@ -0,0 +1,50 @@
+#ifndef NETLISTWRITER_H
+#define NETLISTWRITER_H
+
+#include <string>
+#include <ostream>
+#include <functional>
+#include <vector>
+#include "schematic.h"
+
+
+/* Text export of resolved nets, wires and ports.
+ *
+ * Usage: NetlistWriter::write(sch.snapshot(),NetlistWriter::Format::CSV,out) writes
+ * every net of the snapshot, each wire with its vertex ids and end points, and the
+ * ports. Writing from a snapshot means positions come with the nets (no graph
+ * lookups) and another thread can export while the schematic is edited. Output is
+ * formatted into a fixed buffer with std::to_chars and handed to the sink in large
+ * blocks; the sink is any std::ostream or a function taking (data,size).
+ *
+ * Nets come in name order, wires in the order of select_net(). Numbers are written
+ * in the shortest form that reads back exactly.
+ *
+ * SPICE:  * schematic <name>
+ *         * net <net name>
+ *         W<n> <net name> <id1> <id2> <x1> <y1> <x2> <y2>     (n counts all wires)
+ *         P<n> <port name> <x> <y>
+ *         .end
+ *         Net and port names with whitespace, and schematic names with line breaks,
+ *         can't be written; write() throws std::runtime_error before any output.
+ * CSV:    type,name,id1,id2,x1,y1,x2,y2
+ *         wire,<net name>,<id1>,<id2>,<x1>,<y1>,<x2>,<y2>
+ *         port,<port name>,,,<x>,<y>,,
+ *         Names are quoted when they contain a comma, quote or line break.
+ * JSON:   {"name":"<name>","nets":[{"name":"<net name>","wires":[[id1,id2,x1,y1,x2,y2],...]},...],
+ *          "ports":[{"name":"<port name>","x":x,"y":y},...]}
+ *         Coordinates that are NaN or infinite are written as null.
+ */
+class NetlistWriter
+{
+public:
+    enum class Format {SPICE, CSV, JSON};
+    using Sink = std::function<void(const char* data, size_t size)>;
+
+    static void write(const SchematicSnapshot& snap, Format format, const Sink& sink);
+    static void write(const SchematicSnapshot& snap, Format format, std::ostream& out);
+    static void write_file(const SchematicSnapshot& snap, Format format, const std::string& path);
+};
+
+
+#endif // NETLISTWRITER_H
@@ -0,0 +1,124 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <string>
+#include "benchutils.h"
+
+using namespace nmbench;
+using Wire = std::pair<int,int>;
+
+// Add a wire somewhere in a resolved schematic of n wires, then undo it (the
+// one step undo journal is part of the timed edit)
+static void BM_SchematicAddWire(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    Schematic sch;
+    load_schematic(sch,n);
+    sch.set_undo_limit(1);
+    Segments segments = make_segments(n,4);
+    size_t i = 0;
+    Op op(state);
+    for(auto _ : state)
+    {
+        auto& s = segments[i++ % segments.size()];
+        Wire w;
+        op.time([&] {w = sch.add_wire(s.first,s.second);});
+        if(w != Schematic::INVALID_WIRE) sch.undo();
+    }
+}
+BENCHMARK(BM_SchematicAddWire)->Apply(sizes);
+
+// Remove a wire from a resolved schematic of n wires, then undo it
+static void BM_SchematicRemoveWire(benchmark::State& state)
+{
+    Schematic sch;
+    load_schematic(sch,state.range(0));
+    sch.set_undo_limit(1);
+    Estd::Vec<Wire> wires = sch.get_all_wires();
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<size_t> pick(0,wires.size()-1);
+    Op op(state);
+    for(auto _ : state)
+    {
+        Wire w = wires[pick(rng)];
+        bool removed = false;
+        op.time([&] {removed = sch.remove_wire(w);});
+        if(removed) sch.undo();
+    }
+}
+BENCHMARK(BM_SchematicRemoveWire)->Apply(sizes);
+
+// Resolve the nets of a schematic of n wires
+static void BM_SchematicUpdateNets(benchmark::State& state)
+{
+    Schematic sch;
+    load_schematic(sch,state.range(0));
+    Op op(state);
+    for(auto _ : state) op.time([&] {sch.update_nets();});
+}
+BENCHMARK(BM_SchematicUpdateNets)->Apply(sizes);
+
+// Select the wire at the end of a random segment of a schematic of n wires
+static void BM_SchematicSelectWire(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    Schematic sch;
+    load_schematic(sch,n);
+    Segments segments = make_segments(n);
+    std::mt19937 rng(6);
+    std::uniform_int_distribution<size_t> pick(0,segments.size()-1);
+    Op op(state);
+    for(auto _ : state)
+    {
+        Coordinate2 p = segments[pick(rng)].first;
+        Wire selected;
+        op.time([&] {selected = sch.select_wire(p);});
+        benchmark::DoNotOptimize(selected);
+    }
+}
+BENCHMARK(BM_SchematicSelectWire)->Apply(sizes);
+
+// Full scan of n segments for a point on none of them, with each instruction set
+// (see SegmentBatch); the brute-force part of select_wire()
+static void BM_SegmentBatchFirstWithin(benchmark::State& state)
+{
+    auto isa = static_cast<SegmentBatch::Isa>(state.range(1));
+    if(isa != SegmentBatch::Isa::SCALAR && SegmentBatch::best_isa() < isa)
+    {
+        state.SkipWithError("instruction set not supported");
+        return;
+    }
+    SegmentBatch segments;
+    for(auto& s : make_segments(state.range(0))) segments.push_back(s.first,s.second);
+    SegmentBatch::set_isa(isa);
+    state.SetLabel(SegmentBatch::isa_name(isa));
+    Coordinate2 p(-1e9,-1e9);
+    Op op(state);
+    for(auto _ : state)
+    {
+        size_t i = 0;
+        op.time([&] {i = segments.first_within(p,p.prec());});
+        benchmark::DoNotOptimize(i);
+    }
+    SegmentBatch::set_isa(SegmentBatch::best_isa());
+}
+BENCHMARK(BM_SegmentBatchFirstWithin)->ArgsProduct({{MIN_SIZE,MIN_SIZE*SIZE_MULTIPLIER,MAX_SIZE},{0,1,2}})
+    ->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// Net name of a random wire of a schematic of n wires
+static void BM_SchematicGetNetname(benchmark::State& state)
+{
+    Schematic sch;
+    load_schematic(sch,state.range(0));
+    Estd::Vec<Wire> wires = sch.get_all_wires();
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<size_t> pick(0,wires.size()-1);
+    Op op(state);
+    for(auto _ : state)
+    {
+        Wire w = wires[pick(rng)];
+        std::string name;
+        op.time([&] {name = sch.get_netname(w);});
+        benchmark::DoNotOptimize(name);
+    }
+}
+BENCHMARK(BM_SchematicGetNetname)->Apply(sizes);
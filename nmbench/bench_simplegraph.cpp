@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include "benchutils.h"
+
+using namespace nmbench;
+
+// Add a vertex away from every wire to a graph of n wires
+static void BM_VertexGraphAdd(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    VertexGraph g;
+    build_graph(g,make_segments(n));
+    g.traverse_graph();
+    std::mt19937 rng(2);
+    Op op(state);
+    for(auto _ : state)
+    {
+        Coordinate2 p = free_point(n,rng);
+        int id = -1;
+        op.time([&] {id = g.add(p,false);});
+        benchmark::DoNotOptimize(id);
+        g.erase(id,false);
+    }
+}
+BENCHMARK(BM_VertexGraphAdd)->Apply(sizes);
+
+// Connect two new vertices of a graph of n wires
+static void BM_VertexGraphConnect(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    VertexGraph g;
+    build_graph(g,make_segments(n));
+    g.traverse_graph();
+    std::mt19937 rng(3);
+    Op op(state);
+    for(auto _ : state)
+    {
+        Coordinate2 p = free_point(n,rng);
+        int id1 = g.add(p,false);
+        int id2 = g.add(Coordinate2(p.x,p.y+3),false);
+        op.time([&] {g.connect(id1,id2,false);});
+        g.erase(id1,false);
+        g.erase(id2,false);
+    }
+}
+BENCHMARK(BM_VertexGraphConnect)->Apply(sizes);
+
+// Find the spanning trees of a graph of n wires
+static void BM_VertexGraphTraverse(benchmark::State& state)
+{
+    VertexGraph g;
+    build_graph(g,make_segments(state.range(0)));
+    Op op(state);
+    for(auto _ : state) op.time([&] {g.traverse_graph();});
+}
+BENCHMARK(BM_VertexGraphTraverse)->Apply(sizes);
+
+/* Merge a graph of n vertices in rows of 16, where every row is a chain of 14 edges
+ * with a stub in the middle, so 12 of every 16 vertices are removed.
+ */
+static void BM_VertexGraphMergeCollinear(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    Op op(state);
+    for(auto _ : state)
+    {
+        VertexGraph g;
+        {
+            VertexGraph::BulkBuilder builder(g,4);
+            for(size_t row=0; 16*row<n; row++)
+            {
+                int prev = builder.add(Coordinate2(0,2.0*row));
+                for(int i=1; i<15; i++)
+                {
+                    int id = builder.add(Coordinate2(i,2.0*row));
+                    builder.connect(prev,id);
+                    prev = id;
+                }
+                builder.connect(builder.add(Coordinate2(7,2.0*row)),builder.add(Coordinate2(7,2.0*row+1)));
+            }
+        }
+        op.time([&] {g.merge_unbranched_collinear_edges();});
+    }
+}
+BENCHMARK(BM_VertexGraphMergeCollinear)->Apply(sizes);
@@ -0,0 +1,161 @@
+#ifndef BENCHUTILS_H
+#define BENCHUTILS_H
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../schematicfile.h"
+#include "../simplegraph.h"
+#include "../utils.h"
+
+/* Shared pieces of the NodeManagerBench benchmarks.
+ *
+ * Every benchmark times one operation per iteration with Op, which reports manual
+ * time to the library and adds these counters:
+ *   items_per_second             operations per second
+ *   p50_us, p90_us, p99_us       latency percentiles of single operations
+ *   bytes_per_op, allocs_per_op  heap allocated by the operation (see main.cpp)
+ * Setup between operations (undoing an edit, building a fresh graph) is not timed.
+ *
+ * Sizes go from 1k to 1M wires (or vertices). Run with
+ *   NodeManagerBench --benchmark_out=bench.json --benchmark_out_format=json
+ * to keep the results for comparing two builds, e.g. with compare.py from Google
+ * Benchmark, and --benchmark_filter=/1024/ to run a single size.
+ */
+namespace nmbench
+{
+
+using Segments = Estd::Vec<std::pair<Coordinate2,Coordinate2>>;
+
+// Heap use so far, counted by the operator new in main.cpp
+uint64_t allocated_bytes();
+uint64_t allocation_count();
+
+constexpr int64_t MIN_SIZE = 1<<10;
+constexpr int64_t MAX_SIZE = 1<<20;
+constexpr int SIZE_MULTIPLIER = 32;
+
+// 1k, 32k and 1M
+inline void sizes(benchmark::internal::Benchmark* b)
+{
+    b->RangeMultiplier(SIZE_MULTIPLIER)->Range(MIN_SIZE,MAX_SIZE);
+    b->UseManualTime()->Unit(benchmark::kMicrosecond);
+}
+
+class Op
+{
+public:
+    explicit Op(benchmark::State& state) : _state{state} {}
+    ~Op()
+    {
+        if(_ns.empty()) return;
+        std::sort(_ns.begin(),_ns.end());
+        auto pct = [this](double p) {return _ns[std::min(_ns.size()-1,size_t(p*_ns.size()))]*1e-3;};
+        double n = static_cast<double>(_ns.size());
+        _state.SetItemsProcessed(_state.iterations());
+        _state.counters["p50_us"] = pct(0.50);
+        _state.counters["p90_us"] = pct(0.90);
+        _state.counters["p99_us"] = pct(0.99);
+        _state.counters["bytes_per_op"] = _bytes/n;
+        _state.counters["allocs_per_op"] = _allocs/n;
+    }
+
+    // Time f() as one iteration
+    template<typename F>
+    void time(F&& f)
+    {
+        uint64_t bytes = allocated_bytes();
+        uint64_t allocs = allocation_count();
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        _bytes += allocated_bytes()-bytes;
+        _allocs += allocation_count()-allocs;
+        double ns = std::chrono::duration<double,std::nano>(t1-t0).count();
+        _ns.push_back(ns);
+        _state.SetIterationTime(ns*1e-9);
+    }
+
+private:
+    benchmark::State& _state;
+    std::vector<double> _ns;
+    uint64_t _bytes = 0;
+    uint64_t _allocs = 0;
+};
+
+/* `n` horizontal and vertical wires of length 1 to 8 on integer coordinates, spread
+ * over a square that keeps the density (and so the mix of crossings, T junctions
+ * and separate nets) the same for every n.
+ */
+inline Segments make_segments(size_t n, unsigned seed=1)
+{
+    std::mt19937 rng(seed);
+    int side = std::max(8,static_cast<int>(4*std::sqrt(double(n))));
+    std::uniform_int_distribution<int> coord(0,side), len(1,8), dir(0,1);
+    Segments segments;
+    segments.reserve(n);
+    for(size_t i=0; i<n; i++)
+    {
+        Coordinate2 a(coord(rng),coord(rng));
+        Coordinate2 b = dir(rng) ? Coordinate2(a.x+len(rng),a.y) : Coordinate2(a.x,a.y+len(rng));
+        segments.push_back({a,b});
+    }
+    return segments;
+}
+
+// A point inside the area of make_segments(n) that is never on a wire or a vertex
+inline Coordinate2 free_point(size_t n, std::mt19937& rng)
+{
+    int side = std::max(8,static_cast<int>(4*std::sqrt(double(n))));
+    std::uniform_int_distribution<int> coord(0,side-1);
+    return Coordinate2(coord(rng)+0.5,coord(rng)+0.5);
+}
+
+// Vertex graph of make_segments(n), built like Schematic::add_wires(segments,false)
+inline void build_graph(VertexGraph& g, const Segments& segments)
+{
+    VertexGraph::BulkBuilder builder(g,4.5);
+    for(auto& s : segments)
+    {
+        int id1 = builder.add(s.first);
+        int id2 = builder.add(s.second);
+        builder.connect(id1,id2);
+    }
+}
+
+/* Load the schematic of make_segments(n) into `sch`, resolved. The schematic is built
+ * with add_wires() the first time a size is asked for and saved to a temporary file,
+ * which later benchmarks of the same size load instead.
+ */
+inline void load_schematic(Schematic& sch, size_t n)
+{
+    static struct TempFiles
+    {
+        std::map<size_t,std::string> paths;
+        ~TempFiles() {for(auto& p : paths) std::remove(p.second.c_str());}
+    } files;
+    auto itr = files.paths.find(n);
+    if(itr == files.paths.end())
+    {
+        Schematic built("bench");
+        built.add_wires(make_segments(n));
+        std::string path = "nmbench_" + std::to_string(n) + ".nms";
+        SchematicFile::save(built,path);
+        itr = files.paths.emplace(n,path).first;
+    }
+    SchematicFile::load(sch,itr->second);
+}
+
+}  // namespace nmbench
+
+#endif // BENCHUTILS_H
@@ -0,0 +1,52 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "benchutils.h"
+#include "../utils.h"
+
+#ifdef NM_INSTRUMENT
+// Install the core's allocation counter, which also feeds Schematic::stats()
+#include "../allocationcounter.h"
+
+uint64_t nmbench::allocated_bytes() {return Estd::total_allocated_bytes();}
+uint64_t nmbench::allocation_count() {return Estd::total_allocations();}
+#else
+// Count heap allocations for the bytes_per_op and allocs_per_op counters
+static std::atomic<uint64_t> g_allocated_bytes{0};
+static std::atomic<uint64_t> g_allocation_count{0};
+
+uint64_t nmbench::allocated_bytes() {return g_allocated_bytes.load(std::memory_order_relaxed);}
+uint64_t nmbench::allocation_count() {return g_allocation_count.load(std::memory_order_relaxed);}
+
+void* operator new(std::size_t size)
+{
+    g_allocated_bytes.fetch_add(size,std::memory_order_relaxed);
+    g_allocation_count.fetch_add(1,std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {return operator new(size);}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {return operator new(size);}
+    catch(...) {return nullptr;}
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {return operator new(size,std::nothrow);}
+void operator delete(void* p) noexcept {std::free(p);}
+void operator delete[](void* p) noexcept {std::free(p);}
+void operator delete(void* p, std::size_t) noexcept {std::free(p);}
+void operator delete[](void* p, std::size_t) noexcept {std::free(p);}
+#endif
+
+int main(int argc, char** argv)
+{
+    // Checked and unchecked Estd::Vec builds don't compare, see NM_UNCHECKED_VEC
+    benchmark::AddCustomContext("estd_vec",Estd::VEC_CHECKED ? "checked" : "unchecked");
+    benchmark::Initialize(&argc,argv);
+    if(benchmark::ReportUnrecognizedArguments(argc,argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
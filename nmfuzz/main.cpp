@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "../schematicfuzz.h"
+
+static const char* USAGE =
+    "Usage: NodeManagerFuzz [options]\n"
+    "Make random edits with every net update checked against a full recompute, then\n"
+    "the same kind of edits in eager and lazy mode, serial and parallel, compared.\n"
+    "  --seed S     first seed (default: 1)\n"
+    "  --runs N     number of seeds to run (default: 100)\n"
+    "  --steps N    calls per run (default: 1000)\n"
+    "  --log N      on failure, print the last N calls (default: 20)\n";
+
+int main(int argc, char *argv[])
+{
+    uint64_t seed = 1, runs = 100, steps = 1000, log = 20;
+    try
+    {
+        for(int i=1; i<argc; i++)
+        {
+            std::string arg = argv[i];
+            if(i+1 == argc) throw std::invalid_argument("Missing value for " + arg);
+            uint64_t value = std::stoull(argv[++i]);
+            if(arg == "--seed") seed = value;
+            else if(arg == "--runs") runs = value;
+            else if(arg == "--steps") steps = value;
+            else if(arg == "--log") log = value;
+            else throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n" << USAGE;
+        return 2;
+    }
+
+    uint64_t rejected = 0;
+    for(uint64_t s=seed; s<seed+runs; s++)
+    {
+        SchematicFuzzer::Params params = SchematicFuzzer::variant(s,steps);
+        for(bool differential : {false,true})
+        {
+            SchematicFuzzer::Result result = differential ? SchematicFuzzer::run_differential(params)
+                                                          : SchematicFuzzer::run(params);
+            rejected += result.rejected;
+            if(!result.ok)
+            {
+                std::cout << "FAILED: " << (differential ? "differential, " : "") << SchematicFuzzer::describe(params) << "\n"
+                          << "at call " << result.steps << ": " << result.error << "\n";
+                size_t first = result.log.size() > log ? result.log.size()-log : 0;
+                for(size_t i=first; i<result.log.size(); i++) std::cout << "  " << i+1 << ": " << result.log[i] << "\n";
+                return 1;
+            }
+        }
+    }
+    std::cout << runs << " runs of " << steps << " calls passed, each also as a differential run ("
+              << rejected << " calls rejected as expected)\n";
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "../schematic.h"
+#include "../schematicfile.h"
+#include "../schematicgen.h"
+
+static const char* USAGE =
+    "Usage: NodeManagerGen <pattern> <wires> [options]\n"
+    "Write a synthetic schematic as a wire list.\n"
+    "  pattern      grid, bus, star, forest, ports, chain or tiled\n"
+    "  --nets N     number of nets (default: one per 64 wires)\n"
+    "  --seed S     random seed (default: 1)\n"
+    "  --out PATH   wire list file (default: standard output)\n"
+    "  --nms PATH   also build the schematic and save it as a binary schematic file\n";
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr << USAGE;
+        return 2;
+    }
+    try
+    {
+        SchematicGenerator::Params params;
+        params.pattern = SchematicGenerator::pattern(argv[1]);
+        params.wires = std::stoull(argv[2]);
+        std::string out, nms;
+        for(int i=3; i<argc; i++)
+        {
+            std::string arg = argv[i];
+            if(i+1 == argc) throw std::invalid_argument("Missing value for " + arg);
+            std::string value = argv[++i];
+            if(arg == "--nets") params.nets = std::stoull(value);
+            else if(arg == "--seed") params.seed = std::stoull(value);
+            else if(arg == "--out") out = value;
+            else if(arg == "--nms") nms = value;
+            else throw std::invalid_argument("Unknown option " + arg);
+        }
+
+        SchematicGenerator::Design design = SchematicGenerator::generate(params);
+        if(out.empty()) SchematicGenerator::write(design,std::cout);
+        else SchematicGenerator::write_file(design,out);
+        if(!nms.empty())
+        {
+            Schematic sch(design.name);
+            SchematicGenerator::add_to(design,sch);
+            SchematicFile::save(sch,nms);
+        }
+        std::cerr << design.wires.size() << " wires, " << design.ports.size() << " ports, "
+                  << design.nets << " nets\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n" << USAGE;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "../sessiontrace.h"
+
+static const char* USAGE =
+    "Usage: NodeManagerReplay <trace> [--summary]\n"
+    "Replay a session trace (see SessionTrace) and print the latency of each call type.\n"
+    "  --summary    leave out the histograms\n"
+    "Exits with 1 if the final nets differ from the recorded ones.\n";
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2 || argc > 3 || (argc == 3 && std::string(argv[2]) != "--summary"))
+    {
+        std::cerr << USAGE;
+        return 2;
+    }
+    try
+    {
+        SessionTrace::Report report = SessionTrace::replay(argv[1]);
+        SessionTrace::print(report,std::cout,argc == 2);
+        return report.complete && !report.nets_match ? 1 : 0;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
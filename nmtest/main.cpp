@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include "../allocationcounter.h"  // allocation stats in NM_INSTRUMENT builds
 
 int main(int argc, char *argv[])
 {
@@ -0,0 +1,153 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <random>
+#include <cstdio>
+#include <filesystem>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../editlog.h"
+
+using namespace testing;
+using std::string;
+using Estd::Vec;
+using Wire = Schematic::Wire;
+
+
+class EditLogTestFixture : public Test
+{
+public:
+    Schematic sch{"sheet1"};
+    string path;
+    EditLogTestFixture()
+    {
+        path = (std::filesystem::temp_directory_path() / "nmtest_editlog.log").string();
+        for(int i=0; i<6; i++) sch.add_wire(Coordinate2(0,2*i),Coordinate2(10,2*i));
+        sch.set_undo_limit(20);
+    }
+    ~EditLogTestFixture()
+    {
+        for(uint64_t g=0; g<10; g++) std::remove(EditLog::checkpoint_path(path,g).c_str());
+        std::remove(path.c_str());
+    }
+
+    // Everything recovery must reproduce
+    static std::tuple<Vec<Wire>,std::map<string,Vec<Wire>>,Vec<Schematic::Port>> state(Schematic& s)
+    {
+        std::map<string,Vec<Wire>> nets;
+        for(auto& nn : s.get_all_netnames())
+        {
+            nets[nn] = s.select_net(nn);
+            Estd::sort(nets[nn]);  // nets sharing a port name come in any order
+        }
+        return {s.get_all_wires(),nets,s.snapshot()->ports()};
+    }
+
+    // Random edits of every kind that the log records
+    void edit(std::mt19937& rng, int steps)
+    {
+        auto coord = [&rng]() {return Coordinate2(rng()%12,rng()%12);};
+        for(int step=0; step<steps; step++)
+        {
+            int op = rng()%14;
+            if(op < 4)
+            {
+                Coordinate2 a = coord();
+                Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%12) : Coordinate2(rng()%12,a.y);
+                sch.add_wire(a,b,rng()%4 != 0);
+            }
+            else if(op < 5)
+            {
+                Vec<std::pair<Coordinate2,Coordinate2>> segments;
+                for(int i=0; i<3; i++)
+                {
+                    Coordinate2 a = coord();
+                    segments.push_back({a,Coordinate2(a.x,rng()%12)});
+                }
+                sch.add_wires(segments);
+            }
+            else if(op < 7)
+            {
+                Vec<Wire> wires = sch.get_all_wires();
+                if(!wires.empty()) sch.remove_wire(wires[rng()%wires.size()]);
+            }
+            else if(op < 8) sch.add_port_node(Schematic::Port{coord(),string("P")+char('a'+rng()%3)});
+            else if(op < 9) sch.remove_port_nodes(string("P")+char('a'+rng()%3));
+            else if(op < 10) sch.undo();
+            else if(op < 11) sch.redo();
+            else if(op < 12) sch.set_lazy(!sch.lazy());
+            else if(op < 13) sch.get_all_netnames();  // resolves in lazy mode
+            else if(rng()%4 == 0) sch.compact();
+        }
+    }
+};
+
+TEST_F(EditLogTestFixture, EditLogRecoveryReplaysEditsExactly)
+{
+    std::mt19937 rng(9);
+    EditLog log(path,4);
+    log.start(sch);
+    edit(rng,150);
+    log.checkpoint();  // compaction: later edits go to a fresh log
+    EXPECT_EQ(log.records(),0);
+    EXPECT_EQ(log.generation(),2);
+    EXPECT_FALSE(std::filesystem::exists(EditLog::checkpoint_path(path,1)));
+    edit(rng,150);
+    auto expected = state(sch);
+    log.sync();
+
+    Schematic recovered;
+    recovered.set_undo_limit(8);
+    EXPECT_EQ(EditLog::recover(recovered,path),log.records());
+    EXPECT_EQ(recovered.name,"sheet1");
+    EXPECT_EQ(state(recovered),expected);
+
+    // Both carry on with the same ids and names
+    recovered.set_lazy(sch.lazy());
+    for(int i=0; i<5; i++)
+    {
+        Coordinate2 a(i,20), b(i,30+i);
+        EXPECT_EQ(recovered.add_wire(a,b),sch.add_wire(a,b));
+    }
+    EXPECT_EQ(state(recovered),state(sch));
+    EXPECT_TRUE(recovered.undo());  // the undo limit is back after recovery
+}
+
+TEST_F(EditLogTestFixture, EditLogRecoveryStopsAtTornRecord)
+{
+    EditLog log(path,1);  // every record synced
+    log.start(sch);
+    sch.add_wire(Coordinate2(20,0),Coordinate2(20,10));
+    auto expected = state(sch);
+    sch.add_port_node(Schematic::Port{Coordinate2(20,5),"out"});
+    log.stop();
+    EXPECT_EQ(log.records(),2);
+
+    // A crash while writing the last record
+    std::filesystem::resize_file(path,std::filesystem::file_size(path)-3);
+    Schematic recovered;
+    EXPECT_EQ(EditLog::recover(recovered,path),1);
+    EXPECT_EQ(state(recovered),expected);
+
+    // Not a log
+    std::filesystem::resize_file(path,4);
+    EXPECT_THROW(EditLog::recover(recovered,path),std::runtime_error);
+}
+
+TEST_F(EditLogTestFixture, EditLogOnlyWritesWhenBatchIsFull)
+{
+    EditLog log(path,3);
+    log.start(sch);
+    auto size = std::filesystem::file_size(path);
+    sch.add_wire(Coordinate2(20,0),Coordinate2(20,10));
+    sch.add_wire(Coordinate2(30,0),Coordinate2(30,10));
+    EXPECT_EQ(std::filesystem::file_size(path),size);
+    sch.add_wire(Coordinate2(40,0),Coordinate2(40,10));
+    EXPECT_EQ(std::filesystem::file_size(path),size+log.log_bytes());
+
+    // Edits after stop() are not logged
+    log.stop();
+    sch.add_wire(Coordinate2(50,0),Coordinate2(50,10));
+    EXPECT_EQ(log.records(),3);
+}
@@ -0,0 +1,106 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../netlistwriter.h"
+
+using namespace testing;
+using std::string;
+using Format = NetlistWriter::Format;
+
+
+class NetlistWriterTestFixture : public Test
+{
+public:
+    Schematic sch{"sheet1"};
+    NetlistWriterTestFixture()
+    {
+        sch.add_wire(Coordinate2(0,0),Coordinate2(0,5));
+        sch.add_wire(Coordinate2(0,5),Coordinate2(2.5,5));
+        sch.add_wire(Coordinate2(10,0),Coordinate2(10,-1.25));
+        sch.add_port_node(Schematic::Port{Coordinate2(10,0),"Out,1"});
+    }
+    string write(Format format)
+    {
+        std::ostringstream out;
+        NetlistWriter::write(*sch.snapshot(),format,out);
+        return out.str();
+    }
+};
+
+TEST_F(NetlistWriterTestFixture, NetlistWriterSpice)
+{
+    EXPECT_EQ(write(Format::SPICE),
+              "* schematic sheet1\n"
+              "* net 0\n"
+              "W0 0 0 1 0 0 0 5\n"
+              "W1 0 1 2 0 5 2.5 5\n"
+              "* net out,1\n"
+              "W2 out,1 3 4 10 0 10 -1.25\n"
+              "P0 out,1 10 0\n"
+              ".end\n");
+}
+
+TEST_F(NetlistWriterTestFixture, NetlistWriterCsv)
+{
+    EXPECT_EQ(write(Format::CSV),
+              "type,name,id1,id2,x1,y1,x2,y2\n"
+              "wire,0,0,1,0,0,0,5\n"
+              "wire,0,1,2,0,5,2.5,5\n"
+              "wire,\"out,1\",3,4,10,0,10,-1.25\n"
+              "port,\"out,1\",,,10,0,,\n");
+}
+
+TEST_F(NetlistWriterTestFixture, NetlistWriterJson)
+{
+    sch.name = "say \"hi\"";
+    EXPECT_EQ(write(Format::JSON),
+              "{\"name\":\"say \\\"hi\\\"\",\"nets\":[\n"
+              "{\"name\":\"0\",\"wires\":[[0,1,0,0,0,5],[1,2,0,5,2.5,5]]},\n"
+              "{\"name\":\"out,1\",\"wires\":[[3,4,10,0,10,-1.25]]}],\n"
+              "\"ports\":[\n"
+              "{\"name\":\"out,1\",\"x\":10,\"y\":0}]}\n");
+}
+
+TEST_F(NetlistWriterTestFixture, NetlistWriterRejectsUnwritableSpiceNames)
+{
+    sch.add_port_node(Schematic::Port{Coordinate2(0,5),"in 1"});
+    EXPECT_THROW(write(Format::SPICE),std::runtime_error);
+    EXPECT_THAT(write(Format::CSV),HasSubstr("port,in 1,"));
+    sch.remove_port_nodes("in 1");
+    sch.name = "sheet1\nW9 x";
+    EXPECT_THROW(write(Format::SPICE),std::runtime_error);
+}
+
+TEST_F(NetlistWriterTestFixture, NetlistWriterJsonWritesNonFiniteAsNull)
+{
+    sch.add_port_node(Schematic::Port{Coordinate2(std::numeric_limits<double>::infinity(),0),"far"});
+    sch.add_port_node(Schematic::Port{Coordinate2(1,std::nan("")),"lost"});
+    string json = write(Format::JSON);
+    EXPECT_THAT(json,HasSubstr("{\"name\":\"far\",\"x\":null,\"y\":0}"));
+    EXPECT_THAT(json,HasSubstr("{\"name\":\"lost\",\"x\":1,\"y\":null}"));
+    EXPECT_THAT(json,Not(HasSubstr("inf")));
+    EXPECT_THAT(json,Not(HasSubstr("nan")));
+}
+
+TEST(NetlistWriterSuite, NetlistWriterFlushesLargeOutputInBlocks)
+{
+    Schematic sch;
+    for(int i=0; i<3000; i++) sch.add_wire(Coordinate2(3*i,0.1*i),Coordinate2(3*i,0.1*i+1),false);
+    sch.update_nets();
+    string text;
+    size_t blocks = 0;
+    NetlistWriter::write(*sch.snapshot(),Format::CSV,[&](const char* data, size_t size) {
+        text.append(data,size);
+        blocks++;
+    });
+    EXPECT_GT(blocks,1);
+    EXPECT_EQ(std::count(text.begin(),text.end(),'\n'),3001);
+    EXPECT_THAT(text,HasSubstr("\nwire,2999,5998,5999,8997,"));
+    EXPECT_THAT(text,EndsWith("\n"));
+}
@@ -0,0 +1,164 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <random>
+#include <fstream>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../schematicfile.h"
+
+using namespace testing;
+using std::string;
+using Estd::Vec;
+using Wire = Schematic::Wire;
+
+
+class SchematicFileTestFixture : public Test
+{
+public:
+    Schematic sch{"sheet1"};
+    string path;
+    SchematicFileTestFixture()
+    {
+        path = (std::filesystem::temp_directory_path() / "nmtest_schematicfile.nms").string();
+        // Random wires on a small grid, so that wires cross, split and merge,
+        // and some removals so that vertex and net ids have gaps
+        std::mt19937 rng(11);
+        for(int step=0; step<150; step++)
+        {
+            Coordinate2 a(rng()%14,rng()%14);
+            Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%14) : Coordinate2(rng()%14,a.y);
+            sch.add_wire(a,b);
+            if(step%4 == 0)
+            {
+                Vec<Wire> wires = sch.get_all_wires();
+                sch.remove_wire(wires[rng()%wires.size()]);
+            }
+        }
+        sch.add_port_node(Schematic::Port{Coordinate2(3,3),"VDD"});
+        sch.add_port_node(Schematic::Port{Coordinate2(7,2),"GND"});
+        sch.add_port_node(Schematic::Port{Coordinate2(100,100),"NC"});
+    }
+    ~SchematicFileTestFixture() {std::remove(path.c_str());}
+};
+
+TEST_F(SchematicFileTestFixture, SchematicFileRoundTripIsExact)
+{
+    SchematicFile::save(sch,path);
+    Schematic loaded;
+    loaded.add_wire(Coordinate2(0,0),Coordinate2(0,1));  // replaced by the load
+    SchematicFile::load(loaded,path);
+
+    EXPECT_EQ(loaded.name,"sheet1");
+    EXPECT_EQ(loaded.get_all_wires(),sch.get_all_wires());
+    EXPECT_EQ(loaded.get_all_netnames(),sch.get_all_netnames());
+    for(auto& nn : sch.get_all_netnames()) EXPECT_EQ(loaded.select_net(nn),sch.select_net(nn));
+    EXPECT_EQ(loaded.select_port_nodes("vdd"),sch.select_port_nodes("vdd"));
+    EXPECT_EQ(loaded.select_port_node(Coordinate2(100,100)),sch.select_port_node(Coordinate2(100,100)));
+    EXPECT_FALSE(loaded.nets_dirty());
+
+    // Both continue the same way: same vertex ids and net names for new edits
+    std::mt19937 rng(5);
+    for(int step=0; step<40; step++)
+    {
+        Coordinate2 a(rng()%14,rng()%14);
+        Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%14) : Coordinate2(rng()%14,a.y);
+        EXPECT_EQ(loaded.add_wire(a,b),sch.add_wire(a,b));
+        if(step%3 == 0)
+        {
+            Vec<Wire> wires = sch.get_all_wires();
+            Wire w = wires[rng()%wires.size()];
+            sch.remove_wire(w);
+            loaded.remove_wire(w);
+        }
+        ASSERT_EQ(loaded.get_all_netnames(),sch.get_all_netnames());
+    }
+    for(auto& nn : sch.get_all_netnames()) EXPECT_EQ(loaded.select_net(nn),sch.select_net(nn));
+}
+
+TEST_F(SchematicFileTestFixture, SchematicFileRejectsBadFiles)
+{
+    SchematicFile::save(sch,path);
+    Vec<string> names = sch.get_all_netnames();
+    auto size = std::filesystem::file_size(path);
+
+    // Truncated
+    std::filesystem::resize_file(path,size-16);
+    EXPECT_THROW(SchematicFile::load(sch,path),std::runtime_error);
+    EXPECT_EQ(sch.get_all_netnames(),names);  // unchanged
+
+    // Not a schematic file
+    {
+        std::ofstream out(path,std::ios::binary | std::ios::trunc);
+        out << "This is not a schematic, but it is long enough to hold a header. "
+               "This is not a schematic, but it is long enough to hold a header.";
+    }
+    EXPECT_THROW(SchematicFile::load(sch,path),std::runtime_error);
+
+    // A numeric net name too large for any id
+    {
+        Schematic big;
+        big.add_wire(Coordinate2(0,0),Coordinate2(0,5));
+        big.add_port_node(Schematic::Port{Coordinate2(0,2),"x99999999999999999999999"});
+        SchematicFile::save(big,path);
+        std::fstream file(path,std::ios::binary | std::ios::in | std::ios::out);
+        string bytes((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+        auto at = bytes.find("x9999");
+        ASSERT_NE(at,string::npos);
+        file.seekp(at);
+        file.put('9');
+    }
+    EXPECT_THROW(SchematicFile::load(sch,path),std::runtime_error);
+    EXPECT_EQ(sch.get_all_netnames(),names);
+
+    // Corrupt header counts and vertex ids fail as malformed files, without
+    // allocating for them
+    auto patch = [this](size_t at, auto value) {
+        std::fstream file(path,std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(at);
+        file.write(reinterpret_cast<const char*>(&value),sizeof(value));
+    };
+    auto load_patched = [&](size_t at, auto value) {
+        SchematicFile::save(sch,path);
+        patch(at,value);
+        EXPECT_THROW(SchematicFile::load(sch,path),std::runtime_error);
+        EXPECT_EQ(sch.get_all_netnames(),names);
+    };
+    load_patched(offsetof(SchematicFile::Header,string_count),UINT64_MAX);
+    load_patched(offsetof(SchematicFile::Header,vertex_count),UINT64_MAX/2);
+    load_patched(offsetof(SchematicFile::Header,vertex_pool_size),uint64_t(INT32_MAX)+1);
+    {
+        SchematicFile::save(sch,path);
+        std::ifstream in(path,std::ios::binary);
+        SchematicFile::Header header;
+        in.read(reinterpret_cast<char*>(&header),sizeof(header));
+        // The vertex ids follow the header and the coordinates (2n doubles)
+        load_patched(sizeof(header)+16*header.vertex_count,int32_t(0x7ffffff0));
+    }
+
+    // Missing
+    std::remove(path.c_str());
+    EXPECT_THROW(SchematicFile::load(sch,path),std::runtime_error);
+    EXPECT_EQ(sch.get_all_netnames(),names);
+}
+
+TEST(SchematicFileSuite, SchematicFileRoundTripsEmptySchematic)
+{
+    string path = (std::filesystem::temp_directory_path() / "nmtest_empty.nms").string();
+    Schematic empty("empty");
+    SchematicFile::save(empty,path);
+    Schematic loaded;
+    SchematicFile::load(loaded,path);
+    std::remove(path.c_str());
+    EXPECT_EQ(loaded.name,"empty");
+    EXPECT_TRUE(loaded.get_all_wires().empty());
+    EXPECT_TRUE(loaded.get_all_netnames().empty());
+    loaded.add_wire(Coordinate2(0,0),Coordinate2(0,5));
+    EXPECT_EQ(loaded.get_all_netnames(),Vec<string>{"0"});
+}
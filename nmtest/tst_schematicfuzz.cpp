@@ -0,0 +1,70 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <string>
+#include "../schematic.h"
+#include "../schematicfuzz.h"
+
+using namespace testing;
+using std::string;
+
+
+TEST(SchematicFuzzSuite, RunsAreDeterministic)
+{
+    auto params = SchematicFuzzer::variant(3,200);
+    EXPECT_EQ(params.grid,SchematicFuzzer::variant(3).grid);
+    auto a = SchematicFuzzer::run(params);
+    auto b = SchematicFuzzer::run(params);
+    EXPECT_TRUE(a.ok) << a.error;
+    EXPECT_EQ(a.log,b.log);
+    EXPECT_EQ(a.steps,201);
+    EXPECT_EQ(a.log.back(),"verify_nets");
+    EXPECT_NE(SchematicFuzzer::run(SchematicFuzzer::variant(4,200)).log,a.log);
+
+    params.grid = 1;
+    EXPECT_THROW(SchematicFuzzer::run(params),std::invalid_argument);
+}
+
+TEST(SchematicFuzzSuite, RandomEditsKeepNetsConsistent)
+{
+    // Seed 8 undid and redid an edit that resolved pending nets
+    for(uint64_t seed=1; seed<=24; seed++)
+    {
+        auto params = SchematicFuzzer::variant(seed,400);
+        auto result = SchematicFuzzer::run(params);
+        EXPECT_TRUE(result.ok) << SchematicFuzzer::describe(params) << ": " << result.error
+                               << " after " << (result.log.empty() ? string() : result.log.back());
+    }
+}
+
+TEST(SchematicFuzzSuite, DifferentialRunsAgree)
+{
+    for(uint64_t seed=1; seed<=12; seed++)
+    {
+        auto params = SchematicFuzzer::variant(seed,300);
+        auto result = SchematicFuzzer::run_differential(params);
+        EXPECT_TRUE(result.ok) << "differential, " << SchematicFuzzer::describe(params) << ": " << result.error
+                               << " after " << (result.log.empty() ? string() : result.log.back());
+        EXPECT_EQ(result.log.back(),"compare");
+    }
+    EXPECT_EQ(SchematicFuzzer::run_differential(SchematicFuzzer::variant(5,100)).log,
+              SchematicFuzzer::run_differential(SchematicFuzzer::variant(5,100)).log);
+}
+
+TEST(SchematicFuzzSuite, VerificationChecksEveryUpdate)
+{
+    Schematic sch;
+    EXPECT_FALSE(sch.verification());
+    sch.set_verification(true);
+    sch.set_undo_limit(5);
+    sch.set_concurrent_readers(true);
+    sch.add_wire(Coordinate2(0,0),Coordinate2(0,10));
+    sch.add_wire(Coordinate2(0,10),Coordinate2(10,10));
+    sch.add_wire(Coordinate2(5,0),Coordinate2(5,10),false);
+    sch.add_port_node({{5,10},"vdd"});
+    sch.snapshot();
+    sch.undo();
+    sch.compact();
+    EXPECT_NO_THROW(sch.verify_nets());
+    EXPECT_EQ(sch.get_all_wires().size(),2);
+    EXPECT_EQ(sch.get_all_netnames().size(),1);
+}
@@ -0,0 +1,72 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sstream>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../schematicgen.h"
+#include "../wirelist.h"
+
+using namespace testing;
+using std::string;
+using Estd::Vec;
+using Pattern = SchematicGenerator::Pattern;
+
+static const Vec<Pattern> ALL_PATTERNS{Pattern::GRID,Pattern::BUS,Pattern::STAR,Pattern::FOREST,
+                                       Pattern::PORTS,Pattern::CHAIN,Pattern::TILED};
+
+
+TEST(SchematicGenSuite, DesignsAreDeterministic)
+{
+    for(Pattern p : ALL_PATTERNS)
+    {
+        SCOPED_TRACE(SchematicGenerator::pattern_name(p));
+        EXPECT_EQ(SchematicGenerator::pattern(SchematicGenerator::pattern_name(p)),p);
+        auto a = SchematicGenerator::generate({p,500,9,3});
+        auto b = SchematicGenerator::generate({p,500,9,3});
+        EXPECT_EQ(a.wires,b.wires);
+        EXPECT_EQ(a.ports,b.ports);
+        EXPECT_EQ(a.nets,p == Pattern::TILED ? 15*7 : 9);
+        EXPECT_EQ(a.wires.size(),p == Pattern::TILED ? 15*35 : 500);
+    }
+    // Only the random patterns depend on the seed
+    EXPECT_NE(SchematicGenerator::generate({Pattern::FOREST,500,9,3}).wires,
+              SchematicGenerator::generate({Pattern::FOREST,500,9,4}).wires);
+    EXPECT_EQ(SchematicGenerator::generate({Pattern::GRID,500,9,3}).wires,
+              SchematicGenerator::generate({Pattern::GRID,500,9,4}).wires);
+    EXPECT_THROW(SchematicGenerator::pattern("mesh"),std::invalid_argument);
+}
+
+TEST(SchematicGenSuite, DesignsResolveToTheirNets)
+{
+    for(Pattern p : ALL_PATTERNS)
+    {
+        SCOPED_TRACE(SchematicGenerator::pattern_name(p));
+        auto design = SchematicGenerator::generate({p,800,0,11});
+        Schematic sch;
+        SchematicGenerator::add_to(design,sch);
+        EXPECT_EQ(sch.get_all_netnames().size(),design.nets);
+        // Chains are merged into one wire per net
+        if(p == Pattern::CHAIN) EXPECT_EQ(sch.get_all_wires().size(),design.nets);
+        if(p == Pattern::PORTS) EXPECT_THAT(sch.get_all_netnames(),Each(StartsWith("net")));
+    }
+}
+
+TEST(SchematicGenSuite, WireListMatchesAddingWiresOneByOne)
+{
+    for(Pattern p : {Pattern::STAR,Pattern::PORTS})
+    {
+        auto design = SchematicGenerator::generate({p,300,4,5});
+        Schematic expected;
+        SchematicGenerator::add_to(design,expected,false);
+
+        std::stringstream text;
+        SchematicGenerator::write(design,text);
+        Schematic sch;
+        WireListReader().read(sch,text);
+        EXPECT_EQ(sch.name,design.name);
+        EXPECT_EQ(sch.get_all_wires(),expected.get_all_wires());
+        ASSERT_EQ(sch.get_all_netnames(),expected.get_all_netnames());
+        for(auto& nn : sch.get_all_netnames()) EXPECT_EQ(sch.select_net(nn),expected.select_net(nn));
+    }
+}
@@ -3,8 +3,17 @@
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <set>
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <array>
+#include <algorithm>
 #include "../coordinate2.h"
 #include "../schematic.h"
+#include "../threadpool.h"
 
 using namespace testing;
 using std::string;
@@ -214,6 +223,28 @@ TEST_F(SchematicTestFixtureWithWires, SchematicTestRemoveWireWorks)
     EXPECT_EQ(sch.get_all_wires().size(),33);
 }
 
+TEST_F(SchematicTestFixtureWithWires, SchematicTestTryLookupsMissWithoutThrowing)
+{
+    sch.set_concurrent_readers(true);
+    Wire w = sch.select_wire({16,9});
+    ASSERT_NE(w,Schematic::INVALID_WIRE);
+    string name = sch.get_netname(w);
+    EXPECT_EQ(sch.try_get_netname(w),std::optional<string>(name));
+    EXPECT_EQ(sch.try_get_netname({w.second,w.first}),std::optional<string>(name));
+    EXPECT_EQ(sch.try_select_net(name),std::optional<Estd::Vec<Wire>>(sch.select_net(name)));
+    EXPECT_EQ(sch.try_get_netname({-5,-6}),std::nullopt);
+    EXPECT_EQ(sch.try_select_net("nosuchnet"),std::nullopt);
+    EXPECT_THROW(sch.get_netname({-5,-6}),std::invalid_argument);
+    EXPECT_THROW(sch.select_net("nosuchnet"),std::invalid_argument);
+
+    auto conn = sch.connectivity();
+    EXPECT_EQ(conn->try_get_netname(w),std::optional<string>(name));
+    EXPECT_EQ(conn->try_select_net(name),std::optional<Estd::Vec<Wire>>(conn->select_net(name)));
+    EXPECT_EQ(conn->try_get_netname({-5,-6}),std::nullopt);
+    EXPECT_EQ(conn->try_select_net("nosuchnet"),std::nullopt);
+    EXPECT_THROW(conn->get_netname({-5,-6}),std::invalid_argument);
+}
+
 TEST_F(SchematicTestFixtureWithWires, SchematicTestNetRenamingAlgorithm)
 {
     using std::cout;
@@ -256,6 +287,662 @@ TEST_F(SchematicTestFixtureWithWires, SchematicTestNetRenamingAlgorithm)
 
 }
 
+TEST_F(SchematicTestFixtureWithWires, SchematicTestCompactRemapsWiresAndNets)
+{
+    using Estd::Vec;
+    // Remove two nets to leave gaps in the vertex ids and net numbers
+    Wire w = sch.select_wire({20,8});
+    string nn1 = sch.get_netname(w);
+    sch.remove_wire(sch.select_wire({16,9}));
+    sch.remove_wire(sch.select_wire({20,8}));
+    w = sch.select_wire({40,8});
+    string nn2 = sch.get_netname(w);
+    sch.remove_wire(sch.select_wire({45,10}));
+    sch.remove_wire(sch.select_wire({40,8}));
+    EXPECT_EQ(sch.get_all_netnames().size(),5);
+
+    Wire held = sch.select_wire({70,30});
+    string held_net = sch.get_netname(held);
+    std::map<string,string> renames;
+    std::map<int,int> id_map = sch.compact(&renames);
+
+    // Vertex ids are dense, wires are remapped
+    std::set<int> vids;
+    for(auto& wn : sch.get_all_wires())
+    {
+        vids.insert(wn.first);
+        vids.insert(wn.second);
+    }
+    EXPECT_EQ(vids.size(),id_map.size());
+    EXPECT_EQ(*vids.rbegin(),id_map.size()-1);
+    Wire held_new(id_map[held.first],id_map[held.second]);
+    EXPECT_EQ(sch.select_wire({70,30}),held_new);
+
+    // Integer nets are dense, renamed nets are reported
+    EXPECT_THAT(sch.get_all_netnames(),ElementsAre("0","1","2","3","4"));
+    string new_name = renames.count(held_net) ? renames[held_net] : held_net;
+    EXPECT_EQ(sch.get_netname(held_new),new_name);
+
+    // New nets continue after the last number
+    sch.add_wire({0,0},{0,5});
+    EXPECT_EQ(sch.get_netname(sch.select_wire({0,1})),"5");
+}
+
+TEST_F(SchematicTestFixtureWithWires, SchematicTestHandlesSurviveUnrelatedEdits)
+{
+    Wire w1 = sch.select_wire({20,8});        // net 1
+    Wire w6 = sch.select_wire({70,30});       // net 6
+    Wire w7 = sch.select_wire({70,14});       // net 7
+    Schematic::WireHandle h1 = sch.get_wire_handle(w1);
+    Schematic::WireHandle h6 = sch.get_wire_handle({w6.second,w6.first});  // either order
+    Schematic::WireHandle h7 = sch.get_wire_handle(w7);
+    Schematic::NetHandle n1 = sch.get_net_handle(sch.get_netname(w1));
+    Schematic::NetHandle n6 = sch.get_net_handle(sch.get_netname(w6));
+    EXPECT_EQ(sch.resolve(h1),w1);
+    EXPECT_EQ(sch.resolve(h6),w6);
+    EXPECT_EQ(sch.get_wire_handle(Schematic::INVALID_WIRE),Schematic::WireHandle({-1,0}));
+
+    // Unrelated edits keep handles valid
+    sch.add_wire({0,0},{10,0});
+    sch.remove_wire(sch.select_wire({40,8}));
+    EXPECT_EQ(sch.resolve(h1),w1);
+    EXPECT_EQ(sch.resolve(h6),w6);
+    EXPECT_EQ(sch.resolve(h7),w7);
+    EXPECT_EQ(sch.resolve(n1),sch.get_netname(w1));
+
+    // Splitting a wire rejects its handle
+    sch.add_wire({70,30},{70,40});
+    EXPECT_EQ(sch.resolve(h6),Schematic::INVALID_WIRE);
+    EXPECT_EQ(sch.resolve(n6),sch.get_netname(sch.select_wire({64,30})));
+
+    // Removing a wire rejects its handle, and the slot's reuse doesn't revive it
+    sch.remove_wire(w7);
+    EXPECT_EQ(sch.resolve(h7),Schematic::INVALID_WIRE);
+    sch.add_wire({100,0},{100,10});
+    EXPECT_EQ(sch.resolve(h7),Schematic::INVALID_WIRE);
+
+    // Removing a net rejects the net handle
+    sch.remove_wire(sch.select_wire({16,10}));
+    sch.remove_wire(w1);
+    EXPECT_EQ(sch.resolve(h1),Schematic::INVALID_WIRE);
+    EXPECT_EQ(sch.resolve(n1),"");
+
+    // Handles survive compaction
+    Wire w5 = sch.select_wire({15,51});
+    Schematic::WireHandle h5 = sch.get_wire_handle(w5);
+    std::map<int,int> id_map = sch.compact();
+    EXPECT_EQ(sch.resolve(h5),Wire(id_map[w5.first],id_map[w5.second]));
+}
+
+TEST_F(SchematicTestFixtureWithWires, SchematicTestNetHandlesRejectReusedNames)
+{
+    string name1 = sch.get_netname(sch.select_wire({20,8}));
+    string name2 = sch.get_netname(sch.select_wire({40,8}));
+    string name3 = sch.get_netname(sch.select_wire({45,20}));
+    Schematic::NetHandle n1 = sch.get_net_handle(name1);
+    Schematic::NetHandle n2 = sch.get_net_handle(name2);
+    Schematic::NetHandle n3 = sch.get_net_handle(name3);
+
+    // Merge nets 1 and 2 and draw a new net in one resolution; the new net takes
+    // the name freed by the merge, but the old handles don't follow it
+    sch.set_lazy(true);
+    sch.add_wire({29,8},{35,8});
+    sch.add_wire({100,0},{100,10});
+    string merged = sch.get_netname(sch.select_wire({32,8}));
+    string fresh = sch.get_netname(sch.select_wire({100,5}));
+    ASSERT_TRUE(fresh == name1 || fresh == name2);
+    EXPECT_EQ(sch.resolve(n1),"");
+    EXPECT_EQ(sch.resolve(n2),"");
+    EXPECT_NE(sch.get_net_handle(merged),n1);
+    EXPECT_NE(sch.get_net_handle(fresh),n2);
+    EXPECT_EQ(sch.resolve(n3),name3);
+
+    // A port renames net 3, and the freed name goes to a new net
+    sch.add_port_node({{45,22},"Vcc"});
+    sch.add_wire({110,0},{110,10});
+    EXPECT_EQ(sch.get_netname(sch.select_wire({110,5})),name3);
+    EXPECT_EQ(sch.resolve(n3),"");
+
+    // Splitting a net rejects its handle
+    Schematic::NetHandle n4 = sch.get_net_handle(sch.get_netname(sch.select_wire({30,29})));
+    sch.remove_wire(sch.select_wire({30,29}));
+    sch.get_all_netnames();
+    EXPECT_EQ(sch.resolve(n4),"");
+}
+
+TEST_F(SchematicTestFixtureWithWires, SchematicTestNetEventsDescribeChanges)
+{
+    using Estd::Vec;
+    Vec<Schematic::NetEvent> events;
+    int calls = 0;
+    int sub = sch.subscribe_nets([&](const Vec<Schematic::NetEvent>& evs) {
+        events = evs;
+        calls++;
+    });
+
+    // New isolated wire creates a net
+    sch.add_wire({0,0},{10,0});
+    ASSERT_EQ(events.size(),1);
+    EXPECT_EQ(events[0].type,NetChangeType::NET_CREATED);
+    EXPECT_EQ(events[0].name,sch.get_netname(sch.select_wire({5,0})));
+    EXPECT_EQ(events[0].added.size(),1);
+
+    // Extending a net modifies it
+    sch.add_wire({0,0},{0,10});
+    ASSERT_EQ(events.size(),1);
+    EXPECT_EQ(events[0].type,NetChangeType::NET_MODIFIED);
+    EXPECT_EQ(events[0].added,Vec<Wire>{sch.select_wire({0,5})});
+    EXPECT_TRUE(events[0].removed.empty());
+
+    // Resolving without changes sends nothing
+    int calls_before = calls;
+    sch.update_nets();
+    EXPECT_EQ(calls,calls_before);
+
+    // Joining nets 1 and 2 merges them
+    string nn1 = sch.get_netname(sch.select_wire({16,10}));
+    string nn2 = sch.get_netname(sch.select_wire({45,10}));
+    sch.add_wire({29,8},{35,8});
+    ASSERT_EQ(events.size(),1);
+    EXPECT_EQ(events[0].type,NetChangeType::NET_MERGED);
+    string merged = sch.get_netname(sch.select_wire({16,10}));
+    EXPECT_EQ(events[0].name,merged);
+    EXPECT_THAT(events[0].sources,ElementsAre(merged == nn1 ? nn2 : nn1));
+
+    // Cutting it again splits off a new net
+    sch.remove_wire(sch.select_wire({30,8}));
+    ASSERT_EQ(events.size(),2);
+    EXPECT_EQ(events[0].type,NetChangeType::NET_MODIFIED);
+    EXPECT_EQ(events[0].name,merged);
+    EXPECT_EQ(events[1].type,NetChangeType::NET_SPLIT);
+    EXPECT_THAT(events[1].sources,ElementsAre(merged));
+
+    // A port renames a net
+    string nn6 = sch.get_netname(sch.select_wire({70,30}));
+    sch.add_port_node({{70,30},"Vcc"});
+    ASSERT_EQ(events.size(),1);
+    EXPECT_EQ(events[0].type,NetChangeType::NET_RENAMED);
+    EXPECT_EQ(events[0].name,"vcc");
+    EXPECT_THAT(events[0].sources,ElementsAre(nn6));
+    EXPECT_TRUE(events[0].added.empty());
+
+    // Removing the last wire deletes a net
+    string nn0 = sch.get_netname(sch.select_wire({5,0}));
+    sch.remove_wire(sch.select_wire({0,5}));
+    sch.remove_wire(sch.select_wire({5,0}));
+    ASSERT_EQ(events.size(),1);
+    EXPECT_EQ(events[0].type,NetChangeType::NET_DELETED);
+    EXPECT_EQ(events[0].name,nn0);
+
+    // No more events after unsubscribing
+    sch.unsubscribe_nets(sub);
+    calls_before = calls;
+    sch.add_wire({0,0},{10,0});
+    EXPECT_EQ(calls,calls_before);
+}
+
+TEST_F(SchematicTestFixtureWithWires, SchematicTestSnapshotsShareUnchangedParts)
+{
+    using Estd::Vec;
+    std::shared_ptr<const SchematicSnapshot> snap1 = sch.snapshot();
+    EXPECT_EQ(sch.snapshot(),snap1);  // nothing changed
+    EXPECT_EQ(snap1->get_all_netnames(),sch.get_all_netnames());
+    Vec<Schematic::Wire> wires = sch.get_all_wires();
+    Estd::sort(wires);
+    EXPECT_EQ(snap1->get_all_wires(),wires);
+    for(auto& nn : sch.get_all_netnames())
+    {
+        EXPECT_EQ(snap1->select_net(nn),sch.select_net(nn));
+    }
+
+    // An isolated wire leaves all other nets (and the ports) shared
+    Vec<string> names_before = sch.get_all_netnames();
+    sch.add_wire(Coordinate2(100,100),Coordinate2(100,110));
+    std::shared_ptr<const SchematicSnapshot> snap2 = sch.snapshot();
+    ASSERT_NE(snap2,snap1);
+    EXPECT_EQ(&snap2->ports(),&snap1->ports());
+    for(auto& pair : snap1->nets())
+    {
+        auto itr = snap2->nets().find(pair.first);
+        ASSERT_NE(itr,snap2->nets().end());
+        EXPECT_EQ(itr->second,pair.second);
+    }
+    EXPECT_EQ(snap2->nets().size(),snap1->nets().size()+1);
+    Vec<SchematicSnapshot::Segment> segs = snap2->select_net_segments(sch.get_netname(sch.select_wire(Coordinate2(100,105))));
+    ASSERT_EQ(segs.size(),1);
+    EXPECT_EQ(segs[0].first.x,100);
+
+    // snap1 still shows the old state
+    EXPECT_EQ(snap1->get_all_netnames(),names_before);
+
+    // A port copies the port list, not the nets it does not touch
+    sch.add_port_node(Schematic::Port{Coordinate2(100,100),"VDD"});
+    std::shared_ptr<const SchematicSnapshot> snap3 = sch.snapshot();
+    EXPECT_NE(&snap3->ports(),&snap2->ports());
+    EXPECT_EQ(snap3->ports().size(),snap2->ports().size()+1);
+    EXPECT_EQ(snap3->select_net("vdd").size(),1);
+    EXPECT_THROW(snap3->select_net("nonexistent"),std::invalid_argument);
+}
+
+TEST_F(SchematicTestFixtureWithWires, SchematicTestSnapshotResolvesPendingEditsAndReuses)
+{
+    // An unresolved edit outside lazy mode
+    sch.add_wire(Coordinate2(100,100),Coordinate2(100,110),false);
+    ASSERT_TRUE(sch.nets_dirty());
+    std::shared_ptr<const SchematicSnapshot> snap;
+    ASSERT_NO_THROW(snap = sch.snapshot());
+    EXPECT_FALSE(sch.nets_dirty());
+    EXPECT_EQ(snap->get_all_netnames(),sch.get_all_netnames());
+
+    // Nothing changed: the same snapshot, without allocating (counted with NM_INSTRUMENT)
+    uint64_t allocations = Estd::total_allocations();
+    std::shared_ptr<const SchematicSnapshot> again = sch.snapshot();
+    EXPECT_EQ(Estd::total_allocations(),allocations);
+    EXPECT_EQ(again,snap);
+}
+
+TEST_F(SchematicTestFixture, SchematicLazyModeResolvesOnceOnQuery)
+{
+    using Estd::Vec;
+    int resolutions = 0;
+    sch.subscribe_nets([&](const Vec<Schematic::NetEvent>&) {resolutions++;});
+    sch.set_lazy(true);
+
+    // A burst of edits only marks the nets as stale
+    sch.add_wire({0,0},{0,5});
+    sch.add_wire({0,5},{0,10});   // collinear, merged on resolution
+    sch.add_wire({0,10},{5,10});
+    sch.add_wire({20,0},{20,5});
+    EXPECT_EQ(resolutions,0);
+    EXPECT_TRUE(sch.nets_dirty());
+
+    // First query resolves everything once
+    EXPECT_THAT(sch.get_all_netnames(),ElementsAre("0","1"));
+    EXPECT_EQ(resolutions,1);
+    EXPECT_FALSE(sch.nets_dirty());
+    EXPECT_EQ(sch.get_all_wires().size(),3);
+    EXPECT_EQ(sch.select_net("0").size(),2);
+    EXPECT_EQ(resolutions,1);
+
+    // Port edits resolve pending edits and themselves at once
+    sch.add_wire({30,0},{30,5});
+    sch.add_port_node({{20,5},"Out"});
+    EXPECT_EQ(resolutions,3);
+    EXPECT_FALSE(sch.nets_dirty());
+    EXPECT_EQ(sch.get_netname(sch.select_wire({20,1})),"out");
+
+    // Removing resolves on the next query as well
+    sch.remove_wire(sch.select_wire({3,10}));
+    sch.add_wire({40,0},{40,5});
+    EXPECT_EQ(resolutions,3);
+    EXPECT_THAT(sch.get_all_netnames(),ElementsAre("0","1","2","out"));
+    EXPECT_EQ(resolutions,4);
+    EXPECT_EQ(sch.select_net(Coordinate2{0,3}).size(),1);
+
+    // Leaving lazy mode resolves pending edits
+    sch.add_wire({50,0},{50,5});
+    sch.set_lazy(false);
+    EXPECT_FALSE(sch.nets_dirty());
+    EXPECT_EQ(resolutions,5);
+}
+
+// Nets of a schematic as name -> sorted wire segments {x1,y1,x2,y2}. Numbered
+// names depend on the nets that existed between edits, so they read as "", and
+// without `names` all do.
+static vector<pair<string,vector<std::array<double,4>>>> net_segments(Schematic& sch, bool names)
+{
+    vector<pair<string,vector<std::array<double,4>>>> nets;
+    auto snap = sch.snapshot();
+    for(auto& net : snap->nets())
+    {
+        vector<std::array<double,4>> segments;
+        for(auto& s : net.second->segments)
+        {
+            std::array<double,4> a{s.first.x,s.first.y,s.second.x,s.second.y};
+            std::array<double,4> b{s.second.x,s.second.y,s.first.x,s.first.y};
+            segments.push_back(std::min(a,b));
+        }
+        std::sort(segments.begin(),segments.end());
+        nets.push_back({names && !netname_is_int(net.first) ? net.first : "",segments});
+    }
+    std::sort(nets.begin(),nets.end());
+    return nets;
+}
+
+TEST(SchematicLazySuite, LazyModeMatchesEagerMode)
+{
+    using Edits = std::function<void(Schematic&)>;
+    auto expect_same = [](const Edits& edits, bool names)
+    {
+        Schematic eager, lazy;
+        lazy.set_lazy(true);
+        edits(eager);
+        edits(lazy);
+        EXPECT_EQ(net_segments(lazy,names),net_segments(eager,names));
+        EXPECT_EQ(lazy.get_all_wires(),eager.get_all_wires());
+        EXPECT_EQ(lazy.get_all_netnames().size(),eager.get_all_netnames().size());
+    };
+
+    // Collinear wires left unmerged by a lazy edit must not change what a later
+    // wire is checked against
+    expect_same([](Schematic& sch)
+    {
+        sch.add_wire({5,3},{11,9});
+        sch.add_wire({6,6},{10,6});
+        sch.add_wire({7,6},{11,6});
+        sch.add_wire({8,6},{13,6});
+    },true);
+
+    // A port names the net it was added to, not one a later wire joins it to
+    expect_same([](Schematic& sch)
+    {
+        sch.add_wire({0,3},{6,9});
+        sch.add_wire({0,4},{0,9});
+        sch.add_port_node({{0,7},"a"});
+        sch.add_port_node({{9,9},"a"});
+        sch.add_wire({6,9},{12,9});
+        EXPECT_EQ(sch.select_net("a").size(),1);
+        EXPECT_EQ(sch.get_all_netnames().size(),2);
+    },true);
+
+    // Random edits on a small grid, so that wires cross, split and merge. A port
+    // that a later wire reaches can name the net in lazy mode only, so compare
+    // the nets without their names.
+    for(unsigned seed=1; seed<=5; seed++)
+    {
+        expect_same([seed](Schematic& sch)
+        {
+            std::mt19937 rng(seed);
+            auto coord = [&rng]() {return Coordinate2(rng()%12,rng()%12);};
+            for(int step=0; step<60; step++)
+            {
+                int op = rng()%10;
+                if(op < 6)
+                {
+                    Coordinate2 a = coord();
+                    Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%12) : Coordinate2(rng()%12,a.y);
+                    sch.add_wire(a,b);
+                }
+                else if(op < 8)
+                {
+                    Coordinate2 p = coord();
+                    Wire w = sch.select_wire(p);
+                    if(w != Schematic::INVALID_WIRE) sch.remove_wire(w);
+                }
+                else sch.add_port_node({coord(),string("p")+char('a'+rng()%3)});
+            }
+        },false);
+    }
+}
+
+TEST_F(SchematicTestFixtureWithWires, SchematicTestVersionsTrackChanges)
+{
+    sch.track_net_versions(true);
+    string nn1 = sch.get_netname(sch.select_wire({20,8}));
+    string nn6 = sch.get_netname(sch.select_wire({70,30}));
+    uint64_t sv = sch.structure_version();
+    uint64_t gv = sch.geometry_version();
+    uint64_t nv = sch.nets_version();
+    uint64_t nv1 = sch.net_version(nn1);
+    uint64_t nv6 = sch.net_version(nn6);
+    EXPECT_EQ(sch.net_version("nonexistent"),0);
+
+    // Queries change nothing
+    sch.get_all_netnames();
+    sch.select_net(nn1);
+    sch.print();
+    EXPECT_EQ(sv,sch.structure_version());
+    EXPECT_EQ(gv,sch.geometry_version());
+    EXPECT_EQ(nv,sch.nets_version());
+
+    // Editing one net bumps it and the global versions, but not other nets
+    sch.add_wire({29,8},{29,3});
+    EXPECT_GT(sch.structure_version(),sv);
+    EXPECT_GT(sch.geometry_version(),gv);
+    EXPECT_GT(sch.nets_version(),nv);
+    EXPECT_EQ(sch.net_version(nn1),sch.nets_version());
+    EXPECT_EQ(sch.net_version(nn6),nv6);
+
+    // Ports change geometry and the renamed net
+    gv = sch.geometry_version();
+    sch.add_port_node({{70,30},"Vcc"});
+    EXPECT_GT(sch.geometry_version(),gv);
+    EXPECT_EQ(sch.net_version("vcc"),sch.nets_version());
+    EXPECT_EQ(sch.net_version(nn6),0);
+
+    // Compaction changes structure but not geometry
+    sch.remove_wire(sch.select_wire({16,10}));
+    sch.remove_wire(sch.select_wire({20,8}));
+    sch.remove_wire(sch.select_wire({29,5}));
+    sv = sch.structure_version();
+    gv = sch.geometry_version();
+    sch.compact();
+    EXPECT_GT(sch.structure_version(),sv);
+    EXPECT_EQ(gv,sch.geometry_version());
+    for(auto& nn : sch.get_all_netnames()) EXPECT_GT(sch.net_version(nn),0);
+}
+
+TEST(SchematicParallelSuite, ParallelResolutionNamesNetsLikeSerial)
+{
+    using Estd::Vec;
+    Schematic serial, parallel;
+    Estd::ThreadPool pool(3);
+    parallel.set_parallel_resolution(0,&pool);
+
+    // Same random edits on a small grid, so that wires cross, split and merge
+    std::mt19937 rng(42);
+    auto coord = [&rng]() {return Coordinate2(rng()%12,rng()%12);};
+    for(int step=0; step<150; step++)
+    {
+        int op = rng()%10;
+        if(op < 6)
+        {
+            Coordinate2 a = coord();
+            Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%12) : Coordinate2(rng()%12,a.y);
+            serial.add_wire(a,b);
+            parallel.add_wire(a,b);
+        }
+        else if(op < 8)
+        {
+            Vec<Wire> wires = serial.get_all_wires();
+            if(wires.empty()) continue;
+            Wire w = wires[rng()%wires.size()];
+            serial.remove_wire(w);
+            parallel.remove_wire(w);
+        }
+        else
+        {
+            Schematic::Port port{coord(),string("p")+char('a'+rng()%3)};
+            serial.add_port_node(port);
+            parallel.add_port_node(port);
+        }
+        ASSERT_EQ(serial.get_all_netnames(),parallel.get_all_netnames());
+        for(auto& nn : serial.get_all_netnames())
+        {
+            ASSERT_EQ(serial.select_net(nn),parallel.select_net(nn));
+        }
+    }
+}
+
+TEST(SchematicParallelSuite, ConnectivitySnapshotsAreConsistentDuringEdits)
+{
+    using Estd::Vec;
+    Schematic sch;
+    EXPECT_EQ(sch.connectivity(),nullptr);
+    sch.set_concurrent_readers(true);
+    ASSERT_NE(sch.connectivity(),nullptr);
+    EXPECT_TRUE(sch.connectivity()->get_all_netnames().empty());
+
+    std::atomic<bool> done{false};
+    std::atomic<int> failures{0};
+    auto reader = [&]() {
+        uint64_t last_version = 0;
+        while(!done)
+        {
+            std::shared_ptr<const Connectivity> snap = sch.connectivity();
+            if(snap->nets_version() < last_version) failures++;
+            last_version = snap->nets_version();
+            for(auto& nn : snap->get_all_netnames())
+            {
+                Vec<Schematic::Wire> wires = snap->select_net(nn);
+                for(auto& w : wires)
+                {
+                    if(!snap->same_net(w,wires.front())) failures++;
+                    snap->pos(w.first);
+                    snap->pos(w.second);
+                }
+            }
+        }
+    };
+    std::thread r1(reader), r2(reader);
+
+    std::mt19937 rng(7);
+    for(int step=0; step<300; step++)
+    {
+        Coordinate2 a(rng()%15,rng()%15);
+        Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%15) : Coordinate2(rng()%15,a.y);
+        sch.add_wire(a,b);
+        if(step%3 == 0)
+        {
+            Vec<Schematic::Wire> wires = sch.get_all_wires();
+            if(!wires.empty()) sch.remove_wire(wires[rng()%wires.size()]);
+        }
+    }
+    done = true;
+    r1.join();
+    r2.join();
+    EXPECT_EQ(failures,0);
+
+    // The last snapshot matches the schematic
+    std::shared_ptr<const Connectivity> snap = sch.connectivity();
+    EXPECT_EQ(snap->nets_version(),sch.nets_version());
+    EXPECT_EQ(snap->get_all_netnames(),sch.get_all_netnames());
+    for(auto& w : sch.get_all_wires()) EXPECT_EQ(snap->get_netname(w),sch.get_netname(w));
+    EXPECT_THROW(snap->get_netname({-1,-1}),std::invalid_argument);
+
+    // Readers keep their snapshot while the schematic moves on
+    sch.add_wire(Coordinate2(100,100),Coordinate2(100,110));
+    EXPECT_NE(sch.connectivity(),snap);
+    EXPECT_EQ(snap->nets_version()+1,sch.nets_version());
+
+    sch.set_concurrent_readers(false);
+    EXPECT_EQ(sch.connectivity(),nullptr);
+}
+
+TEST(SchematicParallelSuite, ConnectivityFollowsEditsThatReuseVertexIds)
+{
+    Schematic sch;
+    sch.set_concurrent_readers(true);
+    sch.set_verification(true);  // checks each published Connectivity against the nets
+    for(int i=0; i<20; i++) sch.add_wire(Coordinate2(10*i,0),Coordinate2(10*i,10));
+    std::shared_ptr<const Connectivity> before = sch.connectivity();
+    Wire removed = sch.select_wire(Coordinate2(50,5));
+    string removed_net = sch.get_netname(removed);
+
+    // The freed vertex ids come back at other positions
+    sch.set_lazy(true);
+    sch.remove_wire(removed);
+    sch.add_wire(Coordinate2(50,20),Coordinate2(50,30));
+    sch.set_lazy(false);
+    std::shared_ptr<const Connectivity> after = sch.connectivity();
+    ASSERT_NE(after,before);
+    Wire added = sch.select_wire(Coordinate2(50,25));
+    EXPECT_EQ(after->pos(added.first).y+after->pos(added.second).y,50);
+    EXPECT_EQ(after->get_netname(added),sch.get_netname(added));
+    for(auto& w : sch.get_all_wires()) EXPECT_EQ(after->get_netname(w),sch.get_netname(w));
+
+    // The old snapshot is unchanged
+    EXPECT_EQ(before->get_netname(removed),removed_net);
+    EXPECT_EQ(before->pos(removed.first).y+before->pos(removed.second).y,10);
+    EXPECT_EQ(before->get_all_netnames().size(),20);
+}
+
+TEST(SchematicUndoSuite, UndoRedoRestoresNetsExactly)
+{
+    using Estd::Vec;
+    using Nets = std::map<string,Vec<Schematic::Wire>>;
+    Schematic sch;
+    sch.set_undo_limit(1000);
+    auto state = [&sch]() {
+        Nets nets;
+        for(auto& nn : sch.get_all_netnames())
+        {
+            nets[nn] = sch.select_net(nn);
+            Estd::sort(nets[nn]);  // nets sharing a port name come in any order
+        }
+        return nets;
+    };
+
+    std::mt19937 rng(3);
+    Vec<Nets> states{state()};
+    auto coord = [&rng]() {return Coordinate2(rng()%12,rng()%12);};
+    for(int step=0; step<120; step++)
+    {
+        uint64_t version = sch.geometry_version();
+        int op = rng()%10;
+        if(op < 6)
+        {
+            Coordinate2 a = coord();
+            Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%12) : Coordinate2(rng()%12,a.y);
+            sch.add_wire(a,b);
+        }
+        else if(op < 8)
+        {
+            Vec<Schematic::Wire> wires = sch.get_all_wires();
+            if(!wires.empty()) sch.remove_wire(wires[rng()%wires.size()]);
+        }
+        else if(op < 9) sch.add_port_node(Schematic::Port{coord(),string("p")+char('a'+rng()%3)});
+        else sch.remove_port_nodes(string("p")+char('a'+rng()%3));
+        // Edits that change nothing are not undo steps
+        if(sch.geometry_version() != version) states.push_back(state());
+    }
+
+    // Every undo gives back the nets (names included) of the step before
+    for(int i=states.size()-1; i>0; i--)
+    {
+        ASSERT_TRUE(sch.can_undo());
+        ASSERT_TRUE(sch.undo());
+        ASSERT_EQ(state(),states[i-1]) << "after undoing step " << i;
+    }
+    EXPECT_FALSE(sch.undo());
+    for(int i=1; i<states.size(); i++)
+    {
+        ASSERT_TRUE(sch.redo());
+        ASSERT_EQ(state(),states[i]) << "after redoing step " << i;
+    }
+    EXPECT_FALSE(sch.can_redo());
+
+    // A new edit after undo drops the redo history
+    sch.undo();
+    sch.add_wire(Coordinate2(50,50),Coordinate2(50,60));
+    EXPECT_FALSE(sch.can_redo());
+
+    // The limit drops the oldest steps
+    sch.set_undo_limit(2);
+    EXPECT_TRUE(sch.undo());
+    EXPECT_TRUE(sch.undo());
+    EXPECT_FALSE(sch.undo());
+}
+
+TEST(SchematicUndoSuite, PendingEditsAreUndoneWithTheEditResolvingThem)
+{
+    Schematic sch;
+    sch.set_undo_limit(10);
+    sch.add_wire(Coordinate2(0,0),Coordinate2(0,10));
+    auto before = sch.get_all_netnames();
+    sch.add_wire(Coordinate2(0,10),Coordinate2(10,10),false);
+    sch.add_wire(Coordinate2(20,0),Coordinate2(20,10));
+    EXPECT_EQ(sch.get_all_netnames().size(),2);
+
+    // The net changes of both edits were recorded together
+    ASSERT_TRUE(sch.undo());
+    EXPECT_EQ(sch.get_all_wires().size(),1);
+    EXPECT_EQ(sch.get_all_netnames(),before);
+    ASSERT_TRUE(sch.redo());
+    EXPECT_EQ(sch.get_all_wires().size(),3);
+    EXPECT_EQ(sch.get_all_netnames().size(),2);
+}
+
 TEST_F(SchematicTestFixtureWithWires, SchematicTestAddingAndRemovingPortsIndivid)
 {
     EXPECT_THAT(sch.get_all_netnames(),Not(Contains("gnd1")));
@@ -304,3 +991,127 @@ TEST_F(SchematicTestFixtureWithWires, SchematicTestAddingAndRemovingPortsGrouped
 }
 
 
+
+TEST(SchematicBulkSuite, AddWiresMatchesAddingOneByOne)
+{
+    using Estd::Vec;
+    using Segment = std::pair<Coordinate2,Coordinate2>;
+    // Short and long, horizontal, vertical and diagonal wires on a small grid, so
+    // that they split, overlap and merge; some are degenerate
+    std::mt19937 rng(17);
+    Vec<Segment> segments;
+    for(int i=0; i<600; i++)
+    {
+        Coordinate2 a(rng()%40,rng()%40);
+        int kind = rng()%5;
+        int len = (rng()%4 == 0) ? rng()%40 : rng()%4;
+        if(kind < 2) segments.push_back({a,Coordinate2(a.x+len,a.y)});
+        else if(kind < 4) segments.push_back({a,Coordinate2(a.x,a.y+len)});
+        else segments.push_back({a,Coordinate2(a.x+len,a.y+len)});
+    }
+
+    // add_wire(a,b,false) for each, merging once with the last, like add_wires()
+    Schematic one_by_one;
+    Vec<Schematic::Wire> expected;
+    for(size_t i=0; i<segments.size(); i++)
+    {
+        expected.push_back(one_by_one.add_wire(segments[i].first,segments[i].second,i+1 == segments.size()));
+    }
+
+    // In three batches, so that later batches index an existing graph
+    Schematic bulk;
+    Vec<Schematic::Wire> wires;
+    for(size_t begin=0; begin<segments.size(); begin+=200)
+    {
+        Vec<Segment> batch(segments.begin()+begin,segments.begin()+begin+200);
+        Vec<Schematic::Wire> added = bulk.add_wires(batch,begin+200 == segments.size());
+        wires.insert(wires.end(),added.begin(),added.end());
+    }
+
+    EXPECT_EQ(wires,expected);
+    EXPECT_FALSE(bulk.nets_dirty());
+    EXPECT_EQ(bulk.get_all_wires(),one_by_one.get_all_wires());
+    ASSERT_EQ(bulk.get_all_netnames(),one_by_one.get_all_netnames());
+    for(auto& nn : bulk.get_all_netnames()) EXPECT_EQ(bulk.select_net(nn),one_by_one.select_net(nn));
+    EXPECT_TRUE(bulk.add_wires({}).empty());
+}
+
+TEST(SchematicStatsSuite, StatsCountHotPathsAndReset)
+{
+    Schematic sch;
+    sch.add_wire({0,0},{0,10});
+    sch.add_wire({0,5},{5,5});
+    sch.add_wire({5,0},{5,10});
+    sch.add_port_node({{5,10},"OUT"});
+    sch.get_netname({0,2});
+    sch.select_wire({5,2});
+
+    SchematicStats stats = sch.stats();
+    if(SchematicStats::enabled)
+    {
+        EXPECT_EQ(stats.update_nets.calls,4);
+        EXPECT_EQ(stats.nets_trees.calls,4);
+        EXPECT_EQ(stats.nets_publish.calls,4);
+        EXPECT_GE(stats.update_nets.ns,stats.nets_trees.ns);
+        EXPECT_GT(stats.graph.traversals.calls,0);
+        EXPECT_GT(stats.graph.linear_scans,0);
+        EXPECT_GE(stats.graph.linear_scan_items,stats.graph.linear_scans);
+        EXPECT_GE(stats.select_wire,2);
+        EXPECT_GE(stats.net_scans,1);
+        EXPECT_GT(stats.allocations.allocations,0);
+        EXPECT_GT(stats.allocations.bytes,0);
+    }
+    else
+    {
+        EXPECT_EQ(stats.update_nets.calls,0);
+        EXPECT_EQ(stats.graph.traversals.calls,0);
+        EXPECT_EQ(stats.allocations.allocations,0);
+    }
+
+    sch.reset_stats();
+    stats = sch.stats();
+    EXPECT_EQ(stats.update_nets.calls,0);
+    EXPECT_EQ(stats.update_nets.ns,0);
+    EXPECT_EQ(stats.graph.traversals.calls,0);
+    EXPECT_EQ(stats.graph.linear_scans,0);
+    EXPECT_EQ(stats.select_wire,0);
+    EXPECT_EQ(stats.allocations.bytes,0);
+
+    // Counting starts again after a reset
+    sch.add_wire({20,0},{20,5});
+    stats = sch.stats();
+    if(SchematicStats::enabled) EXPECT_EQ(stats.update_nets.calls,1);
+    EXPECT_EQ(sch.get_all_netnames().size(),2);
+}
+
+TEST(SchematicMemorySuite, MemoryUsageBreaksDownByStructure)
+{
+    Schematic sch;
+    SchematicMemory empty = sch.memory_usage();
+    EXPECT_EQ(empty.nets,0);
+    EXPECT_EQ(empty.published,0);
+
+    for(int i=0; i<50; i++) sch.add_wire({i*10.0,0},{i*10.0,5},false);
+    sch.add_port_node({{0,5},"A_VERY_LONG_PORT_NAME_THAT_IS_NOT_INLINE"},false);
+    sch.update_nets();
+    SchematicMemory m = sch.memory_usage();
+    EXPECT_GT(m.graph.nodes,empty.graph.nodes);
+    EXPECT_GT(m.nets,50*sizeof(Wire));
+    EXPECT_GE(m.etrees,50*sizeof(Wire));
+    EXPECT_GT(m.ports,0);
+    EXPECT_GT(m.handles,0);
+    EXPECT_EQ(m.undo,empty.undo);  // no undo limit, nothing recorded
+    EXPECT_EQ(empty.picking,0);
+    sch.select_wire({10,2});
+    m = sch.memory_usage();
+    EXPECT_GE(m.picking,50*(4*sizeof(double)+sizeof(Wire)));
+    EXPECT_EQ(m.total(),m.graph.total()+m.nets+m.etrees+m.ports+m.id_pool+m.handles+m.listeners+m.undo+m.published+m.picking);
+
+    sch.set_undo_limit(10);
+    sch.add_wire({0,20},{5,20});
+    EXPECT_GT(sch.memory_usage().undo,empty.undo);
+    sch.snapshot();
+    EXPECT_GT(sch.memory_usage().published,0);
+    sch.compact();
+    EXPECT_EQ(sch.memory_usage().undo,empty.undo);
+}
@@ -0,0 +1,107 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include "../coordinate2.h"
+#include "../segmentbatch.h"
+
+using namespace testing;
+using Isa = SegmentBatch::Isa;
+
+static const Estd::Vec<Isa> ALL_ISAS{Isa::SCALAR,Isa::SSE2,Isa::AVX2};
+
+// Picked during static initialization, possibly before segmentbatch.cpp's own
+static const size_t STATIC_INIT_PICK = [] {
+    SegmentBatch segments;
+    segments.push_back({0,0},{10,0});
+    segments.push_back({0,5},{10,5});
+    return segments.first_within({5,4.9},0.5);
+}();
+
+class SegmentBatchFixture : public Test
+{
+protected:
+    ~SegmentBatchFixture() {SegmentBatch::set_isa(SegmentBatch::best_isa());}
+};
+
+
+TEST(SegmentBatchSuite, WorksDuringStaticInitialization)
+{
+    EXPECT_EQ(STATIC_INIT_PICK,1u);
+}
+
+TEST_F(SegmentBatchFixture, DistancesMatchDistanceFromLine)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> coord(-50,50);
+    SegmentBatch segments;
+    Estd::Vec<std::pair<Coordinate2,Coordinate2>> lines;
+    for(int i=0; i<203; i++)  // not a multiple of the vector width
+    {
+        Coordinate2 a(coord(rng),coord(rng));
+        Coordinate2 b = (i%3 == 0) ? Coordinate2(a.x,coord(rng)) : Coordinate2(coord(rng),coord(rng));
+        segments.push_back(a,b);
+        lines.push_back({a,b});
+    }
+    for(Isa isa : ALL_ISAS)
+    {
+        SegmentBatch::set_isa(isa);
+        SCOPED_TRACE(SegmentBatch::isa_name(SegmentBatch::isa()));
+        for(int k=0; k<20; k++)
+        {
+            Coordinate2 p(coord(rng),coord(rng));
+            Estd::Vec<double> d = segments.distances_sq(p);
+            ASSERT_EQ(d.size(),lines.size());
+            for(size_t i=0; i<lines.size(); i++)
+            {
+                double expected = distance_from_line(p,lines[i].first,lines[i].second);
+                EXPECT_NEAR(std::sqrt(d[i]),expected,1e-9*(1+expected));
+                EXPECT_DOUBLE_EQ(d[i],segment_distance_sq(p,lines[i].first,lines[i].second));
+            }
+        }
+    }
+}
+
+TEST_F(SegmentBatchFixture, PicksLikeBruteForce)
+{
+    // Grid wires and points, as a schematic has them: many exact hits and endpoints
+    SegmentBatch segments;
+    Estd::Vec<std::pair<Coordinate2,Coordinate2>> lines;
+    for(int i=0; i<10; i++)
+    {
+        lines.push_back({Coordinate2(i,0),Coordinate2(i,i+1)});
+        lines.push_back({Coordinate2(0,i),Coordinate2(i+2,i)});
+    }
+    lines.push_back({Coordinate2(3,3),Coordinate2(3,3)});  // zero length
+    for(auto& l : lines) segments.push_back(l.first,l.second);
+    for(Isa isa : ALL_ISAS)
+    {
+        SegmentBatch::set_isa(isa);
+        SCOPED_TRACE(SegmentBatch::isa_name(SegmentBatch::isa()));
+        for(double x=-1; x<=12; x+=0.5)
+        {
+            for(double y=-1; y<=12; y+=0.5)
+            {
+                Coordinate2 p(x,y);
+                Estd::Vec<size_t> expected;
+                for(size_t i=0; i<lines.size(); i++)
+                {
+                    if(segment_distance_sq(p,lines[i].first,lines[i].second) < p.prec()*p.prec()) expected.push_back(i);
+                }
+                EXPECT_EQ(segments.all_within(p,p.prec()),expected);
+                EXPECT_EQ(segments.first_within(p,p.prec()),expected.empty() ? SegmentBatch::npos : expected[0]);
+            }
+        }
+    }
+    EXPECT_EQ(segments.first_within(Coordinate2(3,3),1e-10),3*2);  // the wire x=3, not the point
+    EXPECT_EQ(SegmentBatch().first_within(Coordinate2(0,0),1),SegmentBatch::npos);
+}
+
+TEST_F(SegmentBatchFixture, IsaIsCappedAtTheBestSupported)
+{
+    SegmentBatch::set_isa(Isa::AVX2);
+    EXPECT_EQ(SegmentBatch::isa(),SegmentBatch::best_isa());
+    SegmentBatch::set_isa(Isa::SCALAR);
+    EXPECT_EQ(SegmentBatch::isa(),Isa::SCALAR);
+    EXPECT_STREQ(SegmentBatch::isa_name(Isa::SCALAR),"scalar");
+}
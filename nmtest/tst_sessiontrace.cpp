@@ -0,0 +1,154 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <random>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../schematicgen.h"
+#include "../sessiontrace.h"
+
+using namespace testing;
+using std::string;
+using Estd::Vec;
+using Wire = Schematic::Wire;
+
+class SessionTraceFixture : public Test
+{
+protected:
+    string path;
+    SessionTraceFixture() : path{(std::filesystem::temp_directory_path() / "nm_sessiontrace_test.trace").string()} {}
+    ~SessionTraceFixture() {std::filesystem::remove(path);}
+
+    void truncate(uintmax_t size) {std::filesystem::resize_file(path,size);}
+};
+
+
+TEST_F(SessionTraceFixture, ReplayMatchesRecordedSession)
+{
+    Schematic sch;
+    SchematicGenerator::add_to(SchematicGenerator::generate({SchematicGenerator::Pattern::STAR,200,6,2}),sch);
+    sch.set_undo_limit(4);
+    sch.set_lazy(true);
+
+    SessionTrace trace(path);
+    trace.start(sch);
+    std::mt19937 rng(8);
+    uint64_t calls = 0, errors = 0, undos = 0;
+    for(int i=0; i<300; i++)
+    {
+        Coordinate2 p(rng()%40,rng()%80);
+        switch(rng()%10)
+        {
+        case 0: case 1: sch.add_wire(p,(rng()%2) ? Coordinate2(p.x,rng()%80) : Coordinate2(rng()%40,p.y)); break;
+        case 2:
+        {
+            Vec<Wire> wires = sch.get_all_wires();
+            calls++;
+            sch.remove_wire(wires[rng()%wires.size()],rng()%4 != 0);
+            break;
+        }
+        case 3: sch.add_port_node({p,"port" + std::to_string(rng()%5)}); break;
+        case 4: sch.undo(); undos++; break;
+        case 5: sch.redo(); break;
+        case 6:
+            try {sch.get_netname({-5,-6});}
+            catch(std::invalid_argument&) {errors++;}
+            break;
+        case 7: sch.select_net(p); break;
+        case 8: sch.remove_port_nodes("port" + std::to_string(rng()%5)); break;
+        case 9: sch.set_lazy(rng()%2); break;
+        }
+        calls++;
+    }
+    sch.compact();
+    calls++;
+    EXPECT_GT(undos,0);
+    EXPECT_EQ(trace.calls(),calls);
+    trace.stop();
+
+    SessionTrace::Report report = SessionTrace::replay(path);
+    EXPECT_TRUE(report.complete);
+    EXPECT_TRUE(report.nets_match);
+    EXPECT_EQ(report.nets,sch.get_all_netnames().size());
+    EXPECT_EQ(report.calls,calls);
+    EXPECT_EQ(report.errors,errors);
+    EXPECT_EQ(report.replayed[SessionTrace::UNDO].count(),undos);
+    EXPECT_EQ(report.recorded[SessionTrace::UNDO].count(),undos);
+    EXPECT_EQ(report.replayed[SessionTrace::UPDATE_NETS].count(),0);  // only inside other calls
+    EXPECT_LE(report.replayed[SessionTrace::COMPACT].percentile(0.5),report.replayed[SessionTrace::COMPACT].max());
+
+    std::ostringstream out;
+    SessionTrace::print(report,out);
+    EXPECT_THAT(out.str(),HasSubstr("final nets match"));
+    EXPECT_THAT(out.str(),HasSubstr("remove_wire"));
+}
+
+TEST_F(SessionTraceFixture, ReplayChecksFinalNets)
+{
+    Schematic sch;
+    SessionTrace trace(path);
+    trace.start(sch);
+    sch.add_wire({0,0},{0,5});
+    sch.add_wire({0,5},{5,5});
+    sch.add_wire({9,0},{9,5});
+    trace.stop();
+    sch.add_wire({20,20},{20,25});  // not recorded
+    EXPECT_EQ(trace.calls(),3);
+    EXPECT_TRUE(SessionTrace::replay(path).nets_match);
+
+    // Change the digest: END, 8 bytes of digest, 1 byte of net count
+    uintmax_t size = std::filesystem::file_size(path);
+    {
+        std::fstream f(path,std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(size-2);
+        f.put('\x5a');
+    }
+    SessionTrace::Report report = SessionTrace::replay(path);
+    EXPECT_TRUE(report.complete);
+    EXPECT_FALSE(report.nets_match);
+
+    // Without the end the calls are replayed but not checked
+    truncate(size-10);
+    report = SessionTrace::replay(path);
+    EXPECT_FALSE(report.complete);
+    EXPECT_EQ(report.calls,3);
+
+    truncate(size-12);
+    EXPECT_THROW(SessionTrace::replay(path),std::runtime_error);
+}
+
+TEST_F(SessionTraceFixture, RecordingKeepsUndoHistoryAndTryLookups)
+{
+    Schematic sch;
+    sch.set_undo_limit(4);
+    sch.add_wire({0,0},{0,5});
+    sch.add_wire({9,0},{9,5});
+    ASSERT_TRUE(sch.undo());
+
+    SessionTrace trace(path);
+    trace.start(sch);
+    EXPECT_TRUE(sch.can_undo());  // not cleared by recording
+    EXPECT_TRUE(sch.can_redo());
+    EXPECT_FALSE(sch.try_get_netname({-5,-6}));
+    EXPECT_FALSE(sch.try_select_net("missing"));
+    sch.add_wire({0,5},{5,5});
+    trace.stop();
+
+    SessionTrace::Report report = SessionTrace::replay(path);
+    EXPECT_EQ(report.undo_depth,1);
+    EXPECT_EQ(report.redo_depth,1);
+    EXPECT_EQ(report.errors,0);
+    EXPECT_EQ(report.replayed[SessionTrace::TRY_GET_NETNAME].count(),1);
+    EXPECT_EQ(report.replayed[SessionTrace::TRY_SELECT_NET].count(),1);
+    EXPECT_EQ(report.replayed[SessionTrace::GET_NETNAME].count(),0);
+    EXPECT_TRUE(report.nets_match);
+
+    std::ostringstream out;
+    SessionTrace::print(report,out,false);
+    EXPECT_THAT(out.str(),HasSubstr("try_select_net"));
+    EXPECT_THAT(out.str(),HasSubstr("1 undo and 1 redo steps"));
+}
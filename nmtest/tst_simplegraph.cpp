@@ -5,6 +5,7 @@
 #include <vector>
 #include <map>
 #include <exception>
+#include <random>
 #include "../coordinate2.h"
 #include "../simplegraph.h"
 
@@ -353,6 +354,31 @@ TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphTraversalAndReachableVertices
     EXPECT_THAT(graph.get_reachable(id5),ElementsAre(id5));
 }
 
+TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphTryLookupsMissWithoutThrowing)
+{
+    const int missing = 100;
+    ASSERT_NE(graph.try_get_adjacent(id4),nullptr);
+    EXPECT_THAT(*graph.try_get_adjacent(id4),UnorderedElementsAre(id3,id5,id6,id7));
+    EXPECT_EQ(graph.try_get_adjacent(missing),nullptr);
+    EXPECT_EQ(graph.try_adjacent(id3,id4),std::optional<bool>(true));
+    EXPECT_EQ(graph.try_adjacent(id0,id4),std::optional<bool>(false));
+    EXPECT_EQ(graph.try_adjacent(id0,missing),std::nullopt);
+    EXPECT_EQ(graph.try_reachable(id1,id7),std::optional<bool>(true));
+    EXPECT_EQ(graph.try_reachable(id0,id1),std::optional<bool>(false));
+    EXPECT_EQ(graph.try_reachable(missing,id1),std::nullopt);
+    ASSERT_TRUE(graph.try_get_reachable(id6).has_value());
+    EXPECT_EQ(*graph.try_get_reachable(id6),graph.get_reachable(id6));
+    EXPECT_EQ(graph.try_get_reachable(missing),std::nullopt);
+
+    // The throwing versions still throw on the same misses
+    EXPECT_THROW(graph.get_adjacent(missing),std::invalid_argument);
+    EXPECT_THROW(graph.adjacent(id0,missing),std::invalid_argument);
+    EXPECT_THROW(graph.reachable(missing,id1),std::invalid_argument);
+    EXPECT_THROW(graph.get_reachable(missing),std::invalid_argument);
+    EXPECT_THROW(graph.isolated(missing),std::invalid_argument);
+    EXPECT_THROW(graph.erase(missing),std::invalid_argument);
+}
+
 TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphGetEdgeListReturnsCorrect)
 {
     Estd::Vec<pair<int,int>> expected;
@@ -402,6 +428,193 @@ TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphGetSubgraphReturnsStatic)
     EXPECT_THROW(sub1.reachable(id1,id4),std::invalid_argument);
 }
 
+TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphCompactRenumbersDensely)
+{
+    using Estd::Vec;
+    graph.erase(id0);
+    graph.erase(id4);
+    std::map<int,int> id_map = graph.compact();
+
+    // Remaining ids are renumbered in order
+    EXPECT_THAT(id_map,ElementsAre(Pair(id1,0),Pair(id2,1),Pair(id3,2),Pair(id5,3),
+                                   Pair(id6,4),Pair(id7,5)));
+    EXPECT_THAT(graph.get_all_ids(),ElementsAre(0,1,2,3,4,5));
+
+    // Connections and trees are preserved under the new ids
+    EXPECT_TRUE(graph.adjacent(id_map[id1],id_map[id3]));
+    EXPECT_TRUE(graph.adjacent(id_map[id2],id_map[id3]));
+    EXPECT_TRUE(graph.adjacent(id_map[id6],id_map[id7]));
+    EXPECT_TRUE(graph.isolated(id_map[id5]));
+    Vec<Vec<int>> expected;
+    expected.push_back({0,2,1});
+    expected.push_back({3});
+    expected.push_back({4,5});
+    EXPECT_EQ(expected,graph.get_spanning_trees());
+
+    // Id pool continues after the last id
+    EXPECT_EQ(6,graph.add());
+}
+
+TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphVersionsTrackChanges)
+{
+    uint64_t sv = graph.structure_version();
+    uint64_t gv = graph.geometry_version();
+
+    // Queries and no-op edits don't change versions
+    graph.reachable(id1,id2);
+    graph.get_spanning_trees(true);
+    graph.connect(id1,id3);
+    graph.disconnect(id0,id1);
+    EXPECT_EQ(sv,graph.structure_version());
+    EXPECT_EQ(gv,graph.geometry_version());
+
+    // Edits change both
+    graph.connect(id0,id1);
+    EXPECT_GT(graph.structure_version(),sv);
+    EXPECT_GT(graph.geometry_version(),gv);
+    sv = graph.structure_version();
+    gv = graph.geometry_version();
+    graph.erase(id5);
+    EXPECT_GT(graph.structure_version(),sv);
+    EXPECT_GT(graph.geometry_version(),gv);
+
+    // Renumbering only changes the structure
+    sv = graph.structure_version();
+    gv = graph.geometry_version();
+    graph.compact();
+    EXPECT_GT(graph.structure_version(),sv);
+    EXPECT_EQ(gv,graph.geometry_version());
+    sv = graph.structure_version();
+    graph.compact();  // already dense
+    EXPECT_EQ(sv,graph.structure_version());
+}
+
+TEST_F(SimpleGraphTestFixtureWithNodes, SimpleGraphParallelTraversalMatchesSerial)
+{
+    Estd::ThreadPool pool(4);
+    auto serial_trees = graph.get_spanning_trees(true);
+    graph.set_parallel_traversal(0,&pool);
+    EXPECT_EQ(serial_trees,graph.get_spanning_trees(true));
+    EXPECT_TRUE(graph.reachable(id1,id7,true));
+    EXPECT_FALSE(graph.reachable(id0,id1));
+}
+
+TEST(SimpleGraphParallelSuite, ParallelTraversalMatchesSerialOnRandomGraph)
+{
+    // Sparse random graph with many components, some ids erased
+    std::mt19937 rng(1234);
+    SimpleGraph serial, parallel;
+    const int n = 5000;
+    for(int i=0; i<n; i++)
+    {
+        serial.add(false);
+        parallel.add(false);
+    }
+    std::uniform_int_distribution<int> pick(0,n-1);
+    for(int e=0; e<n*4/5; e++)
+    {
+        int a = pick(rng), b = pick(rng);
+        if(a == b) continue;
+        serial.connect(a,b,false);
+        parallel.connect(a,b,false);
+    }
+    for(int i=0; i<n; i+=97)
+    {
+        serial.erase(i,false);
+        parallel.erase(i,false);
+    }
+
+    Estd::ThreadPool pool(4);
+    parallel.set_parallel_traversal(0,&pool);
+    EXPECT_EQ(serial.get_spanning_trees(true),parallel.get_spanning_trees(true));
+    EXPECT_EQ(serial.get_reachable(1),parallel.get_reachable(1));
+}
+
+TEST(SimpleGraphCompressedSuite, CompressedAdjacencyMatchesGraph)
+{
+    // Sparse random graph with many components and gaps in the ids
+    std::mt19937 rng(77);
+    SimpleGraph graph;
+    const int n = 3000;
+    for(int i=0; i<n; i++) graph.add(false);
+    std::uniform_int_distribution<int> pick(0,n-1);
+    for(int e=0; e<n; e++)
+    {
+        int a = pick(rng), b = (rng()%4) ? a+1+rng()%20 : pick(rng);
+        if(a != b && b < n) graph.connect(a,b,false);
+    }
+    for(int i=0; i<n; i+=31) graph.erase(i,false);
+
+    for(bool compacted : {false,true})
+    {
+        if(compacted) graph.compact();  // ids 0..N-1 are not stored
+        CompressedAdjacency adj = graph.get_compressed_adjacency();
+        EXPECT_EQ(adj.size(),graph.get_all_ids().size());
+        EXPECT_EQ(adj.edge_count(),graph.get_all_edges().size());
+        for(auto& pair : graph.get_adjacency_lists())
+        {
+            Estd::Vec<int> expected = pair.second;
+            Estd::sort(expected);
+            ASSERT_EQ(adj.get_adjacent(pair.first),expected);
+            EXPECT_EQ(adj.degree(pair.first),expected.size());
+            for(int other : expected) EXPECT_TRUE(adj.adjacent(pair.first,other));
+        }
+        Estd::Vec<int> ids = graph.get_all_ids();
+        for(int q=0; q<300; q++)
+        {
+            int a = ids[rng()%ids.size()], b = ids[rng()%ids.size()];
+            EXPECT_EQ(adj.adjacent(a,b),graph.adjacent(a,b));
+            EXPECT_EQ(adj.reachable(a,b),graph.reachable(a,b,true));
+        }
+        Estd::Vec<int> reachable = graph.get_reachable(ids[5]);
+        Estd::sort(reachable);
+        EXPECT_EQ(adj.get_reachable(ids[5]),reachable);
+
+        // Same trees, each in ascending id order
+        auto sorted_trees = [](Estd::Vec<Estd::Vec<int>> trees) {
+            for(auto& t : trees) Estd::sort(t);
+            Estd::sort(trees);
+            return trees;
+        };
+        EXPECT_EQ(sorted_trees(adj.get_spanning_trees()),sorted_trees(graph.get_spanning_trees(true)));
+        EXPECT_FALSE(adj.contains(-1));
+        EXPECT_THROW(adj.get_adjacent(n+5),std::invalid_argument);
+    }
+    EXPECT_EQ(CompressedAdjacency().size(),0);
+    EXPECT_TRUE(SimpleGraph().get_compressed_adjacency().get_spanning_trees().empty());
+}
+
+TEST(SimpleGraphMemorySuite, MemoryUsageFollowsContainers)
+{
+    vector<int> v;
+    v.reserve(100);
+    EXPECT_EQ(Estd::heap_bytes(v),100*sizeof(int));
+    EXPECT_EQ(Estd::heap_bytes(string("ab")),0);  // fits in the string object
+    string long_name(100,'x');
+    EXPECT_EQ(Estd::heap_bytes(long_name),long_name.capacity()+1);
+    Estd::Vec<string> names(2,long_name);
+    EXPECT_EQ(Estd::heap_bytes(names),names.capacity()*sizeof(string)+2*(long_name.capacity()+1));
+    map<int,int> m{{1,2},{3,4}};
+    EXPECT_EQ(Estd::heap_bytes(m),2*(Estd::TREE_NODE_OVERHEAD+sizeof(pair<const int,int>)));
+
+    VertexGraph graph;
+    GraphMemory empty = graph.memory_usage();
+    EXPECT_EQ(empty.nodes,0);
+    for(int i=0; i<300; i++) graph.add(Coordinate2(i,i%2),false);
+    for(int i=0; i<299; i++) graph.connect(i,i+1,false);
+    graph.traverse_graph();
+    GraphMemory full = graph.memory_usage();
+    EXPECT_GE(full.nodes,300*(sizeof(GraphVertex)+sizeof(void*)));
+    EXPECT_GE(full.node_index,300*sizeof(int));
+    EXPECT_GE(full.adjacency,598*sizeof(int));
+    EXPECT_GE(full.trees,300*sizeof(int));
+    EXPECT_EQ(full.total(),full.nodes+full.node_index+full.adjacency+full.trees+full.id_pool);
+
+    for(int i=0; i<200; i++) graph.erase(i,false);
+    EXPECT_GT(graph.memory_usage().id_pool,empty.id_pool);  // more than one block of ids
+    EXPECT_LT(graph.memory_usage().adjacency,full.adjacency);
+}
+
 TEST_F(VertexGraphTestFixtureWithVertices, VertexGraphAddNodeOnEdgeSplitsEdge)
 {
     // Adding a point not on an edge has no effect on the edge connections
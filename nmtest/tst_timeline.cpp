@@ -0,0 +1,87 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../timeline.h"
+
+using namespace testing;
+using std::string;
+
+class TimelineFixture : public Test
+{
+protected:
+    ~TimelineFixture() {Timeline::stop();}
+
+    static size_t count(const char* name)
+    {
+        size_t n = 0;
+        for(auto& e : Timeline::events()) n += std::strcmp(e.name,name) == 0;
+        return n;
+    }
+};
+
+
+TEST_F(TimelineFixture, RecordsPhasesOfEditsWhileStarted)
+{
+    Schematic sch;
+    sch.add_wire({0,0},{0,10});     // not recorded
+    Timeline::start();
+    EXPECT_TRUE(Timeline::recording());
+    sch.add_wire({0,5},{5,5});
+    sch.add_wire({5,5},{10,5});     // merged with the previous wire
+    sch.remove_wire(sch.select_wire({0,2}));
+    Timeline::stop();
+    sch.add_wire({20,0},{20,5});    // not recorded
+
+    EXPECT_EQ(count("add_wire"),2);
+    EXPECT_EQ(count("remove_wire"),1);
+    EXPECT_EQ(count("update_nets"),3);
+    EXPECT_EQ(count("_update_trees"),3);
+    EXPECT_EQ(count("merge_unbranched_collinear_edges"),2);
+    EXPECT_EQ(count("VertexGraph::connect"),2);
+    EXPECT_EQ(count("trees"),3);
+    EXPECT_EQ(count("spanning trees"),3);
+    EXPECT_EQ(Timeline::dropped(),0);
+
+    // Phases nest inside their operation, on the same thread
+    Timeline::Event outer{}, inner{};
+    for(auto& e : Timeline::events())
+    {
+        if(std::strcmp(e.name,"update_nets") == 0) outer = e;
+        if(std::strcmp(e.name,"publish") == 0) inner = e;
+    }
+    EXPECT_EQ(inner.thread,outer.thread);
+    EXPECT_GE(inner.start_ns,outer.start_ns);
+    EXPECT_LE(inner.start_ns+inner.duration_ns,outer.start_ns+outer.duration_ns);
+
+    std::ostringstream out;
+    Timeline::write(out);
+    EXPECT_THAT(out.str(),StartsWith("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    EXPECT_THAT(out.str(),HasSubstr("{\"name\":\"remove_wire\",\"cat\":\"schematic\",\"ph\":\"X\",\"ts\":"));
+    EXPECT_THAT(out.str(),HasSubstr("\"cat\":\"graph\""));
+    EXPECT_THAT(out.str(),EndsWith("]}\n"));
+}
+
+TEST_F(TimelineFixture, RingBufferKeepsTheLatestEvents)
+{
+    Schematic sch;
+    Timeline::start(10);
+    for(int i=0; i<20; i++) sch.add_wire({i*10.0,0},{i*10.0,5});
+    Estd::Vec<Timeline::Event> events = Timeline::events();
+    ASSERT_EQ(events.size(),10);
+    EXPECT_GT(Timeline::dropped(),0);
+    for(size_t i=1; i<events.size(); i++)
+    {
+        // Events are added as they end
+        EXPECT_LE(events[i-1].start_ns+events[i-1].duration_ns,events[i].start_ns+events[i].duration_ns);
+    }
+    EXPECT_STREQ(events.back().name,"add_wire");
+
+    Timeline::start(10);
+    EXPECT_TRUE(Timeline::events().empty());
+    EXPECT_EQ(Timeline::dropped(),0);
+    EXPECT_THROW(Timeline::start(0),std::invalid_argument);
+}
@@ -0,0 +1,41 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <type_traits>
+#include "../utils.h"
+
+using namespace testing;
+
+
+TEST(EstdVecSuite, CheckedVecThrowsOutOfRange)
+{
+    Estd::Vec<int,true> v{1,2,3};
+    const Estd::Vec<int,true>& cv = v;
+    EXPECT_EQ(v[2],3);
+    EXPECT_EQ(cv[0],1);
+    v[1] = 5;
+    EXPECT_THAT(v,ElementsAre(1,5,3));
+    EXPECT_THROW(v[3],std::out_of_range);
+    EXPECT_THROW(cv[-1],std::out_of_range);
+    EXPECT_FALSE(noexcept(v[0]));
+}
+
+TEST(EstdVecSuite, UncheckedVecIndexesLikeVector)
+{
+    Estd::Vec<int,false> v(100);
+    for(int i=0; i<100; i++) v[i] = i*i;
+    const Estd::Vec<int,false>& cv = v;
+    for(int i=0; i<100; i++) EXPECT_EQ(cv[i],i*i);
+    EXPECT_TRUE(noexcept(v[0]));
+    EXPECT_TRUE(noexcept(cv[0]));
+    EXPECT_EQ(&v[99],v.data()+99);
+}
+
+TEST(EstdVecSuite, TestsBuildChecked)
+{
+    // NM_UNCHECKED_VEC never reaches the library the tests link, see CMakeLists.txt
+    EXPECT_TRUE(Estd::VEC_CHECKED);
+    EXPECT_TRUE((std::is_same<Estd::Vec<int>,Estd::Vec<int,Estd::VEC_CHECKED>>::value));
+    Estd::Vec<int> v{4,5};
+    EXPECT_EQ(noexcept(v[0]),!Estd::VEC_CHECKED);
+}
@@ -0,0 +1,91 @@
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <sstream>
+#include <random>
+#include "../coordinate2.h"
+#include "../schematic.h"
+#include "../wirelist.h"
+
+using namespace testing;
+using std::string;
+using Estd::Vec;
+
+
+TEST(WireListSuite, WireListMatchesAddingWiresOneByOne)
+{
+    // Random wires and ports, written out as a wire list
+    std::mt19937 rng(23);
+    Schematic expected("expected");
+    std::ostringstream text;
+    text << "# generated\r\nname  sheet 2 \n\n";
+    for(int i=0; i<500; i++)
+    {
+        Coordinate2 a(rng()%30,rng()%30);
+        Coordinate2 b = (rng()%2) ? Coordinate2(a.x,rng()%30) : Coordinate2(rng()%30,a.y);
+        expected.add_wire(a,b,false);  // merged once at the end, like the reader
+        text << ((i%2) ? "wire " : "W\t") << a.x << " " << a.y << " " << b.x << " " << b.y << "\n";
+    }
+    text << "W 100.5 -2.25 100.5 1e1\n";
+    expected.add_wire(Coordinate2(100.5,-2.25),Coordinate2(100.5,10));
+    // Ports are added after all the wires, wherever they are in the file
+    for(int i=0; i<5; i++)
+    {
+        Coordinate2 p(rng()%30,rng()%30);
+        text << "port " << p.x << " " << p.y << " Net " << i << "\n";
+        expected.add_port_node(Schematic::Port{p,"net " + std::to_string(i)});
+    }
+    text << "P 100.5 0 Iso";  // no final newline
+    expected.add_port_node(Schematic::Port{Coordinate2(100.5,0),"iso"});
+
+    // Tiny chunks and batches, so that lines and batches are split everywhere
+    for(auto sizes : Vec<std::pair<size_t,size_t>>{{7,3},{64,50},{1<<16,1<<20}})
+    {
+        Schematic sch;
+        std::istringstream in(text.str());
+        WireListReader::Stats stats = WireListReader(sizes.first,sizes.second).read(sch,in);
+        EXPECT_EQ(stats.wires,501);
+        EXPECT_EQ(stats.ports,6);
+        EXPECT_EQ(stats.lines,510);
+        EXPECT_EQ(stats.bytes,text.str().size());
+        EXPECT_EQ(sch.name,"sheet 2");
+        EXPECT_FALSE(sch.nets_dirty());
+        EXPECT_EQ(sch.get_all_wires(),expected.get_all_wires());
+        ASSERT_EQ(sch.get_all_netnames(),expected.get_all_netnames());
+        EXPECT_THAT(sch.get_all_netnames(),Contains("iso"));
+        for(auto& nn : sch.get_all_netnames()) EXPECT_EQ(sch.select_net(nn),expected.select_net(nn));
+    }
+}
+
+TEST(WireListSuite, WireListReportsLineOfBadRecords)
+{
+    auto error = [](const string& text) {
+        Schematic sch;
+        std::istringstream in(text);
+        try {WireListReader().read(sch,in);}
+        catch(std::runtime_error& e) {return string(e.what());}
+        return string();
+    };
+    EXPECT_THAT(error("W 0 0 0 5\nW 0 0 zero 5\n"),HasSubstr("line 2"));
+    EXPECT_THAT(error("W 0 0 0 5 6\n"),HasSubstr("line 1"));
+    EXPECT_THAT(error("\n\nP 1 1\n"),HasSubstr("line 3"));
+    EXPECT_THAT(error("P 1 1 42\n"),HasSubstr("integer"));
+    EXPECT_THAT(error("# ok\nX 1 2\n"),HasSubstr("unknown record 'X'"));
+    EXPECT_EQ(error("W 0 0 0 5\n# W 1 1 1 1 1\n"),"");
+
+    Schematic sch;
+    EXPECT_THROW(WireListReader().read_file(sch,"/nonexistent/wires.txt"),std::runtime_error);
+}
+
+TEST(WireListSuite, WireListLeavesWiresBeforeAnErrorResolved)
+{
+    // Collinear wires in separate batches, then a bad record
+    Schematic sch;
+    std::istringstream in("W 0 0 0 5\nW 0 5 0 10\nW 0 10 0 15\nP 0 0 in\nW 0 0 zero 5\n");
+    EXPECT_THROW(WireListReader(1).read(sch,in),std::runtime_error);
+    EXPECT_FALSE(sch.nets_dirty());
+    EXPECT_EQ(sch.get_all_wires().size(),1);
+    EXPECT_EQ(sch.get_all_netnames(),Vec<string>{"0"});
+    EXPECT_EQ(sch.select_port_node(Coordinate2(0,0)),-1);
+}
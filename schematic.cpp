@@ -1,8 +1,15 @@
 #include "schematic.h"
+#include "editlog.h"
+#include "sessiontrace.h"
 #include <set>
+#include <iterator>  // back_inserter
+#include <unordered_map>
+#include <unordered_set>
 
 #include <iostream>
 #include <cctype>  // ::isdigit
+#include <cmath>
+#include <limits>
 
 using std::cout;
 using std::endl;
@@ -20,10 +27,32 @@ using Estd::any_of;
 
 using Wire = std::pair<int,int>;
 
+// Opens every public method: records the call in the session trace, if any (see
+// SessionTrace), and counts its allocations (see stats()). `record` is the
+// SessionTrace method and arguments that record this call.
+#define NM_PUBLIC_CALL(record) \
+    SessionTrace::Call traced(_trace); \
+    if(traced) traced->record; \
+    NM_ALLOCATIONS(_stats.allocations)
+
 // Initialize static data
 const Wire Schematic::INVALID_WIRE{-1,-1};
 // /static
 
+// Groups everything a public mutator changes into one undo step
+struct Schematic::EditScope
+{
+    Schematic& sch;
+    bool outer;
+    EditScope(Schematic& s) : sch{s}, outer{!s._in_edit} {sch._in_edit = true;}
+    ~EditScope()
+    {
+        if(!outer) return;
+        sch._in_edit = false;
+        sch._commit_step(true);
+    }
+};
+
 template <typename T>
 void print_Vec(const string&& name, const Estd::Vec<T>& v)
 {
@@ -59,8 +88,17 @@ void print_Wire(const Wire& w)
 
 
 
+Vec<Wire> Schematic::get_all_wires()
+{
+    NM_PUBLIC_CALL(_call(SessionTrace::GET_ALL_WIRES));
+    _resolve_if_lazy();
+    return _graph.get_all_edges();
+}
+
 Vec<string> Schematic::get_all_netnames()
 {
+    NM_PUBLIC_CALL(_call(SessionTrace::GET_ALL_NETNAMES));
+    _resolve_if_lazy();
     Vec<string> names;
     for(auto& pair : _nets) names.push_back(pair.first);
     return names;
@@ -74,37 +112,104 @@ Vec<string> Schematic::get_all_netnames()
  * method should return anything at all.
  *
  * Use `traverse=false` if you are adding many wires and don't want to re-traverse
- * every time.
+ * every time. In lazy mode `traverse` is ignored, see set_lazy().
  */
 Wire Schematic::add_wire(Coordinate2 a, Coordinate2 b, bool traverse)
 {
-    // First check if this wire would be degenerate
+    NM_PUBLIC_CALL(_add_wire(a,b,traverse));
+    Timeline::Scope timeline("add_wire");
+    Timeline::Phases steps;
+    steps.next("degenerate check");
+    // First check if this wire would be degenerate, against merged wires as in
+    // eager mode
+    _merge_if_pending();
     Wire wdeg = Schematic::INVALID_WIRE;
     WireType degen = _degenerate(a,b,wdeg);
     if(degen == WireType::WIRE_DEGENERATE) {return Schematic::INVALID_WIRE;}
 
     // Now do the normal adding procedure
+    EditScope scope(*this);
+    steps.next("graph edit");
     int id1 = _graph.add(a,false);
     int id2 = _graph.add(b,false);
     _graph.connect(id1,id2,false);
-    if(traverse)
+    _nets_dirty = true;
+    steps.next(nullptr);
+    if(_lazy) _merge_pending = true;
+    else if(traverse)
     {
         _remove_degenerate_wires();  // This is a one-and-done method for updating.
         // Handles degenerate wires, and calls update_nets(), which in turn
         // calls _update_trees().
     }
+    if(scope.outer && _edit_log) _edit_log->_log_add_wire(a,b,traverse);
 
     return {id1,id2};
 }
 
+/* Add many wires at once. Each segment is added exactly like add_wire(a,b,false), in
+ * order, but vertices and wires are looked up in a spatial index instead of by
+ * scanning the whole graph (see VertexGraph::BulkBuilder), so a batch costs about
+ * the same per wire however large the schematic is. If traverse==true, collinear
+ * wires are merged and the nets updated once at the end. Returns the wire for each
+ * segment, or INVALID_WIRE if it was degenerate. The batch is one undo step.
+ *
+ * This is not the same as calling add_wire(a,b) (traverse=true) for each segment:
+ * that merges collinear wires after every wire, so a later segment can be checked
+ * for degeneracy against merged wires and come out differently.
+ */
+Vec<Wire> Schematic::add_wires(const Vec<std::pair<Coordinate2,Coordinate2>>& segments, bool traverse)
+{
+    NM_PUBLIC_CALL(_add_wires(segments,traverse));
+    Vec<Wire> wires;
+    if(segments.empty()) return wires;
+    wires.reserve(segments.size());
+
+    // Grid cells about the size of an average wire
+    double length = 0;
+    for(auto& s : segments) length += std::abs(s.second.x-s.first.x) + std::abs(s.second.y-s.first.y);
+    double cell = length/segments.size();
+    if(!(cell > 1e3*segments[0].first.prec()) || !std::isfinite(cell)) cell = 1;
+
+    EditScope scope(*this);
+    _merge_if_pending();
+    VertexGraph::BulkBuilder builder(_graph,cell);
+    for(auto& s : segments)
+    {
+        Coordinate2 a = s.first, b = s.second;
+        // Same check as _degenerate()
+        if(a == b) {wires.push_back(Schematic::INVALID_WIRE); continue;}
+        Wire w1 = builder.select_edge(a);
+        if(w1 != Schematic::INVALID_WIRE && w1 == builder.select_edge(b))
+        {
+            Coordinate2 wp1 = builder.pos(w1.first);
+            Coordinate2 wp2 = builder.pos(w1.second);
+            if(!((wp1 == a && wp2 == b) || (wp1 == b && wp2 == a)))
+            {
+                wires.push_back(Schematic::INVALID_WIRE);
+                continue;
+            }
+        }
+        int id1 = builder.add(a);
+        int id2 = builder.add(b);
+        builder.connect(id1,id2);
+        wires.push_back({id1,id2});
+    }
+    _nets_dirty = true;
+    if(_lazy) _merge_pending = true;
+    else if(traverse) _remove_degenerate_wires();
+    if(scope.outer && _edit_log) _edit_log->_log_add_wires(segments,traverse);
+    return wires;
+}
+
 /* Check if wire with coords (a,b) would be degenerate. Set `deg` to existing wire.
  *
  */
 WireType Schematic::_degenerate(Coordinate2 a,Coordinate2 b,Wire& deg)
 {
     if(a == b) return WireType::WIRE_DEGENERATE;
-    Wire w1 = select_wire(a);
-    Wire w2 = select_wire(b);
+    Wire w1 = _select_wire(a);
+    Wire w2 = _select_wire(b);
     if(w1 != Schematic::INVALID_WIRE)
     {
         // Same wire selected, this could be degenerate
@@ -123,6 +228,16 @@ WireType Schematic::_degenerate(Coordinate2 a,Coordinate2 b,Wire& deg)
     return WireType::WIRE_NORMAL;
 }
 
+/* Lazy mode: merge the collinear wires that earlier edits left, so that the next
+ * edit sees the wires it would see in eager mode.
+ */
+void Schematic::_merge_if_pending()
+{
+    if(!_merge_pending) return;
+    _graph.merge_unbranched_collinear_edges();
+    _merge_pending = false;
+}
+
 /* Remove any degenerate wires (collinear non-branching wires).
  * Always calls update_nets().
  */
@@ -134,35 +249,84 @@ void Schematic::_remove_degenerate_wires()
 
 string Schematic::get_netname(Wire w)
 {
+    NM_PUBLIC_CALL(_wire(SessionTrace::GET_NETNAME,w));
+    _resolve_if_lazy();
+    const string* name = _find_netname(w);
+    if(!name) throw std::invalid_argument("Wire is not associated with a net.");
+    return *name;
+}
+
+/* get_netname() without throwing, std::nullopt if the wire has no net.
+ */
+std::optional<string> Schematic::try_get_netname(Wire w)
+{
+    NM_PUBLIC_CALL(_wire(SessionTrace::TRY_GET_NETNAME,w));
+    _resolve_if_lazy();
+    const string* name = _find_netname(w);
+    if(!name) return std::nullopt;
+    return *name;
+}
+
+// Name of the net holding `w` (either way round) in _nets, or nullptr
+const string* Schematic::_find_netname(Wire w) const
+{
+    NM_COUNT(_stats.net_scans,1);
+    Wire w2(w.second,w.first);  // check for flipped coords
     for(auto& nm : _nets)
     {
         // nm = name map
         for(auto& wtmp : nm.second)
         {
-            if(wtmp == w) return nm.first;
-            Wire w2(w.second,w.first);  // check for flipped coords
-            if(wtmp == w2) return nm.first;
+            if(wtmp == w || wtmp == w2) return &nm.first;
         }
     }
-    throw std::invalid_argument("Wire is not associated with a net.");
+    return nullptr;
 }
 
 Vec<Wire> Schematic::select_net(string netname)
 {
+    NM_PUBLIC_CALL(_name(SessionTrace::SELECT_NET,netname));
     // _nets is a multimap, so collect all the trees for this netname
     // if none, throw invalid_argument
+    _resolve_if_lazy();
+    Vec<Wire> selected;
+    if(!_collect_net(netname,selected)) throw std::invalid_argument("Net name was not found in schematic.");
+    return selected;
+}
 
+/* select_net() without throwing, std::nullopt if there is no such net.
+ */
+std::optional<Vec<Wire>> Schematic::try_select_net(const string& netname)
+{
+    NM_PUBLIC_CALL(_name(SessionTrace::TRY_SELECT_NET,netname));
+    _resolve_if_lazy();
     Vec<Wire> selected;
-    auto[range_start,range_end] = _nets.equal_range(netname);
-    if(range_start == _nets.end()) {throw std::invalid_argument("Net name was not found in schematic.");}
+    if(!_collect_net(netname,selected)) return std::nullopt;
+    return selected;
+}
 
-    for(auto& itr = range_start; itr != range_end; ++itr)
+// Append the wires of every tree named `netname` to `selected`, false if none
+bool Schematic::_collect_net(const string& netname, Vec<Wire>& selected) const
+{
+    auto[range_start,range_end] = _nets.equal_range(netname);
+    if(range_start == range_end) return false;
+    for(auto itr = range_start; itr != range_end; ++itr)
     {
-        for(auto w : itr->second)
-        {
-            selected.push_back(w);
-        }
+        selected.insert(selected.end(),itr->second.begin(),itr->second.end());
     }
+    return true;
+}
+
+/* Select the net of the wire at `p`, or an empty Vec if there is no wire.
+ */
+Vec<Wire> Schematic::select_net(Coordinate2 p)
+{
+    NM_PUBLIC_CALL(_point(SessionTrace::SELECT_NET_AT,p));
+    Wire w = select_wire(p);
+    if(w == Schematic::INVALID_WIRE) return {};
+    const string* name = _find_netname(w);
+    Vec<Wire> selected;
+    if(name) _collect_net(*name,selected);
     return selected;
 }
 
@@ -172,41 +336,71 @@ Vec<Wire> Schematic::select_net(string netname)
  */
 Wire Schematic::select_wire(Coordinate2 p)
 {
-    Vec<Wire> edges = get_all_wires();
-    double tol = p.prec();
-    double dist = 0;
-    for(auto& e : edges)
-    {
-        dist = distance_from_line(p, _graph.pos(e.first),_graph.pos(e.second));
-        if(dist < tol) return e;
-    }
-    return Schematic::INVALID_WIRE;
+    NM_PUBLIC_CALL(_point(SessionTrace::SELECT_WIRE,p));
+    _resolve_if_lazy();
+    return _select_wire(p);
+}
+
+// select_wire() without resolving, for use while editing
+Wire Schematic::_select_wire(Coordinate2 p)
+{
+    return _select_wire(_pick_segments(),p);
+}
+
+// _select_wire() on segments from _pick_segments(), safe to call from the pool
+Wire Schematic::_select_wire(const SegmentBatch& segments, Coordinate2 p) const
+{
+    NM_COUNT(_stats.select_wire,1);
+    size_t i = segments.first_within(p,p.prec());
+    return i == SegmentBatch::npos ? Schematic::INVALID_WIRE : _pick.wires[i];
+}
+
+/*
+ * The wires of get_all_edges() as segments, in the same order, for the brute-force
+ * picks. Rebuilt when the graph's structure changes.
+ */
+const SegmentBatch& Schematic::_pick_segments()
+{
+    if(_pick.valid && _pick.graph_version == _graph.structure_version()) return _pick.segments;
+    _pick.wires = _graph.get_all_edges();
+    _pick.segments.clear();
+    _pick.segments.reserve(_pick.wires.size());
+    for(auto& e : _pick.wires) _pick.segments.push_back(_graph.pos(e.first),_graph.pos(e.second));
+    _pick.graph_version = _graph.structure_version();
+    _pick.valid = true;
+    return _pick.segments;
 }
 
 /* Select every wire which overlaps `p`. If none, return empty Vec.
  */
 Vec<Wire> Schematic::select_wires(Coordinate2 p)
 {
-    Vec<Wire> edges = get_all_wires();
+    NM_PUBLIC_CALL(_point(SessionTrace::SELECT_WIRES,p));
+    _resolve_if_lazy();
+    const SegmentBatch& segments = _pick_segments();
     Vec<Wire> selected;
-    double tol = p.prec();
-    double dist = 0;
-    for(auto& e : edges)
-    {
-        dist = distance_from_line(p, _graph.pos(e.first),_graph.pos(e.second));
-        if(dist < tol) selected.push_back(e);
-    }
+    for(size_t i : segments.all_within(p,p.prec())) selected.push_back(_pick.wires[i]);
     return selected;
 }
 
 bool Schematic::remove_wire(Wire w, bool traverse)
 {
+    NM_PUBLIC_CALL(_remove_wire(w,traverse));
+    Timeline::Scope timeline("remove_wire");
+    Timeline::Phases steps;
+    EditScope scope(*this);
+    steps.next("graph edit");
     _graph.disconnect(w.first,w.second,false);
+    // Release now, the vertex ids may be reused before the next update_nets()
+    _wire_handles.release({std::min(w.first,w.second),std::max(w.first,w.second)});
     // note that isolated() doesn't depend on traversal
     if(_graph.isolated(w.first)) _graph.erase(w.first,false);
     if(_graph.isolated(w.second)) _graph.erase(w.second,false);
 
-    if(traverse) update_nets();
+    _nets_dirty = true;
+    steps.next(nullptr);
+    if(traverse && !_lazy) update_nets();
+    if(scope.outer && _edit_log) _edit_log->_log_remove_wire(w,traverse);
 
     return true;
 }
@@ -216,6 +410,21 @@ bool netname_is_int(const string& name)
     return !name.empty() && std::all_of(name.begin(), name.end(), ::isdigit);
 }
 
+// Order-dependent hash of a wire list, used to match trees and nets quickly
+static uint64_t fingerprint(const Vec<Wire>& wires)
+{
+    uint64_t h = 1469598103934665603ull ^ wires.size();
+    for(auto& w : wires)
+    {
+        uint64_t x = (uint64_t(uint32_t(w.first)) << 32) | uint32_t(w.second);
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        h = (h ^ x) * 1099511628211ull;
+    }
+    return h;
+}
+
 /* Update net names.
  * Reprocess the whole schematic, basic heuristics for new net names. Calls _update_trees().
  * Call this when changes to the schematic are made. Methods like add_wire() and
@@ -223,8 +432,16 @@ bool netname_is_int(const string& name)
  */
 void Schematic::update_nets()
 {
+    NM_PUBLIC_CALL(_call(SessionTrace::UPDATE_NETS));
     // Note: This is a big function, but breaking it up would be uglier imho.
 
+    // Resolving outside of an edit (explicitly, or on a query in lazy mode)
+    // changes the nets, so the edit log replays it
+    if(_edit_log && !_in_edit && !_replaying) _edit_log->_log_update_nets();
+    NM_TIME(_stats.update_nets);
+    Timeline::Scope timeline("update_nets");
+    Timeline::Phases steps;
+
     // Go through current spanning trees, compare with spanning trees in _nets
     // Only add _nets keys that correspond to existing spanning trees in _etrees.
     // If any spanning tree is not a value in _nets, give it a new name, checking
@@ -232,33 +449,79 @@ void Schematic::update_nets()
     multimap<string,Vec<Wire>> nets_new;
     std::set<int> ok_trees;
     std::set<string> ok_nets;
+    bool changed = false;  // any net renamed, resized or dropped
+    steps.next("merge pending",&_stats.nets_merge);
+    _merge_if_pending();
+    steps.next("trees",&_stats.nets_trees);
     _update_trees();
+    steps.next("match nets",&_stats.nets_match);
+
+    // Fingerprint trees and nets (in parallel) so that unchanged nets are found
+    // with a hash lookup instead of comparing wire lists
+    Vec<const Vec<Wire>*> net_wires;
+    for(auto& net : _nets) net_wires.push_back(&net.second);
+    std::vector<uint64_t> tree_fps(_etrees.size()), net_fps(net_wires.size());
+    _for_each_tree(_etrees.size(),[&](size_t t) {tree_fps[t] = fingerprint(_etrees[t]);});
+    _for_each_tree(net_wires.size(),[&](size_t i) {net_fps[i] = fingerprint(*net_wires[i]);});
+    std::unordered_multimap<uint64_t,int> trees_by_fp;
+    for(int t=0; t<tree_fps.size(); t++) trees_by_fp.insert({tree_fps[t],t});
 
     int treeid = -1; // init treeid
+    int netidx = 0;
+    std::vector<char> net_kept(_nets.size(),0);     // for the undo journal
+    std::set<const void*> entries_kept;
     // For each net (name : etree), search _etrees for it
     for(auto& net : _nets)
     {
-        // lower_bound returns iter to first elem !< val, so
-        // verify that it actually matches
-        auto itr_lb = std::lower_bound(_etrees.begin(),_etrees.end(),net.second);
-        if(itr_lb != _etrees.end() && *itr_lb == net.second)
+        // Lowest matching tree id, verifying the fingerprint match
+        treeid = -1;
+        auto[fp_start,fp_end] = trees_by_fp.equal_range(net_fps[netidx++]);
+        for(auto itr = fp_start; itr != fp_end; ++itr)
+        {
+            if((treeid < 0 || itr->second < treeid) && _etrees[itr->second] == net.second) treeid = itr->second;
+        }
+        if(treeid >= 0)
         {
-            // if match, get index of tree
-            treeid = std::distance(_etrees.begin(),itr_lb);
             // update
             ok_trees.insert(treeid);
-            nets_new.insert(net);
+            entries_kept.insert(&*nets_new.insert(net));
             ok_nets.insert(net.first);
+            net_kept[netidx-1] = 1;
+        }
+    }
+
+    // Nets that are about to be changed or dropped, as they were
+    Vec<std::pair<string,Vec<Wire>>> nets_changed;
+    if(_recording())
+    {
+        netidx = 0;
+        for(auto& net : _nets)
+        {
+            if(!net_kept[netidx++]) nets_changed.push_back(net);
         }
     }
 
     // For each net, check if net tree includes any tree in _etrees
-    // Only search through trees that are not in ok_trees
+    // Only search through trees that are not in ok_trees. A tree can only be a
+    // subset or superset of a net if it holds one of the net's wires.
+    // A changed net keeps its handle if its remaining wires lie in one tree that
+    // holds no other net's wires and gets the net's name; merged, split and renamed
+    // nets don't (see _sync_handles()).
+    Vec<std::pair<string,int>> net_successors;  // name, the tree of its wires or -1
+    std::map<int,std::set<string>> tree_netnames;
     for(auto& net : _nets)
     {
         if(ok_nets.find(net.first) == ok_nets.end())
         {
-            for(treeid=0; treeid < _etrees.size(); treeid++)
+            std::set<int> candidates;
+            for(auto& w : net.second)
+            {
+                int t = _tree_of_wire(w);
+                if(t >= 0) candidates.insert(t);
+            }
+            net_successors.push_back({net.first,candidates.size() == 1 ? *candidates.begin() : -1});
+            for(int treeid : candidates) tree_netnames[treeid].insert(net.first);
+            for(int treeid : candidates)
             {
                 if(ok_trees.find(treeid) == ok_trees.end())
                 {
@@ -274,6 +537,7 @@ void Schematic::update_nets()
                         net.second = _etrees[treeid];
                         nets_new.insert(net);
                         ok_nets.insert(net.first);
+                        changed = true;
                     }
                     else if(std::includes(_etrees[treeid].begin(),_etrees[treeid].end(),
                             net.second.begin(),net.second.end()))
@@ -285,6 +549,7 @@ void Schematic::update_nets()
                         net.second = _etrees[treeid];
                         nets_new.insert(net);
                         ok_nets.insert(net.first);
+                        changed = true;
                     }
                 }
             }
@@ -297,6 +562,7 @@ void Schematic::update_nets()
     {
         if(ok_nets.find(pair.first) == ok_nets.end())
         {
+            changed = true;
             // See if name is a plain number, and if so, add back to pool
             if(netname_is_int(pair.first))
             {
@@ -305,27 +571,39 @@ void Schematic::update_nets()
             }
         }
     }
+    steps.next("name new nets",&_stats.nets_ports);
+    // Tree under each port, looked up once per port (in parallel) instead of once
+    // per unnamed tree. A tree takes the name of its first port.
+    Vec<int> tree_port(_etrees.size(),-1);
+    if(ok_trees.size() < _etrees.size())
+    {
+        Vec<int> port_tree(_ports.size(),-1);
+        const SegmentBatch& segments = _pick_segments();   // built here, read by the pool
+        _for_each_tree(_ports.size(),[&](size_t i) {
+            // get first matching wire
+            Wire port_wire = _select_wire(segments,_ports[i].first);
+            if(port_wire != Schematic::INVALID_WIRE) port_tree[i] = _tree_of_wire(port_wire);
+        });
+        for(int i=_ports.size()-1; i>=0; i--)
+        {
+            if(port_tree[i] >= 0) tree_port[port_tree[i]] = i;
+        }
+    }
+
     // Any trees not in `ok_trees` must be given net names
     for(int treeid=0; treeid < _etrees.size(); treeid++)
     {
         if(ok_trees.find(treeid) == ok_trees.end())
         {
+            changed = true;
             // Rename net
             // First check for ports
             bool has_port = false;
-            for(auto& p : _ports)
+            if(tree_port[treeid] >= 0)
             {
-                // get first matching wire
-                Wire port_wire = select_wire(p.first);
-                if(port_wire != Schematic::INVALID_WIRE) {
-                    // Check if this wire is in the current tree
-                    if(contains(_etrees[treeid],port_wire)) {
-                        // Port is connected to this tree
-                        nets_new.insert({p.second, _etrees[treeid]});
-                        has_port = true;
-                        break;  // stop looking for ports
-                    }
-                }
+                // Port is connected to this tree
+                nets_new.insert({_ports[tree_port[treeid]].second, _etrees[treeid]});
+                has_port = true;
             }
 
             if(!has_port)
@@ -338,7 +616,601 @@ void Schematic::update_nets()
         }
     }
 
-    _nets = nets_new;
+    for(auto& pair : net_successors)
+    {
+        int treeid = pair.second;
+        bool same = false;
+        if(treeid >= 0 && tree_netnames[treeid].size() == 1)
+        {
+            auto[range_start,range_end] = nets_new.equal_range(pair.first);
+            for(auto itr = range_start; itr != range_end && !same; ++itr) same = itr->second == _etrees[treeid];
+        }
+        if(!same) _stale_netnames.push_back(pair.first);
+    }
+
+    steps.next("publish",&_stats.nets_publish);
+    if(changed) _nets_version++;
+    _nets = std::move(nets_new);
+    _nets_dirty = false;
+    if(_recording())
+    {
+        // Integer names that were dropped or newly made went through _idpool
+        for(auto& net : nets_changed)
+        {
+            _record_net(false,netname_is_int(net.first) && !ok_nets.count(net.first),net.first,net.second);
+        }
+        for(auto& net : _nets)
+        {
+            if(entries_kept.count(&net)) continue;
+            _record_net(true,netname_is_int(net.first) && !ok_nets.count(net.first),net.first,net.second);
+        }
+    }
+
+    _sync_handles();
+    if(!_in_edit) _commit_step(false);
+    if(_concurrent_readers) _publish_connectivity();
+    if(_diffing_nets()) _notify_net_listeners();
+    if(_verify) _verify_nets();
+}
+
+/*
+ * Bring the handle tables in line with the resolved nets. Wires and nets that
+ * still exist keep their handles, all others are invalidated. So are the handles
+ * of nets in `_stale_netnames`, even if their name is in use again: a net name
+ * can pass to another net within one resolution.
+ */
+void Schematic::_sync_handles()
+{
+    for(auto& name : _stale_netnames) _net_handles.release(name);
+    _stale_netnames.clear();
+    Vec<Wire> wires;
+    Vec<string> netnames;
+    for(auto& net : _nets)
+    {
+        wires.insert(wires.end(),net.second.begin(),net.second.end());
+        if(netnames.empty() || netnames.back() != net.first) netnames.push_back(net.first);
+    }
+    Estd::sort(wires);
+    _wire_handles.sync(wires);
+    _net_handles.sync(netnames);
+}
+
+/*
+ * Switch lazy net resolution on or off.
+ * In lazy mode add_wire(), add_wires() and remove_wire() only record that the nets
+ * are stale, whatever their `traverse` argument. The next query (get_netname(),
+ * select_net(), get_all_netnames(), select_wire(), ...) resolves the nets once for
+ * all edits since the last query. Collinear wires left unmerged are merged before
+ * the next wire is added, and port edits resolve pending edits and themselves at
+ * once, so the nets match eager mode and a port names the net it is added to.
+ * Names can still differ where eager mode named a net between edits that lazy
+ * mode resolves together: numbered names, or a port that a later wire reaches.
+ * Turning lazy mode off resolves any pending edits.
+ */
+void Schematic::set_lazy(bool lazy)
+{
+    NM_PUBLIC_CALL(_flag(SessionTrace::SET_LAZY,lazy));
+    _lazy = lazy;
+    if(!_lazy && _nets_dirty) update_nets();
+}
+
+void Schematic::_resolve_if_lazy()
+{
+    if(_lazy && _nets_dirty) update_nets();
+}
+
+/*
+ * Publish a Connectivity snapshot after every net resolution, for readers on other
+ * threads. Enabling publishes the current nets (resolving them first if needed),
+ * disabling drops the last snapshot. Call this from the thread doing the edits.
+ */
+void Schematic::set_concurrent_readers(bool enable)
+{
+    _concurrent_readers = enable;
+    if(!enable) std::atomic_store(&_connectivity,std::shared_ptr<const Connectivity>());
+    else if(_nets_dirty) update_nets();
+    else _publish_connectivity();
+}
+
+/*
+ * Build a snapshot of the resolved nets and swap it in. Readers holding the
+ * previous snapshot keep it alive until they let go of it. Nets whose wires and
+ * positions did not change are shared with the previous snapshot, and only the
+ * vertex index blocks holding vertices of changed nets are copied.
+ */
+void Schematic::_publish_connectivity()
+{
+    using Net = Connectivity::Net;
+    using Block = Connectivity::Block;
+    auto prev = std::atomic_load(&_connectivity);
+    auto snapshot = std::make_shared<Connectivity>();
+    snapshot->_structure_version = structure_version();
+    snapshot->_geometry_version = geometry_version();
+    snapshot->_nets_version = _nets_version;
+    if(prev) snapshot->_vertices = prev->_vertices;
+
+    // Vertex index blocks copied for this snapshot, by block index
+    Vec<Block*> copied(snapshot->_vertices.size(),nullptr);
+    auto vertex = [&](int id) -> Connectivity::Vertex& {
+        size_t b = id/Connectivity::BLOCK;
+        if(b >= snapshot->_vertices.size())
+        {
+            snapshot->_vertices.resize(b+1);
+            copied.resize(b+1,nullptr);
+        }
+        if(!copied[b])
+        {
+            auto& shared = snapshot->_vertices[b];
+            auto block = shared ? std::make_shared<Block>(*shared) : std::make_shared<Block>();
+            copied[b] = block.get();
+            shared = std::move(block);
+        }
+        return (*copied[b])[id%Connectivity::BLOCK];
+    };
+
+    std::unordered_set<const Net*> reused(_nets.size());
+    Vec<const Net*> fresh;
+    for(auto& net : _nets)
+    {
+        std::shared_ptr<const Net> shared;
+        if(prev)
+        {
+            auto[range_start,range_end] = prev->_nets.equal_range(net.first);
+            for(auto itr = range_start; itr != range_end && !shared; ++itr)
+            {
+                if(itr->second->wires != net.second) continue;
+                // A freed vertex id can come back at another position
+                bool same_positions = std::all_of(net.second.begin(),net.second.end(),[&](const Wire& w) {
+                    return prev->_vertex(w.first)->pos == _graph.pos(w.first)
+                            && prev->_vertex(w.second)->pos == _graph.pos(w.second);
+                });
+                if(same_positions && !reused.count(itr->second.get())) shared = itr->second;
+            }
+        }
+        if(shared) reused.insert(shared.get());
+        else
+        {
+            auto made = std::make_shared<Net>();
+            made->name = net.first;
+            made->wires = net.second;
+            fresh.push_back(made.get());
+            shared = std::move(made);
+        }
+        snapshot->_nets.emplace_hint(snapshot->_nets.end(),net.first,std::move(shared));
+    }
+
+    // Vertices of nets that are gone first, then those of the new nets
+    if(prev)
+    {
+        for(auto& net : prev->_nets)
+        {
+            if(reused.count(net.second.get())) continue;
+            for(auto& w : net.second->wires)
+            {
+                for(int id : {w.first,w.second})
+                {
+                    if(prev->_vertex(id)->net == net.second.get()) vertex(id).net = nullptr;
+                }
+            }
+        }
+    }
+    for(const Net* net : fresh)
+    {
+        for(auto& w : net->wires)
+        {
+            vertex(w.first) = {net,_graph.pos(w.first)};
+            vertex(w.second) = {net,_graph.pos(w.second)};
+        }
+    }
+    std::atomic_store(&_connectivity,std::shared_ptr<const Connectivity>(std::move(snapshot)));
+}
+
+/*
+ * Keep up to `max_steps` undo steps, see undo(). 0 turns the journal off and
+ * drops the history.
+ */
+void Schematic::set_undo_limit(size_t max_steps)
+{
+    NM_PUBLIC_CALL(_count(SessionTrace::SET_UNDO_LIMIT,max_steps));
+    _undo_limit = max_steps;
+    if(_undo_limit == 0) clear_undo();
+    while(_undo.size() > _undo_limit) _undo.pop_front();
+    _graph.set_journal(_undo_limit > 0 ? &_open_step.graph : nullptr);
+}
+
+void Schematic::clear_undo()
+{
+    _undo.clear();
+    _redo.clear();
+    _open_step = EditStep();
+    _step_pending = false;
+}
+
+/*
+ * Revert the last edit. Pending edits (lazy mode or traverse=false) are resolved
+ * first, so they are part of the last step: edits made while the nets are pending
+ * are undone together. Returns false if there is nothing to undo.
+ */
+bool Schematic::undo()
+{
+    NM_PUBLIC_CALL(_call(SessionTrace::UNDO));
+    if(_nets_dirty) update_nets();
+    if(_undo.empty()) return false;
+    EditStep step = std::move(_undo.back());
+    _undo.pop_back();
+    _replay(step,true);
+    if(_edit_log) _edit_log->_log_step(step,true);
+    _redo.push_back(std::move(step));
+    return true;
+}
+
+/*
+ * Apply the last undone edit again. Returns false if there is nothing to redo.
+ */
+bool Schematic::redo()
+{
+    NM_PUBLIC_CALL(_call(SessionTrace::REDO));
+    if(_nets_dirty) update_nets();
+    if(_redo.empty()) return false;
+    EditStep step = std::move(_redo.back());
+    _redo.pop_back();
+    _replay(step,false);
+    if(_edit_log) _edit_log->_log_step(step,false);
+    _undo.push_back(std::move(step));
+    return true;
+}
+
+void Schematic::_record_net(bool insert, bool pooled, const string& name, const Vec<Wire>& wires)
+{
+    if(_recording()) _open_step.nets.push_back({insert,pooled,name,wires});
+}
+
+/*
+ * Close the changes recorded since the last step. The changes of a public mutator
+ * make a new step, anything else (e.g. resolving nets in lazy mode) belongs to
+ * the last step. Net changes are recorded against resolved nets, so edits made
+ * while the nets are pending join the last step until the nets are resolved.
+ */
+void Schematic::_commit_step(bool new_step)
+{
+    bool pending = _step_pending;
+    _step_pending = _nets_dirty && (pending || !_open_step.empty());
+    if(_open_step.empty()) return;
+    if(new_step && !(pending && !_undo.empty()))
+    {
+        _undo.push_back(std::move(_open_step));
+        _redo.clear();
+        while(_undo.size() > _undo_limit) _undo.pop_front();
+    }
+    else if(!_undo.empty())
+    {
+        EditStep& last = _undo.back();
+        last.graph.insert(last.graph.end(),_open_step.graph.begin(),_open_step.graph.end());
+        last.ports.insert(last.ports.end(),_open_step.ports.begin(),_open_step.ports.end());
+        last.nets.insert(last.nets.end(),_open_step.nets.begin(),_open_step.nets.end());
+    }
+    _open_step = EditStep();
+}
+
+/*
+ * Apply `step` (or revert it if `inverse`) to the graph, the ports and the net
+ * table, then resolve the nets. Since the net table is restored as well, nets keep
+ * the names they had before (or after) the step.
+ */
+void Schematic::_replay(const EditStep& step, bool inverse)
+{
+    _replaying = true;
+    auto replay_port = [this,inverse](const PortOp& op) {
+        if(op.add != inverse) _ports.insert(_ports.begin()+op.index,op.port);
+        else _ports.erase(_ports.begin()+op.index);
+    };
+    auto replay_net = [this,inverse](const NetOp& op) {
+        if(op.insert != inverse)
+        {
+            if(op.pooled) _idpool.take(std::stoi(op.name));
+            _nets.insert({op.name,op.wires});
+            return;
+        }
+        auto[range_start,range_end] = _nets.equal_range(op.name);
+        for(auto itr = range_start; itr != range_end; ++itr)
+        {
+            if(itr->second != op.wires) continue;
+            _nets.erase(itr);
+            _stale_netnames.push_back(op.name);    // undone or redone nets get new handles
+            if(op.pooled) _idpool.put_back(std::stoi(op.name));
+            break;
+        }
+    };
+    if(inverse)
+    {
+        for(auto itr = step.graph.rbegin(); itr != step.graph.rend(); ++itr) _graph.replay(*itr,true,false);
+        for(auto itr = step.ports.rbegin(); itr != step.ports.rend(); ++itr) replay_port(*itr);
+        for(auto itr = step.nets.rbegin(); itr != step.nets.rend(); ++itr) replay_net(*itr);
+    }
+    else
+    {
+        for(auto& entry : step.graph) _graph.replay(entry,false,false);
+        for(auto& op : step.ports) replay_port(op);
+        for(auto& op : step.nets) replay_net(op);
+    }
+    if(!step.ports.empty()) _ports_version++;
+    if(!step.nets.empty()) _nets_version++;
+    _nets_dirty = true;
+    update_nets();
+    _replaying = false;
+}
+
+/*
+ * Return an immutable snapshot of the schematic. If nothing changed since the last
+ * call, the same snapshot is returned, without allocating. Otherwise pending edits
+ * are resolved (in any mode) and a new one is built that reuses the previous
+ * snapshot's port list and every net whose wires and positions are unchanged, so
+ * only changed nets are copied.
+ */
+std::shared_ptr<const SchematicSnapshot> Schematic::snapshot()
+{
+    NM_PUBLIC_CALL(_call(SessionTrace::SNAPSHOT));
+    if(!_nets_dirty && _snapshot_current()) return _snapshot;
+    if(_nets_dirty) update_nets();
+    if(_snapshot_current()) return _snapshot;
+    std::shared_ptr<const SchematicSnapshot> prev = _snapshot;
+
+    auto snap = std::make_shared<SchematicSnapshot>();
+    snap->_name = name;
+    snap->_structure_version = structure_version();
+    snap->_geometry_version = geometry_version();
+    snap->_nets_version = _nets_version;
+    // Positions can only have changed if the graph did
+    bool same_graph = prev && prev->_graph_version == _graph.structure_version();
+    for(auto& net : _nets)
+    {
+        std::shared_ptr<const SchematicSnapshot::Net> shared;
+        if(prev)
+        {
+            auto[range_start,range_end] = prev->_nets.equal_range(net.first);
+            for(auto itr = range_start; itr != range_end && !shared; ++itr)
+            {
+                if(itr->second->wires == net.second) shared = itr->second;
+            }
+        }
+        if(!shared || !same_graph)
+        {
+            auto fresh = std::make_shared<SchematicSnapshot::Net>();
+            fresh->wires = net.second;
+            for(auto& w : net.second) fresh->segments.push_back({_graph.pos(w.first),_graph.pos(w.second)});
+            if(!shared || shared->segments != fresh->segments) shared = std::move(fresh);
+        }
+        snap->_nets.emplace_hint(snap->_nets.end(),net.first,std::move(shared));
+    }
+    if(prev && prev->_ports_version == _ports_version) snap->_ports = prev->_ports;
+    else snap->_ports = std::make_shared<const Vec<Port>>(_ports);
+    snap->_ports_version = _ports_version;
+    snap->_graph_version = _graph.structure_version();
+
+    if(_verify) _verify_snapshot(*snap);
+    _snapshot = snap;
+    return snap;
+}
+
+// The last snapshot() still shows the schematic
+bool Schematic::_snapshot_current() const
+{
+    return _snapshot && _snapshot->_structure_version == structure_version()
+            && _snapshot->_geometry_version == geometry_version()
+            && _snapshot->_nets_version == _nets_version && _snapshot->_name == name;
+}
+
+/*
+ * Add a listener for net changes. After every update_nets() that changes any net,
+ * each listener is called once with the list of changes. Listeners must not modify
+ * the schematic. Returns a subscription id for unsubscribe_nets().
+ */
+int Schematic::subscribe_nets(NetListener listener)
+{
+    if(!_diffing_nets()) _nets_reported = _nets;
+    _net_listeners[_next_subscription] = listener;
+    return _next_subscription++;
+}
+
+void Schematic::unsubscribe_nets(int subscription)
+{
+    _net_listeners.erase(subscription);
+    if(!_diffing_nets()) _nets_reported.clear();
+}
+
+/*
+ * Keep a version per net name. All current nets start at the current nets_version().
+ */
+void Schematic::track_net_versions(bool track)
+{
+    if(track == _track_net_versions) return;
+    if(track)
+    {
+        if(!_diffing_nets()) _nets_reported = _nets;
+        for(auto& net : _nets) _net_versions[net.first] = _nets_version;
+    }
+    _track_net_versions = track;
+    if(!track)
+    {
+        _net_versions.clear();
+        if(!_diffing_nets()) _nets_reported.clear();
+    }
+}
+
+/*
+ * Return the nets_version() at which net `netname` last changed, or 0 if there is
+ * no such net or net versions aren't tracked.
+ */
+uint64_t Schematic::net_version(const string& netname) const
+{
+    auto itr = _net_versions.find(netname);
+    return itr == _net_versions.end() ? 0 : itr->second;
+}
+
+// Wires of each net name, sorted (nets with a shared name are combined)
+static map<string,Vec<Wire>> wires_by_name(const multimap<string,Vec<Wire>>& nets)
+{
+    map<string,Vec<Wire>> by_name;
+    for(auto& net : nets)
+    {
+        Vec<Wire>& wires = by_name[net.first];
+        wires.insert(wires.end(),net.second.begin(),net.second.end());
+    }
+    for(auto& pair : by_name) Estd::sort(pair.second);
+    return by_name;
+}
+
+/*
+ * Work out what happened to each net between `old_nets` and `new_nets`.
+ * Nets are matched through the wires they share: a new name that takes over one
+ * vanished net is a rename, one that takes over several is a merge, and one that
+ * takes wires from nets that still exist is a split. Unchanged nets are skipped.
+ */
+static Vec<Schematic::NetEvent> diff_nets(const multimap<string,Vec<Wire>>& old_nets,
+                                          const multimap<string,Vec<Wire>>& new_nets)
+{
+    using NetEvent = Schematic::NetEvent;
+    map<string,Vec<Wire>> old_by_name = wires_by_name(old_nets);
+    map<string,Vec<Wire>> new_by_name = wires_by_name(new_nets);
+
+    // Only nets that changed can share wires with another name
+    map<Wire,string> old_owner;
+    for(auto& pair : old_by_name)
+    {
+        auto itr = new_by_name.find(pair.first);
+        if(itr != new_by_name.end() && itr->second == pair.second) continue;
+        for(auto& w : pair.second) old_owner[w] = pair.first;
+    }
+
+    Vec<NetEvent> events;
+    set<string> consumed;
+    for(auto& pair : new_by_name)
+    {
+        auto old_itr = old_by_name.find(pair.first);
+        bool existed = old_itr != old_by_name.end();
+        if(existed && old_itr->second == pair.second) continue;
+
+        set<string> vanished, surviving;
+        for(auto& w : pair.second)
+        {
+            auto owner = old_owner.find(w);
+            if(owner == old_owner.end() || owner->second == pair.first) continue;
+            if(new_by_name.count(owner->second)) surviving.insert(owner->second);
+            else vanished.insert(owner->second);
+        }
+
+        NetEvent ev;
+        ev.name = pair.first;
+        if(!vanished.empty())
+        {
+            ev.sources.assign(vanished.begin(),vanished.end());
+            bool rename = !existed && vanished.size() == 1 && surviving.empty();
+            ev.type = rename ? NetChangeType::NET_RENAMED : NetChangeType::NET_MERGED;
+        }
+        else if(!existed && !surviving.empty())
+        {
+            ev.sources.assign(surviving.begin(),surviving.end());
+            ev.type = NetChangeType::NET_SPLIT;
+        }
+        else if(existed) ev.type = NetChangeType::NET_MODIFIED;
+        else ev.type = NetChangeType::NET_CREATED;
+        consumed.insert(vanished.begin(),vanished.end());
+
+        // Wire deltas against this net's old wires plus everything it absorbed
+        Vec<Wire> baseline;
+        if(existed) baseline = old_itr->second;
+        for(auto& src : vanished)
+        {
+            Vec<Wire>& src_wires = old_by_name[src];
+            baseline.insert(baseline.end(),src_wires.begin(),src_wires.end());
+        }
+        Estd::sort(baseline);
+        std::set_difference(pair.second.begin(),pair.second.end(),baseline.begin(),baseline.end(),
+                            std::back_inserter(ev.added));
+        std::set_difference(baseline.begin(),baseline.end(),pair.second.begin(),pair.second.end(),
+                            std::back_inserter(ev.removed));
+        events.push_back(std::move(ev));
+    }
+
+    for(auto& pair : old_by_name)
+    {
+        if(new_by_name.count(pair.first) || consumed.count(pair.first)) continue;
+        events.push_back({NetChangeType::NET_DELETED,pair.first,{},{},pair.second});
+    }
+    return events;
+}
+
+/*
+ * Send listeners the changes since the nets were last reported.
+ * Diffing against the last reported nets, rather than _nets at the start of
+ * update_nets(), also catches nets that the port methods dropped beforehand.
+ */
+void Schematic::_notify_net_listeners()
+{
+    Vec<NetEvent> events = diff_nets(_nets_reported,_nets);
+    _nets_reported = _nets;
+    _publish_net_events(events);
+}
+
+// Stamp per-net versions and call listeners
+void Schematic::_publish_net_events(const Vec<NetEvent>& events)
+{
+    if(events.empty()) return;
+    if(_track_net_versions)
+    {
+        for(auto& ev : events)
+        {
+            if(ev.type == NetChangeType::NET_DELETED) {_net_versions.erase(ev.name); continue;}
+            _net_versions[ev.name] = _nets_version;
+            if(ev.type == NetChangeType::NET_MERGED || ev.type == NetChangeType::NET_RENAMED)
+            {
+                for(auto& src : ev.sources) _net_versions.erase(src);
+            }
+        }
+    }
+    auto listeners = _net_listeners;  // listeners may unsubscribe while being called
+    for(auto& pair : listeners) pair.second(events);
+}
+
+/*
+ * Return a handle to wire `w`, which stays valid until `w` itself is changed.
+ * Returns an invalid handle if `w` is not a wire in a net.
+ */
+Schematic::WireHandle Schematic::get_wire_handle(Wire w) const
+{
+    if(w.first > w.second) std::swap(w.first,w.second);
+    return _wire_handles.find(w);
+}
+
+/*
+ * Return the wire for handle `h`, or INVALID_WIRE if the wire was removed, split or
+ * merged since the handle was made.
+ */
+Wire Schematic::resolve(WireHandle h) const
+{
+    const Wire* w = _wire_handles.resolve(h);
+    return w ? *w : Schematic::INVALID_WIRE;
+}
+
+/*
+ * Return a handle to the net `netname`, which stays valid while the net keeps its
+ * name and is not merged or split. Wires added to or removed from the net keep it
+ * valid; undo and redo of a step that changed the net do not. A name that passes to
+ * another net does not revive the handle. Returns an invalid handle if there is no
+ * such net.
+ */
+Schematic::NetHandle Schematic::get_net_handle(std::string netname) const
+{
+    return _net_handles.find(netname);
+}
+
+/*
+ * Return the net name for handle `h`, or an empty string if the net is gone.
+ */
+string Schematic::resolve(NetHandle h) const
+{
+    const string* name = _net_handles.resolve(h);
+    return name ? *name : string();
 }
 
 /* Add a new port node.
@@ -348,6 +1220,7 @@ void Schematic::update_nets()
  */
 int Schematic::add_port_node(Port port, bool traverse)
 {
+    NM_PUBLIC_CALL(_add_port(port,traverse));
     // Check name
     if(netname_is_int(port.second)) {return -1;}
     // Check for duplicate ports
@@ -357,33 +1230,54 @@ int Schematic::add_port_node(Port port, bool traverse)
     }
 
     // Add port
+    EditScope scope(*this);
+    // A port renames the net under it as the nets are now, so in lazy mode pending
+    // edits are resolved first, and the port's own change at once
+    if(_lazy && _nets_dirty) update_nets();
     Estd::to_lower(port.second);  // by reference
     _ports.push_back(port);
+    _ports_version++;
+    if(_recording()) _open_step.ports.push_back({true,static_cast<int>(_ports.size())-1,port});
 
     // Remove any trees from _nets to force refactor
-    Wire pw = select_wire(port.first);
+    _release_port_net(port.first);
+
+    _nets_dirty = true;
+    if(traverse || _lazy) update_nets();
+    if(scope.outer && _edit_log) _edit_log->_log_add_port(port,traverse);
+    return _ports.size()-1;  // last element
+}
+
+/*
+ * Remove the net under position `p` from _nets, so that update_nets() names it
+ * again (and finds the port at `p`).
+ */
+void Schematic::_release_port_net(Coordinate2 p)
+{
+    Wire pw = _select_wire(p);
     if(pw != Schematic::INVALID_WIRE)
     {
         // This port overlaps a wire
         // Remove its tree from _nets
-        try{
-            string netname = get_netname(pw);
-            if(_nets.find(netname) != _nets.end())
+        const string* found = _find_netname(pw);
+        if(found)
+        {
+            string netname = *found;  // copied, the entry is erased below
+            _stale_netnames.push_back(netname);
+            // Return netname to pool if integer
+            if(netname_is_int(netname))
             {
-                // Return netname to pool if integer
-                if(netname_is_int(netname))
-                {
-                    int netnum = std::stoi(netname);
-                    _idpool.put_back(netnum);
-                }
-                auto[range_start,range_end] = _nets.equal_range(netname);
-                _nets.erase(range_start,range_end);
+                int netnum = std::stoi(netname);
+                _idpool.put_back(netnum);
+            }
+            auto[range_start,range_end] = _nets.equal_range(netname);
+            for(auto itr = range_start; itr != range_end; ++itr)
+            {
+                _record_net(false,netname_is_int(netname),itr->first,itr->second);
             }
-        } catch(std::invalid_argument){}
+            _nets.erase(range_start,range_end);
+        }
     }
-
-    if(traverse) update_nets();
-    return _ports.size()-1;  // last element
 }
 
 /*
@@ -391,6 +1285,7 @@ int Schematic::add_port_node(Port port, bool traverse)
  */
 int Schematic::select_port_node(Coordinate2 p) const
 {
+    NM_PUBLIC_CALL(_point(SessionTrace::SELECT_PORT,p));
     for(int i=0; i<_ports.size(); i++)
     {
         if(_ports[i].first == p)
@@ -406,6 +1301,7 @@ int Schematic::select_port_node(Coordinate2 p) const
  */
 Vec<int> Schematic::select_port_nodes(std::string port_name) const
 {
+    NM_PUBLIC_CALL(_name(SessionTrace::SELECT_PORTS,port_name));
     Vec<int> selected;
     for(int i=0; i<_ports.size(); i++)
     {
@@ -416,19 +1312,25 @@ Vec<int> Schematic::select_port_nodes(std::string port_name) const
 
 void Schematic::remove_port_node(int pid, bool traverse)
 {
-    try{
-        string netname = _ports[pid].second;
-        // erase port from `_ports`
-        _ports.erase(_ports.begin()+pid);
-        // remove entries in `_nets`
-        // Note: this is aggressive, but update_nets() will rename any that
-        // still have this name
-        auto[range_start,range_end] = _nets.equal_range(netname);
-        _nets.erase(range_start,range_end);
-        if(traverse) {update_nets();}
-    }catch(std::out_of_range){
-        throw std::invalid_argument("Port node not found in Schematic.");
-    }
+    NM_PUBLIC_CALL(_remove_port(pid,traverse));
+    if(pid < 0 || pid >= static_cast<int>(_ports.size())) throw std::invalid_argument("Port node not found in Schematic.");
+    EditScope scope(*this);
+    if(_lazy && _nets_dirty) update_nets();
+    string netname = _ports[pid].second;
+    if(_recording()) _open_step.ports.push_back({false,pid,_ports[pid]});
+    // erase port from `_ports`
+    _ports.erase(_ports.begin()+pid);
+    _ports_version++;
+    // remove entries in `_nets`
+    // Note: this is aggressive, but update_nets() will rename any that
+    // still have this name
+    auto[range_start,range_end] = _nets.equal_range(netname);
+    for(auto itr = range_start; itr != range_end; ++itr) _record_net(false,false,itr->first,itr->second);
+    _nets.erase(range_start,range_end);
+    _stale_netnames.push_back(netname);
+    _nets_dirty = true;
+    if(traverse || _lazy) {update_nets();}
+    if(scope.outer && _edit_log) _edit_log->_log_remove_port(pid,traverse);
 }
 
 /*
@@ -436,23 +1338,76 @@ void Schematic::remove_port_node(int pid, bool traverse)
  */
 void Schematic::remove_port_nodes(std::string port_name, bool traverse)
 {
+    NM_PUBLIC_CALL(_remove_ports(port_name,traverse));
+    EditScope scope(*this);
+    if(_lazy && _nets_dirty) update_nets();
     // Remove any ports with this name from _ports
     Vec<Port> new_ports;
     for(auto& p : _ports)
     {
         if(p.second != port_name) {new_ports.push_back(p);}
+        else if(_recording()) _open_step.ports.push_back({false,static_cast<int>(new_ports.size()),p});
     }
+    if(new_ports.size() != _ports.size()) _ports_version++;
     _ports = new_ports;
 
     // Remove entries in _nets
     auto[range_start,range_end] = _nets.equal_range(port_name);
+    for(auto itr = range_start; itr != range_end; ++itr) _record_net(false,false,itr->first,itr->second);
     _nets.erase(range_start,range_end);
-    if(traverse) {update_nets();}
+    _stale_netnames.push_back(port_name);
+    _nets_dirty = true;
+    if(traverse || _lazy) {update_nets();}
+    if(scope.outer && _edit_log) _edit_log->_log_remove_ports(port_name,traverse);
+}
+
+SchematicStats Schematic::stats() const
+{
+    SchematicStats s = _stats;
+    s.graph = _graph.stats();
+    return s;
+}
+
+void Schematic::reset_stats()
+{
+    _stats = SchematicStats();
+    _graph.reset_stats();
+}
+
+/*
+ * Heap bytes used by the schematic, by structure. Vectors are counted exactly from
+ * their capacity, node-based containers are estimated (see memoryusage.h). Objects
+ * shared with callers (the published connectivity and the last snapshot) are
+ * counted in `published` even if a reader also holds them.
+ */
+SchematicMemory Schematic::memory_usage() const
+{
+    SchematicMemory m;
+    m.graph = _graph.memory_usage();
+    m.nets = Estd::heap_bytes(_nets);
+    m.etrees = Estd::heap_bytes(_etrees)+Estd::heap_bytes(_vertex_tree);
+    m.ports = Estd::heap_bytes(_ports);
+    m.id_pool = Estd::heap_bytes(_idpool);
+    m.handles = _wire_handles.heap_bytes()+_net_handles.heap_bytes();
+    m.listeners = Estd::heap_bytes(_net_listeners)+Estd::heap_bytes(_nets_reported)+Estd::heap_bytes(_net_versions);
+    m.undo = Estd::heap_bytes(_undo)+Estd::heap_bytes(_redo)+Estd::heap_bytes(_open_step);
+    if(auto c = std::atomic_load(&_connectivity))
+    {
+        m.published += Estd::SHARED_OVERHEAD+sizeof(Connectivity);
+        m.published += Estd::heap_bytes(c->_nets)+Estd::heap_bytes(c->_vertices);
+    }
+    if(_snapshot)
+    {
+        m.published += Estd::SHARED_OVERHEAD+sizeof(SchematicSnapshot);
+        m.published += Estd::heap_bytes(_snapshot->_name)+Estd::heap_bytes(_snapshot->_nets)+Estd::heap_bytes(_snapshot->_ports);
+    }
+    m.picking = _pick.segments.heap_bytes()+Estd::heap_bytes(_pick.wires);
+    return m;
 }
 
 void Schematic::print()
 {
-    update_nets();
+    if(_nets_dirty) update_nets();
 
     // print nets
     for(auto& pair : _nets)
@@ -470,28 +1425,433 @@ void Schematic::print()
     }
 }
 
+/*
+ * Renumber vertex ids and integer net names densely.
+ * After many add/remove cycles the vertex ids and net numbers become sparse. This
+ * resolves any pending edits, then renumbers vertices to 0..N-1 and integer nets to 0..K-1,
+ * both in ascending order of their current value, and remaps the stored nets and
+ * trees in the same pass. Ports are stored by position and are unaffected.
+ *
+ * Returns the map of old vertex id -> new vertex id, so that any Wire held outside
+ * the schematic can be fixed up. If `net_renames` is given, it is filled with
+ * old net name -> new net name for every net that was renamed.
+ */
+std::map<int,int> Schematic::compact(std::map<std::string,std::string>* net_renames)
+{
+    NM_PUBLIC_CALL(_call(SessionTrace::COMPACT));
+    if(_nets_dirty) update_nets();
+    std::map<int,int> id_map = _graph.compact();
+
+    // Remap wires. The mapping is monotonic, so sorted trees remain sorted.
+    Vec<int> table(id_map.empty() ? 0 : id_map.rbegin()->first+1,-1);
+    for(auto& pair : id_map) table[pair.first] = pair.second;
+    auto remap = [&table](Vec<Wire>& wires) {
+        for(auto& w : wires) w = {table[w.first],table[w.second]};
+    };
+    for(auto& tree : _etrees) remap(tree);
+    for(auto& net : _nets) remap(net.second);
+    std::vector<int> vertex_tree(id_map.size(),-1);
+    for(auto& pair : id_map)
+    {
+        if(pair.first < static_cast<int>(_vertex_tree.size())) vertex_tree[pair.second] = _vertex_tree[pair.first];
+    }
+    _vertex_tree = std::move(vertex_tree);
+
+    // Renumber integer nets in numeric order
+    Vec<int> netnums;
+    for(auto& net : _nets)
+    {
+        if(netname_is_int(net.first)) netnums.push_back(std::stoi(net.first));
+    }
+    Estd::sort(netnums);
+    map<string,string> renames;
+    for(int i=0; i<netnums.size(); i++)
+    {
+        if(netnums[i] != i) renames[std::to_string(netnums[i])] = std::to_string(i);
+    }
+    if(!renames.empty())
+    {
+        multimap<string,Vec<Wire>> nets_new;
+        for(auto& net : _nets)
+        {
+            auto itr = renames.find(net.first);
+            if(itr == renames.end()) nets_new.insert(std::move(net));
+            else nets_new.insert({itr->second,std::move(net.second)});
+        }
+        _nets = std::move(nets_new);
+    }
+    _idpool.reset(netnums.size());
+
+    // Handles stay valid across compaction
+    _wire_handles.remap([&table](const Wire& w) -> Wire {return {table[w.first],table[w.second]};});
+    _net_handles.remap([&renames](const string& name) {
+        auto itr = renames.find(name);
+        return itr == renames.end() ? name : itr->second;
+    });
+
+    if(!renames.empty() && _diffing_nets())
+    {
+        _nets_version++;
+        _nets_reported = _nets;
+        // Renames can chain (5->3 while 3->2), so restamp rather than replay events
+        map<string,uint64_t> net_versions;
+        for(auto& pair : _net_versions)
+        {
+            if(!renames.count(pair.first)) net_versions.insert(pair);
+        }
+        Vec<NetEvent> events;
+        for(auto& pair : renames)
+        {
+            if(_track_net_versions) net_versions[pair.second] = _nets_version;
+            // Wire ids all changed as well, listeners should use the returned id map
+            events.push_back({NetChangeType::NET_RENAMED,pair.second,{pair.first},{},{}});
+        }
+        _net_versions = std::move(net_versions);
+        auto listeners = _net_listeners;
+        for(auto& l : listeners) l.second(events);
+    }
+    else if(!renames.empty()) _nets_version++;
+
+    clear_undo();  // the journal refers to the old ids
+    if(_concurrent_readers) _publish_connectivity();
+    if(_edit_log && !_in_edit) _edit_log->_log_compact();
+
+    if(net_renames) *net_renames = std::move(renames);
+    return id_map;
+}
+
 /*
  * Update the spanning trees of vertices.
- * This method clears _vtrees and _etrees and repopulates them. The _nets data
+ * This method clears _etrees and repopulates them. The _nets data
  * structure is NOT UPDATED by this method. It is called by update_nets().
- * Each edge tree in _etrees is sorted, and then _etrees itself is sorted by first
- * element.
+ * Each edge tree in _etrees is sorted, and then _etrees itself is sorted
+ * lexicographically. The edges of each tree are collected and sorted in parallel.
  */
 void Schematic::_update_trees()
 {
+    Timeline::Scope timeline("_update_trees");
+    Timeline::Phases steps;
+    steps.next("spanning trees");
+    Vec<Vec<int>> trees = _graph.get_spanning_trees(true);
+    steps.next("edge trees");
+    std::vector<Vec<Wire>> etrees(trees.size());
+    _for_each_tree(trees.size(),[&](size_t t) {
+        for(int v : trees[t])
+        {
+            for(int adj : _graph.get_adjacent(v))
+            {
+                if(adj > v) etrees[t].push_back({v,adj});
+            }
+        }
+        std::sort(etrees[t].begin(),etrees[t].end());  // sort lexicographically
+    });
+
+    steps.next("sort trees");
+    std::vector<size_t> order = Estd::argsort(etrees);
+    _etrees.clear();
+    _etrees.reserve(etrees.size());
+    for(auto t : order) _etrees.push_back(std::move(etrees[t]));
+
+    // vertex id -> index in _etrees
+    steps.next("vertex index");
+    int max_id = -1;
+    for(auto& tree : trees) for(int v : tree) max_id = std::max(max_id,v);
+    _vertex_tree.assign(max_id+1,-1);
+    _for_each_tree(order.size(),[&](size_t t) {
+        for(int v : trees[order[t]]) _vertex_tree[v] = t;
+    });
+}
+
+/*
+ * Finish loading: the graph, _nets, _ports and _idpool have been replaced with
+ * saved ones whose nets are resolved, so the trees are rebuilt from the nets
+ * instead of traversing the graph.
+ */
+void Schematic::_load_resolved()
+{
+    std::vector<Vec<Wire>> etrees;
+    int max_id = -1;
+    for(auto& net : _nets)
+    {
+        etrees.push_back(net.second);
+        for(auto& w : net.second) max_id = std::max({max_id,w.first,w.second});
+    }
+    std::vector<size_t> order = Estd::argsort(etrees);
     _etrees.clear();
-    for(auto& tree : _graph.get_spanning_trees(true))
+    _etrees.reserve(etrees.size());
+    for(auto t : order) _etrees.push_back(std::move(etrees[t]));
+    _vertex_tree.assign(max_id+1,-1);
+    for(int t=0; t<_etrees.size(); t++)
+    {
+        for(auto& w : _etrees[t]) _vertex_tree[w.first] = _vertex_tree[w.second] = t;
+    }
+
+    _merge_pending = false;
+    _nets_dirty = false;
+    _nets_version++;
+    // The loaded nets are not the ones the handles were taken from, whatever their names
+    _wire_handles.sync({});
+    _net_handles.sync({});
+    _sync_handles();
+    if(_concurrent_readers) _publish_connectivity();
+    if(_diffing_nets()) _notify_net_listeners();
+    if(_verify) _verify_nets();
+}
+
+/*
+ * Check the resolved nets against a full recompute, and throw std::logic_error if
+ * they differ. The reference is a serial traversal of the whole graph and edge trees
+ * built from scratch, the path update_nets() takes on its own when nothing is
+ * parallel, incremental or deferred. Checked:
+ *   - the edge trees are the ones of the reference traversal
+ *   - every vertex maps to its tree
+ *   - the nets hold exactly the edge trees, each once
+ *   - integer net names are unique and not in the net id pool
+ *   - the published Connectivity (with concurrent readers) matches the nets
+ * With set_verification(true) this runs after every update_nets(), and snapshot()
+ * checks each snapshot it builds. Pending edits are resolved first.
+ */
+void Schematic::verify_nets()
+{
+    if(_nets_dirty) update_nets();
+    _verify_nets();
+}
+
+void Schematic::_verify_nets()
+{
+    auto fail = [](const string& what) {throw std::logic_error("Net verification failed: " + what);};
+
+    size_t min_nodes = _graph.parallel_traversal_min_nodes();
+    _graph.set_parallel_traversal(std::numeric_limits<size_t>::max(),_pool);
+    Vec<Vec<int>> trees = _graph.get_spanning_trees(true);
+    _graph.set_parallel_traversal(min_nodes,_pool);
+    std::vector<Vec<Wire>> expected(trees.size());
+    for(size_t t=0; t<trees.size(); t++)
+    {
+        for(int v : trees[t])
+        {
+            for(int adj : _graph.get_adjacent(v))
+            {
+                if(adj > v) expected[t].push_back({v,adj});
+            }
+        }
+        std::sort(expected[t].begin(),expected[t].end());
+    }
+    std::sort(expected.begin(),expected.end());
+    if(expected.size() != _etrees.size() || !std::equal(expected.begin(),expected.end(),_etrees.begin()))
+        fail("edge trees differ from a full traversal.");
+    for(int t=0; t<_etrees.size(); t++)
+    {
+        for(auto& w : _etrees[t])
+        {
+            if(_tree_of_wire(w) != t) fail("vertex " + std::to_string(w.first) + " is not mapped to its tree.");
+        }
+    }
+
+    std::vector<Vec<Wire>> net_wires;
+    for(auto& net : _nets) net_wires.push_back(net.second);
+    std::sort(net_wires.begin(),net_wires.end());
+    if(net_wires != expected) fail("nets are not the edge trees.");
+
+    Vec<int> free_ids = _idpool.free_ids();
+    std::set<int> pooled(free_ids.begin(),free_ids.end());
+    std::set<int> numbers;
+    for(auto& net : _nets)
+    {
+        if(!netname_is_int(net.first)) continue;
+        int n = std::stoi(net.first);
+        if(!numbers.insert(n).second) fail("net " + net.first + " appears twice.");
+        if(n >= _idpool.size() || pooled.count(n)) fail("net " + net.first + " is not taken from the id pool.");
+    }
+
+    if(_concurrent_readers)
+    {
+        auto c = std::atomic_load(&_connectivity);
+        if(!c || c->_nets_version != _nets_version || c->_nets.size() != _nets.size()) fail("published connectivity is stale.");
+        auto itr = c->_nets.begin();
+        for(auto& net : _nets)
+        {
+            if(itr->first != net.first || itr->second->wires != net.second) fail("published connectivity is stale.");
+            ++itr;
+            for(auto& w : net.second)
+            {
+                if(c->try_get_netname(w) != net.first) fail("published connectivity has the wrong net for a wire.");
+                if(!(c->pos(w.first) == _graph.pos(w.first)) || !(c->pos(w.second) == _graph.pos(w.second)))
+                    fail("published connectivity has a stale position.");
+            }
+        }
+    }
+}
+
+// Check a snapshot built from shared parts against the schematic
+void Schematic::_verify_snapshot(const SchematicSnapshot& snap)
+{
+    auto fail = [](const string& what) {throw std::logic_error("Snapshot verification failed: " + what);};
+    if(snap._nets.size() != _nets.size()) fail("wrong number of nets.");
+    auto itr = _nets.begin();
+    for(auto& net : snap._nets)
+    {
+        if(net.first != itr->first || net.second->wires != itr->second) fail("net " + net.first + " differs.");
+        if(net.second->segments.size() != itr->second.size()) fail("net " + net.first + " has the wrong segments.");
+        for(size_t i=0; i<itr->second.size(); i++)
+        {
+            const Wire& w = itr->second[i];
+            if(net.second->segments[i] != SchematicSnapshot::Segment(_graph.pos(w.first),_graph.pos(w.second)))
+                fail("net " + net.first + " has a stale segment.");
+        }
+        ++itr;
+    }
+    if(*snap._ports != _ports) fail("ports differ.");
+}
+
+// Index of the tree in _etrees holding wire `w`, or -1 if `w` is not a wire
+int Schematic::_tree_of_wire(const Wire& w) const
+{
+    if(w.first < 0 || w.first >= static_cast<int>(_vertex_tree.size())) return -1;
+    int t = _vertex_tree[w.first];
+    if(t < 0 || !std::binary_search(_etrees[t].begin(),_etrees[t].end(),w)) return -1;
+    return t;
+}
+
+/*
+ * Call f(i) for i in [0,n), on the thread pool if there are at least
+ * `_parallel_min_trees` items. f must only write to its own item.
+ */
+void Schematic::_for_each_tree(size_t n, const std::function<void(size_t)>& f)
+{
+    if(n < _parallel_min_trees)
     {
-        auto sub_adj = _graph.get_sub_adjacency_lists(tree);
-        SimpleStaticGraph subgraph(tree,sub_adj);
-        _etrees.push_back(subgraph.get_all_edges());
-        std::sort(_etrees.back().begin(),_etrees.back().end());  // sort lexicographically
+        for(size_t i=0; i<n; i++) f(i);
+        return;
     }
-    std::sort(_etrees.begin(),_etrees.end());
+    Estd::ThreadPool& pool = _pool ? *_pool : Estd::ThreadPool::shared();
+    pool.for_each_chunk(n,16,[&f](size_t b, size_t e) {
+        for(size_t i=b; i<e; i++) f(i);
+    });
+}
+
+/*
+ * Resolve nets on a thread pool (default: the shared one) once there are at least
+ * `min_trees` trees. The graph traversal uses the same pool. Net naming is the same
+ * as with serial resolution.
+ */
+void Schematic::set_parallel_resolution(size_t min_trees, Estd::ThreadPool* pool)
+{
+    _parallel_min_trees = min_trees;
+    _pool = pool;
+    _graph.set_parallel_traversal(_graph.parallel_traversal_min_nodes(),pool);
+}
+
+
+Vec<string> Connectivity::get_all_netnames() const
+{
+    Vec<string> names;
+    for(auto& pair : _nets) names.push_back(pair.first);
+    return names;
+}
+
+string Connectivity::get_netname(Wire w) const
+{
+    std::optional<string> name = try_get_netname(w);
+    if(!name) throw std::invalid_argument("Wire is not associated with a net.");
+    return std::move(*name);
+}
+
+std::optional<string> Connectivity::try_get_netname(Wire w) const
+{
+    const Net* net = _net_of(w);
+    if(!net) return std::nullopt;
+    return net->name;
+}
+
+Vec<Wire> Connectivity::select_net(const string& netname) const
+{
+    std::optional<Vec<Wire>> selected = try_select_net(netname);
+    if(!selected) throw std::invalid_argument("Net name was not found in schematic.");
+    return std::move(*selected);
+}
+
+std::optional<Vec<Wire>> Connectivity::try_select_net(const string& netname) const
+{
+    auto[range_start,range_end] = _nets.equal_range(netname);
+    if(range_start == range_end) return std::nullopt;
+    Vec<Wire> selected;
+    for(auto itr = range_start; itr != range_end; ++itr)
+    {
+        selected.insert(selected.end(),itr->second->wires.begin(),itr->second->wires.end());
+    }
+    return selected;
 }
 
+// True if both wires exist and belong to the same net
+bool Connectivity::same_net(Wire a, Wire b) const
+{
+    const Net* net_a = _net_of(a);
+    const Net* net_b = _net_of(b);
+    return net_a && net_b && net_a->name == net_b->name;
+}
+
+Coordinate2 Connectivity::pos(int id) const
+{
+    const Vertex* v = _vertex(id);
+    if(!v || !v->net) throw std::invalid_argument("Vertex is not part of any wire.");
+    return v->pos;
+}
 
+// Entry of vertex `id` in the index, or nullptr past its end
+const Connectivity::Vertex* Connectivity::_vertex(int id) const
+{
+    if(id < 0 || static_cast<size_t>(id)/BLOCK >= _vertices.size()) return nullptr;
+    const auto& block = _vertices[id/BLOCK];
+    return block ? &(*block)[id%BLOCK] : nullptr;
+}
 
+// Net holding `w` (either way round), or nullptr
+const Connectivity::Net* Connectivity::_net_of(Wire w) const
+{
+    const Vertex* v = _vertex(w.first);
+    if(!v || !v->net) return nullptr;
+    if(w.first > w.second) std::swap(w.first,w.second);
+    const Vec<Wire>& wires = v->net->wires;
+    return std::binary_search(wires.begin(),wires.end(),w) ? v->net : nullptr;
+}
 
 
+Vec<string> SchematicSnapshot::get_all_netnames() const
+{
+    Vec<string> names;
+    for(auto& pair : _nets) names.push_back(pair.first);
+    return names;
+}
 
+Vec<Wire> SchematicSnapshot::get_all_wires() const
+{
+    Vec<Wire> wires;
+    for(auto& pair : _nets) wires.insert(wires.end(),pair.second->wires.begin(),pair.second->wires.end());
+    Estd::sort(wires);
+    return wires;
+}
+
+Vec<Wire> SchematicSnapshot::select_net(const string& netname) const
+{
+    Vec<Wire> selected;
+    auto[range_start,range_end] = _nets.equal_range(netname);
+    if(range_start == range_end) throw std::invalid_argument("Net name was not found in schematic.");
+    for(auto itr = range_start; itr != range_end; ++itr)
+    {
+        selected.insert(selected.end(),itr->second->wires.begin(),itr->second->wires.end());
+    }
+    return selected;
+}
+
+Vec<SchematicSnapshot::Segment> SchematicSnapshot::select_net_segments(const string& netname) const
+{
+    Vec<Segment> selected;
+    auto[range_start,range_end] = _nets.equal_range(netname);
+    if(range_start == range_end) throw std::invalid_argument("Net name was not found in schematic.");
+    for(auto itr = range_start; itr != range_end; ++itr)
+    {
+        selected.insert(selected.end(),itr->second->segments.begin(),itr->second->segments.end());
+    }
+    return selected;
+}
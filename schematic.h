@@ -3,8 +3,16 @@
 
 #include <string>
 #include <map>
+#include <array>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <optional>
 #include "coordinate2.h"
 #include "simplegraph.h"
+#include "instrument.h"
+#include "memoryusage.h"
+#include "segmentbatch.h"
 #include "utils.h"
 
 
@@ -16,15 +24,301 @@ enum class WireType
     WIRE_PARTIAL_DEGEN_B   // Wire is partially degenerate because B is on the wire
 };
 
+enum class NetChangeType
+{
+    NET_CREATED,
+    NET_DELETED,
+    NET_MODIFIED,   // Net kept its name, wires were added or removed
+    NET_MERGED,     // Net absorbed the nets in `sources`, which no longer exist
+    NET_SPLIT,      // Net was split off from the nets in `sources`, which still exist
+    NET_RENAMED     // Net took over all of `sources[0]`, e.g. because of a port
+};
+
+// True if `name` is a plain number, i.e. a net name handed out by Schematic
+bool netname_is_int(const std::string& name);
+
+
+/* Table of generational handles to keys (wires or net names).
+ *
+ * A Handle is a slot index and a generation counter. Resolving a handle is a bounds
+ * check and a generation compare. When a key is released, its slot's generation is
+ * bumped, so every outstanding handle to it is rejected, and the slot is reused for
+ * a later key.
+ */
+template<typename KeyT>
+class HandleTable
+{
+public:
+    struct Handle
+    {
+        int index;
+        unsigned generation;
+        bool operator==(const Handle& rhs) const {return index==rhs.index && generation==rhs.generation;}
+        bool operator!=(const Handle& rhs) const {return !(*this == rhs);}
+    };
+    static constexpr Handle INVALID_HANDLE{-1,0};
+
+    // Return the handle for `key`, or INVALID_HANDLE if it is not in the table
+    Handle find(const KeyT& key) const
+    {
+        auto itr = _slot_ids.find(key);
+        if(itr == _slot_ids.end()) return INVALID_HANDLE;
+        return {itr->second,_slots[itr->second].generation};
+    }
+    // Return a pointer to the key of `h`, or nullptr if `h` is stale
+    const KeyT* resolve(Handle h) const
+    {
+        if(h.index < 0 || h.index >= static_cast<int>(_slots.size())) return nullptr;
+        const Slot& slot = _slots[h.index];
+        if(!slot.live || slot.generation != h.generation) return nullptr;
+        return &slot.key;
+    }
+    void release(const KeyT& key)
+    {
+        auto itr = _slot_ids.find(key);
+        if(itr == _slot_ids.end()) return;
+        _release_slot(itr->second);
+        _slot_ids.erase(itr);
+    }
+    // Make the table hold exactly `keys` (sorted, unique). Keys already present keep
+    // their handles, missing keys are released and new keys get a slot.
+    void sync(const Estd::Vec<KeyT>& keys)
+    {
+        auto itr = _slot_ids.begin();
+        auto key_itr = keys.begin();
+        while(itr != _slot_ids.end() || key_itr != keys.end())
+        {
+            if(key_itr == keys.end() || (itr != _slot_ids.end() && itr->first < *key_itr))
+            {
+                _release_slot(itr->second);
+                itr = _slot_ids.erase(itr);
+            }
+            else if(itr == _slot_ids.end() || *key_itr < itr->first)
+            {
+                _slot_ids.emplace_hint(itr,*key_itr,_acquire_slot(*key_itr));
+                ++key_itr;
+            }
+            else
+            {
+                ++itr;
+                ++key_itr;
+            }
+        }
+    }
+    // Replace every key k with f(k), keeping handles valid. f must keep keys unique.
+    template<typename F>
+    void remap(F f)
+    {
+        std::map<KeyT,int> slot_ids;
+        for(auto& pair : _slot_ids)
+        {
+            _slots[pair.second].key = f(pair.first);
+            slot_ids.emplace_hint(slot_ids.end(),_slots[pair.second].key,pair.second);
+        }
+        _slot_ids = std::move(slot_ids);
+    }
+
+private:
+    struct Slot
+    {
+        KeyT key;
+        unsigned generation;
+        bool live;
+        size_t heap_bytes() const {return Estd::heap_bytes(key);}
+    };
+    int _acquire_slot(const KeyT& key)
+    {
+        if(_free_slots.empty())
+        {
+            _slots.push_back({key,0,true});
+            return _slots.size()-1;
+        }
+        int index = _free_slots.back();
+        _free_slots.pop_back();
+        _slots[index].key = key;
+        _slots[index].live = true;
+        return index;
+    }
+    void _release_slot(int index)
+    {
+        _slots[index].live = false;
+        _slots[index].generation++;
+        _free_slots.push_back(index);
+    }
+
+    Estd::Vec<Slot> _slots;
+    Estd::Vec<int> _free_slots;
+    std::map<KeyT,int> _slot_ids;      // key -> slot index
+
+public:
+    size_t heap_bytes() const {return Estd::heap_bytes(_slots)+Estd::heap_bytes(_free_slots)+Estd::heap_bytes(_slot_ids);}
+};
+
+
+/* Immutable snapshot of the nets of a Schematic, see Schematic::connectivity().
+ *
+ * A Connectivity never changes once it is published, so any number of threads can
+ * query it while another thread edits the schematic. Wires use the vertex ids the
+ * schematic had when the snapshot was taken, and the version counters say which
+ * state of the schematic that was.
+ *
+ * Consecutive snapshots share what did not change: each net's wires are one shared
+ * object, and the vertex index (vertex id -> net and position) is split into blocks
+ * of BLOCK ids that are only copied when one of their vertices changes net.
+ */
+class Connectivity
+{
+public:
+    using Wire = std::pair<int,int>;  // id1,id2
+
+    uint64_t structure_version() const {return _structure_version;}
+    uint64_t geometry_version() const {return _geometry_version;}
+    uint64_t nets_version() const {return _nets_version;}
+
+    Estd::Vec<std::string> get_all_netnames() const;
+    std::string get_netname(Wire w) const;
+    Estd::Vec<Wire> select_net(const std::string& netname) const;
+    // As above, std::nullopt instead of std::invalid_argument on a miss
+    std::optional<std::string> try_get_netname(Wire w) const;
+    std::optional<Estd::Vec<Wire>> try_select_net(const std::string& netname) const;
+    bool same_net(Wire a, Wire b) const;
+    Coordinate2 pos(int id) const;
+
+private:
+    friend class Schematic;
+    struct Net
+    {
+        std::string name;
+        Estd::Vec<Wire> wires;          // sorted
+        size_t heap_bytes() const {return Estd::heap_bytes(name)+Estd::heap_bytes(wires);}
+    };
+    struct Vertex
+    {
+        const Net* net = nullptr;       // nullptr if the id is not part of a wire
+        Coordinate2 pos;
+    };
+    static constexpr size_t BLOCK = 256;
+    using Block = std::array<Vertex,BLOCK>;
+
+    uint64_t _structure_version = 0;
+    uint64_t _geometry_version = 0;
+    uint64_t _nets_version = 0;
+    std::multimap<std::string,std::shared_ptr<const Net>> _nets;   // netname -> wires
+    Estd::Vec<std::shared_ptr<const Block>> _vertices;             // vertex id / BLOCK
+
+    const Vertex* _vertex(int id) const;
+    const Net* _net_of(Wire w) const;
+};
+
+
+/* Immutable view of a whole Schematic (wires, nets and ports), see Schematic::snapshot().
+ *
+ * A snapshot is shared, not copied: nets whose wires and positions did not change
+ * and an unchanged port list are the same objects in consecutive snapshots, so a
+ * background thread can hold on to one while the schematic is edited.
+ */
+class SchematicSnapshot
+{
+public:
+    using Wire = std::pair<int,int>;  // id1,id2
+    using Port = std::pair<Coordinate2, std::string>;  // position, name
+    using Segment = std::pair<Coordinate2,Coordinate2>;
+    struct Net
+    {
+        Estd::Vec<Wire> wires;          // sorted
+        Estd::Vec<Segment> segments;    // endpoint positions of each wire
+        size_t heap_bytes() const {return Estd::heap_bytes(wires)+Estd::heap_bytes(segments);}
+    };
+
+    const std::string& name() const {return _name;}
+    uint64_t structure_version() const {return _structure_version;}
+    uint64_t geometry_version() const {return _geometry_version;}
+    uint64_t nets_version() const {return _nets_version;}
+
+    Estd::Vec<std::string> get_all_netnames() const;
+    Estd::Vec<Wire> get_all_wires() const;
+    Estd::Vec<Wire> select_net(const std::string& netname) const;
+    Estd::Vec<Segment> select_net_segments(const std::string& netname) const;
+    const std::multimap<std::string,std::shared_ptr<const Net>>& nets() const {return _nets;}
+    const Estd::Vec<Port>& ports() const {return *_ports;}
+
+private:
+    friend class Schematic;
+    std::string _name;
+    uint64_t _structure_version = 0;
+    uint64_t _geometry_version = 0;
+    uint64_t _nets_version = 0;
+    uint64_t _graph_version = 0;    // versions of the parts, to decide what to share
+    uint64_t _ports_version = 0;
+    std::multimap<std::string,std::shared_ptr<const Net>> _nets;
+    std::shared_ptr<const Estd::Vec<Port>> _ports;
+};
+
+
+class EditLog;
+class SessionTrace;
+
+
+// Heap bytes of a Schematic by structure, see Schematic::memory_usage()
+struct SchematicMemory
+{
+    GraphMemory graph;
+    size_t nets = 0;            // netname -> wires
+    size_t etrees = 0;          // edge trees and vertex id -> tree
+    size_t ports = 0;           // ports
+    size_t id_pool = 0;         // returned net numbers
+    size_t handles = 0;         // wire and net handle tables
+    size_t listeners = 0;       // net listeners, last reported nets and net versions
+    size_t undo = 0;            // undo and redo steps
+    size_t published = 0;       // connectivity() and the last snapshot(), shared with readers
+    size_t picking = 0;         // wire segments for select_wire()
+    size_t total() const {return graph.total()+nets+etrees+ports+id_pool+handles+listeners+undo+published+picking;}
+};
+
 
 /* Schematic class for managing wires and ports on a schematic.
  *
  * Usage: A Schematic has a name, a collection of Wire objects, and a collection of
  * Port objects. Add wires with `add_wire()`. If traverse==true (default), this automatically
- * runs `update_nets()`. Wires are identified by the internal vertex id's of their
+ * runs `update_nets()`, or with `set_lazy(true)` the nets are resolved on the next
+ * query instead. Wires are identified by the internal vertex id's of their
  * endpoints. Because adding or removing a wire can change the graph interconnections,
  * a Wire should be considered _invalid_ after any changes to the schematic.
  *
+ * For a reference that survives unrelated edits, use `get_wire_handle()` or
+ * `get_net_handle()`. Handles are checked each time the nets are resolved: a wire
+ * handle is rejected once its wire is removed, split or merged, and a net handle
+ * once its net name disappears from the schematic. Resolving a handle is O(1).
+ *
+ * Version counters let callers cache query results: geometry_version() changes when
+ * wires or ports are added, removed or merged, structure_version() also changes when
+ * vertex ids are renumbered, and nets_version() changes when any net changes. With
+ * `track_net_versions(true)`, net_version() gives the nets_version() at which a
+ * single net last changed. In lazy mode, resolving on a query can bump them too.
+ *
+ * Schematic itself is not thread-safe: even queries can resolve nets or traverse the
+ * graph. With `set_concurrent_readers(true)`, each update_nets() publishes an
+ * immutable Connectivity snapshot, which other threads get with connectivity()
+ * without blocking the thread doing the edits. In lazy mode a snapshot is only
+ * published when the nets are resolved, so call update_nets() to publish edits.
+ *
+ * snapshot() gives an immutable view of the wires, nets and ports, to hand to
+ * exporters or renderers on other threads. It shares everything that did not change
+ * with the previous snapshot.
+ *
+ * With `set_undo_limit(n)`, each call to add_wire(), add_wires(), remove_wire() or
+ * one of the port mutators is recorded as one undo step: the primitive graph
+ * changes, port changes and net table changes it made (see
+ * AbstractGraph::set_journal()). undo() and redo() replay a step backwards or
+ * forwards, restoring the net names, and then resolve the nets. Handles to wires
+ * touched by the step are invalidated, and compact() clears the history.
+ *
+ * For crash-safe autosave, an EditLog appends every edit to a log on disk. A
+ * SessionTrace records every call, edits and queries, for replaying and timing later.
+ * In builds with NM_INSTRUMENT, stats() counts and times the hot paths (see
+ * instrument.h). For debugging, `set_verification(true)` checks every net update
+ * against a full recompute, see verify_nets() and SchematicFuzzer.
+ *
  * Ports are used to override the netname of a net. They do not interact with wires
  * directly, but they have positions and will rename the net names for any wire they
  * overlap. This is handled in `update_nets()`. Ports must have non-integer names.
@@ -35,22 +329,86 @@ class Schematic
 public:
     using Wire = std::pair<int,int>;  // id1,id2
     using Port = std::pair<Coordinate2, std::string>;  // position, name
+    using WireHandle = HandleTable<Wire>::Handle;
+    using NetHandle = HandleTable<std::string>::Handle;
     static const Wire INVALID_WIRE;
+
+    /* One change to one net, as decided by update_nets().
+     * `added` and `removed` are the wire deltas against the net's previous wires
+     * (plus those of any nets it absorbed). Removed wires may refer to vertex ids
+     * that no longer exist.
+     */
+    struct NetEvent
+    {
+        NetChangeType type;
+        std::string name;
+        Estd::Vec<std::string> sources;
+        Estd::Vec<Wire> added;
+        Estd::Vec<Wire> removed;
+    };
+    using NetListener = std::function<void(const Estd::Vec<NetEvent>&)>;
+
     std::string name;
     Schematic() : name{"default"} {}
     Schematic(std::string name) : name{name} {}
 
     // wire and net methods
-    Estd::Vec<Wire> get_all_wires() { return _graph.get_all_edges(); }
+    Estd::Vec<Wire> get_all_wires();
     Estd::Vec<std::string> get_all_netnames();
     Wire add_wire(Coordinate2 a, Coordinate2 b, bool traverse=true);
+    Estd::Vec<Wire> add_wires(const Estd::Vec<std::pair<Coordinate2,Coordinate2>>& segments, bool traverse=true);
     std::string get_netname(Wire w);
     Estd::Vec<Wire> select_net(std::string netname);
     Estd::Vec<Wire> select_net(Coordinate2 p);
     Wire select_wire(Coordinate2 p);
+    // get_netname() and select_net() returning std::nullopt on a miss, for hot lookups
+    std::optional<std::string> try_get_netname(Wire w);
+    std::optional<Estd::Vec<Wire>> try_select_net(const std::string& netname);
     Estd::Vec<Wire> select_wires(Coordinate2 p);
     bool remove_wire(Wire w, bool traverse=true);
     void update_nets();
+    void set_lazy(bool lazy);
+    void set_parallel_resolution(size_t min_trees, Estd::ThreadPool* pool=nullptr);
+    bool lazy() const {return _lazy;}
+    bool nets_dirty() const {return _nets_dirty;}
+
+    // net change events, see _notify_net_listeners()
+    int subscribe_nets(NetListener listener);
+    void unsubscribe_nets(int subscription);
+
+    // version counters
+    uint64_t structure_version() const {return _graph.structure_version() + _ports_version;}
+    uint64_t geometry_version() const {return _graph.geometry_version() + _ports_version;}
+    uint64_t nets_version() const {return _nets_version;}
+    void track_net_versions(bool track);
+    uint64_t net_version(const std::string& netname) const;
+
+    // concurrent readers, see Connectivity
+    void set_concurrent_readers(bool enable);
+    bool concurrent_readers() const {return _concurrent_readers;}
+    std::shared_ptr<const Connectivity> connectivity() const {return std::atomic_load(&_connectivity);}
+
+    // immutable snapshots, see SchematicSnapshot
+    std::shared_ptr<const SchematicSnapshot> snapshot();
+
+    // differential verification, see verify_nets()
+    void set_verification(bool verify) {_verify = verify;}
+    bool verification() const {return _verify;}
+    void verify_nets();
+
+    // undo/redo journal
+    void set_undo_limit(size_t max_steps);
+    bool undo();
+    bool redo();
+    bool can_undo() const {return !_undo.empty();}
+    bool can_redo() const {return !_redo.empty();}
+    void clear_undo();
+
+    // stable handles
+    WireHandle get_wire_handle(Wire w) const;
+    Wire resolve(WireHandle h) const;
+    NetHandle get_net_handle(std::string netname) const;
+    std::string resolve(NetHandle h) const;
 
     // port methods
     int add_port_node(Port port, bool traverse=true);
@@ -61,16 +419,117 @@ public:
 
     void print();
 
+    // maintenance
+    std::map<int,int> compact(std::map<std::string,std::string>* net_renames=nullptr);
+
+    // instrumentation (all zeros without NM_INSTRUMENT)
+    SchematicStats stats() const;
+    void reset_stats();
+    SchematicMemory memory_usage() const;
+
 private:
+    friend class SchematicFile;
+    friend class EditLog;
+    friend class SessionTrace;
     VertexGraph _graph;
     std::multimap<std::string,Estd::Vec<Wire>> _nets;  // map of netname -> wires
     Estd::Vec<Estd::Vec<Wire>> _etrees;     // edge trees, based on spanning trees but with all connections
     Estd::Vec<Port> _ports;                 // ports (name and position)
+    std::vector<int> _vertex_tree;          // vertex id -> index in _etrees, -1 if none
     void _update_trees();                   // reprocess spanning trees
+    void _load_resolved();                  // finish loading a saved schematic
+    int _tree_of_wire(const Wire& w) const;
+    void _for_each_tree(size_t n, const std::function<void(size_t)>& f);
     WireType _degenerate(Coordinate2 a,Coordinate2 b,Wire& deg);
+    void _merge_if_pending();
     void _remove_degenerate_wires();
+    Wire _select_wire(Coordinate2 p);
+    Wire _select_wire(const SegmentBatch& segments, Coordinate2 p) const;
+    const SegmentBatch& _pick_segments();
+    void _release_port_net(Coordinate2 p);
+    const std::string* _find_netname(Wire w) const;
+    bool _collect_net(const std::string& netname, Estd::Vec<Wire>& selected) const;
+    void _resolve_if_lazy();
+    void _sync_handles();
+    void _notify_net_listeners();
+    void _publish_net_events(const Estd::Vec<NetEvent>& events);
+    void _publish_connectivity();
+    void _verify_nets();
+    void _verify_snapshot(const SchematicSnapshot& snap);
+    bool _snapshot_current() const;
+
+    // Undo journal, see set_undo_limit()
+    struct PortOp
+    {
+        bool add;           // port was added at `index`, otherwise removed from it
+        int index;
+        Port port;
+        size_t heap_bytes() const {return Estd::heap_bytes(port);}
+    };
+    struct NetOp
+    {
+        bool insert;        // entry was inserted into _nets, otherwise erased
+        bool pooled;        // integer name taken from / returned to _idpool
+        std::string name;
+        Estd::Vec<Wire> wires;
+        size_t heap_bytes() const {return Estd::heap_bytes(name)+Estd::heap_bytes(wires);}
+    };
+    struct EditStep
+    {
+        Estd::Vec<VertexGraph::JournalEntry> graph;
+        Estd::Vec<PortOp> ports;
+        Estd::Vec<NetOp> nets;
+        bool empty() const {return graph.empty() && ports.empty() && nets.empty();}
+        size_t heap_bytes() const {return Estd::heap_bytes(graph)+Estd::heap_bytes(ports)+Estd::heap_bytes(nets);}
+    };
+    struct EditScope;       // marks a public mutator as one undo step
+    bool _recording() const {return _undo_limit > 0 && !_replaying;}
+    void _record_net(bool insert, bool pooled, const std::string& name, const Estd::Vec<Wire>& wires);
+    void _commit_step(bool new_step);
+    void _replay(const EditStep& step, bool inverse);
+    bool _diffing_nets() const {return !_net_listeners.empty() || _track_net_versions;}
 
     IdPool _idpool;
+    size_t _parallel_min_trees = 1024;
+    Estd::ThreadPool* _pool = nullptr;
+    bool _lazy = false;
+    bool _nets_dirty = false;               // edits since the last update_nets()
+    bool _merge_pending = false;            // lazy mode: collinear merge deferred
+    Estd::Vec<std::string> _stale_netnames; // nets merged, split or dropped since the last _sync_handles()
+    HandleTable<Wire> _wire_handles;
+    HandleTable<std::string> _net_handles;
+
+    std::map<int,NetListener> _net_listeners;
+    int _next_subscription = 0;
+    std::multimap<std::string,Estd::Vec<Wire>> _nets_reported;  // _nets as last diffed
+
+    uint64_t _ports_version = 0;
+    uint64_t _nets_version = 0;
+    bool _track_net_versions = false;
+    std::map<std::string,uint64_t> _net_versions;   // netname -> nets_version of last change
+
+    bool _concurrent_readers = false;
+    std::shared_ptr<const Connectivity> _connectivity;  // only accessed with atomic_load/atomic_store
+    std::shared_ptr<const SchematicSnapshot> _snapshot;     // last snapshot(), shared with callers
+
+    size_t _undo_limit = 0;                 // 0: no journal
+    std::deque<EditStep> _undo;
+    Estd::Vec<EditStep> _redo;
+    EditStep _open_step;                    // changes since the last committed step
+    bool _step_pending = false;             // the last step left the nets unresolved
+    bool _in_edit = false;                  // inside a public mutator
+    bool _replaying = false;                // inside undo()/redo()
+    EditLog* _edit_log = nullptr;           // see EditLog
+    SessionTrace* _trace = nullptr;         // see SessionTrace
+    bool _verify = false;                   // see set_verification()
+    struct
+    {
+        SegmentBatch segments;
+        Estd::Vec<Wire> wires;
+        uint64_t graph_version = 0;
+        bool valid = false;
+    } _pick;                                // see _pick_segments()
+    mutable SchematicStats _stats;          // see stats(), also counted by const queries
 };
 
 
@@ -0,0 +1,355 @@
+#include "schematicfile.h"
+#include <fstream>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <charconv>
+
+#ifdef _WIN32
+#include <cstdio>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using Estd::Vec;
+using Wire = Schematic::Wire;
+
+constexpr char SchematicFile::MAGIC[8];
+
+namespace
+{
+
+/* Read-only view of a whole file. Memory-mapped where available, otherwise read
+ * into a buffer (8 byte aligned, like a mapping).
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const string& path)
+    {
+#ifdef _WIN32
+        FILE* f = std::fopen(path.c_str(),"rb");
+        if(!f) throw std::runtime_error("Could not open schematic file.");
+        std::fseek(f,0,SEEK_END);
+        long size = std::ftell(f);
+        std::fseek(f,0,SEEK_SET);
+        _buffer.resize((size+7)/8);
+        _size = size;
+        bool ok = size < 0 || std::fread(_buffer.data(),1,_size,f) == _size;
+        std::fclose(f);
+        if(size < 0 || !ok) throw std::runtime_error("Could not read schematic file.");
+        _data = reinterpret_cast<const char*>(_buffer.data());
+#else
+        int fd = ::open(path.c_str(),O_RDONLY);
+        if(fd < 0) throw std::runtime_error("Could not open schematic file.");
+        struct stat st;
+        if(::fstat(fd,&st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not read schematic file.");
+        }
+        _size = st.st_size;
+        if(_size > 0)
+        {
+            void* p = ::mmap(nullptr,_size,PROT_READ,MAP_PRIVATE,fd,0);
+            if(p == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Could not map schematic file.");
+            }
+            _data = static_cast<const char*>(p);
+        }
+        ::close(fd);  // the mapping stays valid
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if(_data) ::munmap(const_cast<char*>(_data),_size);
+#endif
+    }
+    const char* data() const {return _data;}
+    size_t size() const {return _size;}
+
+private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    std::vector<uint64_t> _buffer;
+#endif
+};
+
+// Hands out the sections of a mapped file in order, checking bounds
+class SectionReader
+{
+public:
+    SectionReader(const char* data, size_t size, size_t offset) : _data{data},_size{size},_offset{offset} {}
+    template<typename T>
+    const T* take(uint64_t count)
+    {
+        _offset = (_offset+7) & ~size_t(7);
+        if(_offset > _size || count > (_size-_offset)/sizeof(T)) throw std::runtime_error("Schematic file is truncated.");
+        const T* section = reinterpret_cast<const T*>(_data+_offset);
+        _offset += count*sizeof(T);
+        return section;
+    }
+private:
+    const char* _data;
+    size_t _size;
+    size_t _offset;
+};
+
+// Writes sections, padding each to 8 bytes
+void write_section(std::ofstream& out, const void* data, size_t bytes)
+{
+    static const char zeros[8] = {};
+    if(bytes) out.write(static_cast<const char*>(data),bytes);
+    if(bytes % 8) out.write(zeros,8-bytes%8);
+}
+
+// Offsets must start at 0, never decrease and end at `total`
+void check_offsets(const uint32_t* offsets, uint64_t count, uint64_t total)
+{
+    if(offsets[0] != 0 || offsets[count] != total) throw std::runtime_error("Schematic file is malformed.");
+    for(uint64_t i=0; i<count; i++)
+    {
+        if(offsets[i+1] < offsets[i]) throw std::runtime_error("Schematic file is malformed.");
+    }
+}
+
+}  // namespace
+
+
+/*
+ * Write `sch` to `path`. Pending edits are resolved first, so the file holds
+ * resolved nets.
+ */
+void SchematicFile::save(Schematic& sch, const string& path)
+{
+    if(sch._nets_dirty) sch.update_nets();
+
+    VertexGraph::DenseAdjacency dense = sch._graph.get_dense_adjacency();
+    Vec<Coordinate2> positions = sch._graph.get_positions();
+    std::vector<double> xy(2*positions.size());
+    for(size_t i=0; i<positions.size(); i++)
+    {
+        xy[2*i] = positions[i].x;
+        xy[2*i+1] = positions[i].y;
+    }
+    for(int t : dense.targets)
+    {
+        if(t < 0) throw std::runtime_error("Graph refers to a vertex that does not exist.");
+    }
+
+    // String table: schematic name, net names and port names
+    std::map<string,uint32_t> string_ids;
+    std::vector<const string*> strings;
+    auto intern = [&](const string& s) {
+        auto [itr,added] = string_ids.emplace(s,strings.size());
+        if(added) strings.push_back(&itr->first);
+        return itr->second;
+    };
+    uint32_t name = intern(sch.name);
+    const IdPool& vertex_pool = sch._graph.get_id_pool();
+    Vec<int> vertex_free = vertex_pool.free_ids();
+    Vec<int> net_free = sch._idpool.free_ids();
+
+    std::vector<uint32_t> net_names, net_offsets{0};
+    std::vector<int32_t> net_wires;
+    for(auto& net : sch._nets)
+    {
+        net_names.push_back(intern(net.first));
+        for(auto& w : net.second)
+        {
+            net_wires.push_back(w.first);
+            net_wires.push_back(w.second);
+        }
+        net_offsets.push_back(net_wires.size()/2);
+    }
+    std::vector<double> port_xy;
+    std::vector<uint32_t> port_names;
+    for(auto& port : sch._ports)
+    {
+        port_xy.push_back(port.first.x);
+        port_xy.push_back(port.first.y);
+        port_names.push_back(intern(port.second));
+    }
+    std::vector<uint32_t> string_offsets{0};
+    string string_data;
+    for(auto s : strings)
+    {
+        string_data += *s;
+        string_offsets.push_back(string_data.size());
+    }
+
+    Header header{};
+    std::memcpy(header.magic,MAGIC,sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.vertex_count = dense.ids.size();
+    header.adjacency_count = dense.targets.size();
+    header.vertex_pool_size = vertex_pool.size();
+    header.vertex_free_count = vertex_free.size();
+    header.net_count = net_names.size();
+    header.net_wire_count = net_wires.size()/2;
+    header.net_pool_size = sch._idpool.size();
+    header.net_free_count = net_free.size();
+    header.port_count = port_names.size();
+    header.string_count = strings.size();
+    header.string_bytes = string_data.size();
+    header.name = name;
+
+    std::ofstream out(path,std::ios::binary | std::ios::trunc);
+    if(!out) throw std::runtime_error("Could not open schematic file for writing.");
+    write_section(out,&header,sizeof(header));
+    write_section(out,xy.data(),xy.size()*sizeof(double));
+    write_section(out,dense.ids.data(),dense.ids.size()*sizeof(int32_t));
+    write_section(out,dense.offsets.data(),dense.offsets.size()*sizeof(uint32_t));
+    write_section(out,dense.targets.data(),dense.targets.size()*sizeof(uint32_t));
+    write_section(out,vertex_free.data(),vertex_free.size()*sizeof(int32_t));
+    write_section(out,net_names.data(),net_names.size()*sizeof(uint32_t));
+    write_section(out,net_offsets.data(),net_offsets.size()*sizeof(uint32_t));
+    write_section(out,net_wires.data(),net_wires.size()*sizeof(int32_t));
+    write_section(out,net_free.data(),net_free.size()*sizeof(int32_t));
+    write_section(out,port_xy.data(),port_xy.size()*sizeof(double));
+    write_section(out,port_names.data(),port_names.size()*sizeof(uint32_t));
+    write_section(out,string_offsets.data(),string_offsets.size()*sizeof(uint32_t));
+    write_section(out,string_data.data(),string_data.size());
+    if(!out) throw std::runtime_error("Could not write schematic file.");
+}
+
+/*
+ * Replace the contents of `sch` with the schematic saved at `path`. The file is
+ * checked for consistency (bounds, ids, offsets), but its geometry is trusted.
+ * `sch` is left unchanged if the file can't be read.
+ */
+void SchematicFile::load(Schematic& sch, const string& path)
+{
+    MappedFile file(path);
+    if(file.size() < sizeof(Header)) throw std::runtime_error("Schematic file is truncated.");
+    Header header;
+    std::memcpy(&header,file.data(),sizeof(header));
+    if(std::memcmp(header.magic,MAGIC,sizeof(MAGIC)) != 0) throw std::runtime_error("Not a schematic file.");
+    if(header.byte_order != BYTE_ORDER_MARK) throw std::runtime_error("Schematic file has a different byte order.");
+    if(header.version != VERSION) throw std::runtime_error("Unsupported schematic file version.");
+
+    // Every counted item takes at least a byte, so counts past the file size are
+    // corrupt; checked first so that n+1 and 2*n below can't wrap around
+    for(uint64_t count : {header.vertex_count,header.adjacency_count,header.vertex_free_count,
+                          header.net_count,header.net_wire_count,header.net_free_count,
+                          header.port_count,header.string_count,header.string_bytes})
+    {
+        if(count > file.size()) throw std::runtime_error("Schematic file is malformed.");
+    }
+    if(header.vertex_pool_size > INT32_MAX || header.net_pool_size > INT32_MAX) throw std::runtime_error("Schematic file is malformed.");
+
+    SectionReader reader(file.data(),file.size(),sizeof(Header));
+    const uint64_t n = header.vertex_count;
+    const double* xy = reader.take<double>(2*n);
+    const int32_t* ids = reader.take<int32_t>(n);
+    const uint32_t* offsets = reader.take<uint32_t>(n+1);
+    const uint32_t* targets = reader.take<uint32_t>(header.adjacency_count);
+    const int32_t* vertex_free = reader.take<int32_t>(header.vertex_free_count);
+    const uint32_t* net_names = reader.take<uint32_t>(header.net_count);
+    const uint32_t* net_offsets = reader.take<uint32_t>(header.net_count+1);
+    const int32_t* net_wires = reader.take<int32_t>(2*header.net_wire_count);
+    const int32_t* net_free = reader.take<int32_t>(header.net_free_count);
+    const double* port_xy = reader.take<double>(2*header.port_count);
+    const uint32_t* port_names = reader.take<uint32_t>(header.port_count);
+    const uint32_t* string_offsets = reader.take<uint32_t>(header.string_count+1);
+    const char* string_data = reader.take<char>(header.string_bytes);
+
+    // Consistency checks, linear in the file size
+    check_offsets(offsets,n,header.adjacency_count);
+    check_offsets(net_offsets,header.net_count,header.net_wire_count);
+    check_offsets(string_offsets,header.string_count,header.string_bytes);
+    std::vector<int32_t> index;  // vertex id -> index, -1 if unused
+    for(uint64_t i=0; i<n; i++)
+    {
+        if(ids[i] < 0 || ids[i] >= static_cast<int64_t>(header.vertex_pool_size)) throw std::runtime_error("Schematic file is malformed.");
+        if(ids[i] >= static_cast<int64_t>(index.size())) index.resize(ids[i]+1,-1);
+        if(index[ids[i]] >= 0) throw std::runtime_error("Schematic file is malformed.");
+        index[ids[i]] = i;
+    }
+    for(uint64_t k=0; k<header.adjacency_count; k++)
+    {
+        if(targets[k] >= n) throw std::runtime_error("Schematic file is malformed.");
+    }
+    for(uint64_t k=0; k<2*header.net_wire_count; k++)
+    {
+        int32_t id = net_wires[k];
+        if(id < 0 || id >= static_cast<int64_t>(index.size()) || index[id] < 0)
+        {
+            throw std::runtime_error("Schematic file is malformed.");
+        }
+    }
+    auto get_string = [&](uint32_t s) {
+        if(s >= header.string_count) throw std::runtime_error("Schematic file is malformed.");
+        return string(string_data+string_offsets[s],string_offsets[s+1]-string_offsets[s]);
+    };
+
+    std::multimap<string,Vec<Wire>> nets;
+    for(uint64_t i=0; i<header.net_count; i++)
+    {
+        Vec<Wire> wires(net_offsets[i+1]-net_offsets[i]);
+        for(uint32_t k=net_offsets[i]; k<net_offsets[i+1]; k++)
+        {
+            wires[k-net_offsets[i]] = {net_wires[2*k],net_wires[2*k+1]};
+        }
+        nets.emplace_hint(nets.end(),get_string(net_names[i]),std::move(wires));
+    }
+    Vec<Schematic::Port> ports(header.port_count);
+    for(uint64_t i=0; i<header.port_count; i++)
+    {
+        ports[i] = {Coordinate2(port_xy[2*i],port_xy[2*i+1]),get_string(port_names[i])};
+    }
+    string name = get_string(header.name);
+
+    // Id pools: free ids must be in the pool, unique and not in use
+    std::vector<char> vertex_used(header.vertex_pool_size,0), net_used(header.net_pool_size,0);
+    for(size_t id=0; id<index.size(); id++) vertex_used[id] = index[id] >= 0;
+    for(auto& net : nets)
+    {
+        if(!netname_is_int(net.first)) continue;
+        uint64_t num = 0;
+        const char* end = net.first.data()+net.first.size();
+        auto result = std::from_chars(net.first.data(),end,num);
+        if(result.ec != std::errc() || result.ptr != end || num >= header.net_pool_size)
+            throw std::runtime_error("Schematic file is malformed.");
+        net_used[num] = 1;
+    }
+    auto read_pool = [](uint64_t size, const int32_t* free_ids, uint64_t count, std::vector<char>& used) {
+        Vec<int> ids(count);
+        for(uint64_t i=0; i<count; i++)
+        {
+            if(free_ids[i] < 0 || free_ids[i] >= static_cast<int64_t>(size) || used[free_ids[i]])
+            {
+                throw std::runtime_error("Schematic file is malformed.");
+            }
+            used[free_ids[i]] = 1;
+            ids[i] = free_ids[i];
+        }
+        IdPool pool;
+        pool.assign(size,ids);
+        return pool;
+    };
+    IdPool vertex_pool = read_pool(header.vertex_pool_size,vertex_free,header.vertex_free_count,vertex_used);
+    IdPool net_pool = read_pool(header.net_pool_size,net_free,header.net_free_count,net_used);
+
+    // Everything is checked, replace the schematic
+    sch.clear_undo();
+    sch._graph.assign(n,ids,xy,offsets,targets,std::move(vertex_pool));
+    sch._idpool = std::move(net_pool);
+    sch.name = std::move(name);
+    sch._nets = std::move(nets);
+    sch._ports = std::move(ports);
+    sch._ports_version++;
+    sch._load_resolved();
+}
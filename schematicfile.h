@@ -0,0 +1,71 @@
+#ifndef SCHEMATICFILE_H
+#define SCHEMATICFILE_H
+
+#include <string>
+#include <cstdint>
+#include "schematic.h"
+
+
+/* Binary schematic files.
+ *
+ * Usage: SchematicFile::save(sch,path) writes the resolved schematic, and
+ * SchematicFile::load(sch,path) replaces the contents of `sch` with a saved one.
+ * Loading memory-maps the file and copies its arrays straight into the graph and the
+ * net table. Nothing is re-added wire by wire, because a saved schematic already
+ * follows the vertex graph rules and its nets are already resolved. Vertex ids, net
+ * names, ports and the id pools come back exactly as they were saved, so later edits
+ * give the same ids and names as they would have before saving. The undo history is
+ * cleared.
+ *
+ * Layout (version 1, native byte order, every section starts on an 8 byte boundary):
+ *   Header
+ *   double   positions[2*vertex_count]       x,y of each vertex, in node list order
+ *   int32    vertex_ids[vertex_count]
+ *   uint32   adjacency_offsets[vertex_count+1]
+ *   uint32   adjacency[adjacency_count]      vertex indices (CSR)
+ *   int32    vertex_free_ids[vertex_free_count]   vertex id pool, in order
+ *   uint32   net_names[net_count]            string indices
+ *   uint32   net_offsets[net_count+1]        into net_wires, in wires
+ *   int32    net_wires[2*net_wire_count]     vertex ids
+ *   int32    net_free_ids[net_free_count]    net number pool, in order
+ *   double   port_positions[2*port_count]
+ *   uint32   port_names[port_count]          string indices
+ *   uint32   string_offsets[string_count+1]  into string_data
+ *   char     string_data[string_bytes]
+ *
+ * Malformed or truncated files, and files from another version or byte order, throw
+ * std::runtime_error.
+ */
+class SchematicFile
+{
+public:
+    static constexpr char MAGIC[8] = {'N','M','S','C','H','E','M','\0'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t vertex_count;
+        uint64_t adjacency_count;
+        uint64_t vertex_pool_size;
+        uint64_t vertex_free_count;
+        uint64_t net_count;
+        uint64_t net_wire_count;
+        uint64_t net_pool_size;
+        uint64_t net_free_count;
+        uint64_t port_count;
+        uint64_t string_count;
+        uint64_t string_bytes;
+        uint32_t name;              // string index of the schematic name
+        uint32_t reserved;
+    };
+
+    static void save(Schematic& sch, const std::string& path);
+    static void load(Schematic& sch, const std::string& path);
+};
+
+
+#endif // SCHEMATICFILE_H
@@ -0,0 +1,451 @@
+#include "schematicfuzz.h"
+#include <random>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "threadpool.h"
+
+using std::string;
+using Wire = Schematic::Wire;
+using Segment = std::pair<Coordinate2,Coordinate2>;
+
+namespace
+{
+
+// std::mt19937_64 gives the same sequence everywhere, the std distributions don't
+class Random
+{
+public:
+    Random(uint64_t seed) : _rng{seed} {}
+    size_t below(size_t n) {return static_cast<size_t>(_rng() % n);}
+    bool chance(size_t percent) {return below(100) < percent;}
+private:
+    std::mt19937_64 _rng;
+};
+
+const char* PORT_NAMES[] = {"a","b","vdd","gnd"};
+
+string str(Coordinate2 p)
+{
+    std::ostringstream out;
+    out << p.x << " " << p.y;
+    return out.str();
+}
+
+// Mostly horizontal and vertical wires, some diagonal, some degenerate
+Coordinate2 random_point(Random& rng, int grid) {return Coordinate2(rng.below(grid),rng.below(grid));}
+Segment random_segment(Random& rng, int grid)
+{
+    Coordinate2 a = random_point(rng,grid);
+    int len = rng.below(7);
+    size_t kind = rng.below(20);
+    if(kind < 9) return {a,Coordinate2(a.x+len,a.y)};
+    if(kind < 18) return {a,Coordinate2(a.x,a.y+len)};
+    return {a,Coordinate2(a.x+len,a.y+len)};
+}
+
+class Run
+{
+public:
+    Run(const SchematicFuzzer::Params& params, SchematicFuzzer::Result& result)
+        : _params{params},_result{result},_rng{params.seed} {}
+
+    void setup()
+    {
+        _sch.set_verification(true);
+        if(_params.parallel)
+        {
+            _pool = std::make_unique<Estd::ThreadPool>(4);
+            _sch.set_parallel_resolution(0,_pool.get());
+        }
+        if(_params.concurrent_readers) _sch.set_concurrent_readers(true);
+        if(_params.undo_limit) _sch.set_undo_limit(_params.undo_limit);
+    }
+
+    void step()
+    {
+        size_t op = _rng.below(100);
+        if(op < 30) add_wire();
+        else if(op < 38) add_wires();
+        else if(op < 52) remove_wire();
+        else if(op < 60) add_port();
+        else if(op < 65) remove_ports();
+        else if(op < 73)
+        {
+            if(!_params.undo_limit) return add_wire();
+            bool back = _rng.chance(60);
+            _log(back ? "undo" : "redo");
+            if(back) _sch.undo();
+            else _sch.redo();
+        }
+        else if(op < 78)
+        {
+            if(!_params.lazy) return remove_wire();
+            bool lazy = !_sch.lazy();
+            _log("set_lazy " + std::to_string(lazy));
+            _sch.set_lazy(lazy);
+        }
+        else if(op < 82)
+        {
+            _log("snapshot");
+            _sch.snapshot();
+        }
+        else if(op < 85)
+        {
+            _log("update_nets");
+            _sch.update_nets();
+        }
+        else if(op < 87)
+        {
+            _log("compact");
+            _sch.compact();
+        }
+        else query();
+    }
+
+    void finish()
+    {
+        _log("verify_nets");
+        _sch.verify_nets();
+    }
+
+private:
+    const SchematicFuzzer::Params& _params;
+    SchematicFuzzer::Result& _result;
+    Random _rng;
+    std::unique_ptr<Estd::ThreadPool> _pool;  // outlives _sch
+    Schematic _sch;
+
+    void _log(const string& line) {_result.log.push_back(line);}
+    Coordinate2 _point() {return random_point(_rng,_params.grid);}
+    Segment _segment() {return random_segment(_rng,_params.grid);}
+
+    void add_wire()
+    {
+        Segment s = _segment();
+        bool traverse = _rng.chance(90);
+        _log("add_wire " + str(s.first) + " " + str(s.second) + " " + std::to_string(traverse));
+        _sch.add_wire(s.first,s.second,traverse);
+    }
+
+    void add_wires()
+    {
+        Estd::Vec<Segment> batch(1+_rng.below(8));
+        string line = "add_wires";
+        for(auto& s : batch)
+        {
+            s = _segment();
+            line += " " + str(s.first) + " " + str(s.second);
+        }
+        bool traverse = _rng.chance(90);
+        _log(line + " " + std::to_string(traverse));
+        _sch.add_wires(batch,traverse);
+    }
+
+    void remove_wire()
+    {
+        Estd::Vec<Wire> wires = _sch.get_all_wires();
+        if(wires.empty()) return add_wire();
+        Wire w = wires[_rng.below(wires.size())];
+        bool traverse = _rng.chance(90);
+        _log("remove_wire " + std::to_string(w.first) + " " + std::to_string(w.second) + " " + std::to_string(traverse));
+        _sch.remove_wire(w,traverse);
+    }
+
+    void add_port()
+    {
+        Schematic::Port port(_point(),PORT_NAMES[_rng.below(4)]);
+        bool traverse = _rng.chance(90);
+        _log("add_port_node " + str(port.first) + " " + port.second + " " + std::to_string(traverse));
+        _sch.add_port_node(port,traverse);
+    }
+
+    void remove_ports()
+    {
+        string name = PORT_NAMES[_rng.below(4)];
+        bool traverse = _rng.chance(90);
+        Estd::Vec<int> pids = _sch.select_port_nodes(name);
+        if(!pids.empty() && _rng.chance(50))
+        {
+            int pid = pids[_rng.below(pids.size())];
+            _log("remove_port_node " + std::to_string(pid) + " " + std::to_string(traverse));
+            _sch.remove_port_node(pid,traverse);
+        }
+        else
+        {
+            _log("remove_port_nodes " + name + " " + std::to_string(traverse));
+            _sch.remove_port_nodes(name,traverse);
+        }
+    }
+
+    void query()
+    {
+        Coordinate2 p = _point();
+        switch(_rng.below(3))
+        {
+        case 0:
+            _log("select_net " + str(p));
+            _sch.select_net(p);
+            break;
+        case 1:
+            _log("select_wires " + str(p));
+            _sch.select_wires(p);
+            break;
+        default:
+        {
+            Estd::Vec<Wire> wires = _sch.get_all_wires();
+            if(wires.empty()) return;
+            Wire w = wires[_rng.below(wires.size())];
+            _log("get_netname " + std::to_string(w.first) + " " + std::to_string(w.second));
+            // Edits made with traverse=false leave new wires without a net until
+            // the next update_nets(); that is the one rejection expected here
+            bool stale = _sch.nets_dirty() && !_sch.lazy();
+            try {_sch.get_netname(w);}
+            catch(const std::invalid_argument&)
+            {
+                if(!stale) throw;
+                _result.rejected++;
+            }
+        }
+        }
+    }
+};
+
+// The configurations of a differential run; the first is the reference
+const char* CONFIGS[] = {"eager serial","lazy serial","eager parallel","lazy parallel"};
+
+class DiffRun
+{
+public:
+    DiffRun(const SchematicFuzzer::Params& params, SchematicFuzzer::Result& result)
+        : _params{params},_result{result},_rng{params.seed} {}
+
+    void setup()
+    {
+        _pool = std::make_unique<Estd::ThreadPool>(4);
+        for(int i=0; i<4; i++)
+        {
+            Schematic& sch = _schs[i];
+            sch.set_verification(true);
+            if(i & 1) sch.set_lazy(true);
+            if(i & 2) sch.set_parallel_resolution(0,_pool.get());
+            if(_params.undo_limit) sch.set_undo_limit(_params.undo_limit);
+        }
+    }
+
+    // Wires are picked by position, so that every call means the same in all
+    // configurations whatever their vertex ids, and added with traverse=true, which
+    // is what lazy mode defers. No undo or redo: edits made while the nets are
+    // pending are one undo step (see Schematic::undo()), so lazy steps are coarser.
+    void step()
+    {
+        size_t op = _rng.below(100);
+        if(op < 35)
+        {
+            Segment s = random_segment(_rng,_params.grid);
+            _log("add_wire " + str(s.first) + " " + str(s.second));
+            for(auto& sch : _schs) sch.add_wire(s.first,s.second);
+        }
+        else if(op < 43)
+        {
+            Estd::Vec<Segment> batch(1+_rng.below(8));
+            string line = "add_wires";
+            for(auto& s : batch)
+            {
+                s = random_segment(_rng,_params.grid);
+                line += " " + str(s.first) + " " + str(s.second);
+            }
+            _log(line);
+            for(auto& sch : _schs) sch.add_wires(batch);
+        }
+        else if(op < 57)
+        {
+            Coordinate2 p = random_point(_rng,_params.grid);
+            _log("remove_wire at " + str(p));
+            for(auto& sch : _schs)
+            {
+                Wire w = sch.select_wire(p);
+                if(w != Schematic::INVALID_WIRE) sch.remove_wire(w);
+            }
+        }
+        else if(op < 65)
+        {
+            Schematic::Port port(random_point(_rng,_params.grid),PORT_NAMES[_rng.below(4)]);
+            _log("add_port_node " + str(port.first) + " " + port.second);
+            for(auto& sch : _schs) sch.add_port_node(port);
+        }
+        else if(op < 70)
+        {
+            string name = PORT_NAMES[_rng.below(4)];
+            Estd::Vec<int> pids = _schs[0].select_port_nodes(name);  // ports are in the same order everywhere
+            if(!pids.empty() && _rng.chance(50))
+            {
+                int pid = pids[_rng.below(pids.size())];
+                _log("remove_port_node " + std::to_string(pid));
+                for(auto& sch : _schs) sch.remove_port_node(pid);
+            }
+            else
+            {
+                _log("remove_port_nodes " + name);
+                for(auto& sch : _schs) sch.remove_port_nodes(name);
+            }
+        }
+        else if(op < 72)
+        {
+            _log("compact");
+            for(auto& sch : _schs) sch.compact();
+        }
+        else if(op < 90) query();
+        else
+        {
+            _log("compare");
+            compare();
+        }
+    }
+
+    void finish()
+    {
+        _log("compare");
+        compare();
+        for(auto& sch : _schs) sch.verify_nets();
+    }
+
+private:
+    const SchematicFuzzer::Params& _params;
+    SchematicFuzzer::Result& _result;
+    Random _rng;
+    std::unique_ptr<Estd::ThreadPool> _pool;  // outlives _schs
+    Schematic _schs[4];
+
+    // A net as its name and its sorted segments (x1,y1,x2,y2 with the lower end first)
+    using Segments = std::vector<std::array<double,4>>;
+    using Nets = std::vector<std::pair<string,Segments>>;
+
+    void _log(const string& line) {_result.log.push_back(line);}
+
+    void query()
+    {
+        Coordinate2 p = random_point(_rng,_params.grid);
+        _log("select_net " + str(p));
+        for(auto& sch : _schs) sch.select_net(p);
+    }
+
+    /* The nets sorted by their segments, with their names if `names`. */
+    static Nets _nets(const SchematicSnapshot& snap, bool names)
+    {
+        Nets nets;
+        for(auto& net : snap.nets())
+        {
+            Segments segments;
+            for(auto& s : net.second->segments)
+            {
+                std::array<double,4> seg{s.first.x,s.first.y,s.second.x,s.second.y};
+                if(std::make_pair(seg[2],seg[3]) < std::make_pair(seg[0],seg[1])) seg = {seg[2],seg[3],seg[0],seg[1]};
+                segments.push_back(seg);
+            }
+            std::sort(segments.begin(),segments.end());
+            nets.push_back({names ? net.first : string(),std::move(segments)});
+        }
+        std::sort(nets.begin(),nets.end());
+        return nets;
+    }
+
+    /* Parallel resolution names nets exactly as serial resolution in the same mode.
+     * Lazy mode gives the same nets as eager mode, but not always the same names:
+     * eager mode names nets between edits that lazy mode resolves together (see
+     * Schematic::set_lazy()).
+     */
+    void compare()
+    {
+        std::shared_ptr<const SchematicSnapshot> snaps[4];
+        for(int i=0; i<4; i++) snaps[i] = _schs[i].snapshot();
+        for(int i=1; i<4; i++)
+        {
+            int ref = (i == 3) ? 1 : 0;   // serial in the same mode, eager serial for lazy serial
+            bool names = (i != 1);
+            if(_nets(*snaps[i],names) != _nets(*snaps[ref],names))
+            {
+                throw std::logic_error(string("Nets of the ") + CONFIGS[i] + " schematic differ from the " + CONFIGS[ref] + " ones.");
+            }
+            if(snaps[i]->ports() != snaps[0]->ports()) throw std::logic_error(string("Ports of the ") + CONFIGS[i] + " schematic differ from the eager serial ones.");
+        }
+    }
+};
+
+}  // namespace
+
+
+SchematicFuzzer::Result SchematicFuzzer::run_differential(const Params& params)
+{
+    if(params.grid < 2) throw std::invalid_argument("Fuzzer grid must be at least 2.");
+    Result result;
+    DiffRun run(params,result);
+    try
+    {
+        run.setup();
+        for(; result.steps < params.steps; )
+        {
+            result.steps++;
+            run.step();
+        }
+        result.steps++;
+        run.finish();
+    }
+    catch(const std::exception& e)
+    {
+        result.ok = false;
+        result.error = e.what();
+    }
+    return result;
+}
+
+SchematicFuzzer::Result SchematicFuzzer::run(const Params& params)
+{
+    if(params.grid < 2) throw std::invalid_argument("Fuzzer grid must be at least 2.");
+    Result result;
+    Run run(params,result);
+    try
+    {
+        run.setup();
+        for(; result.steps < params.steps; )
+        {
+            result.steps++;
+            run.step();
+        }
+        result.steps++;
+        run.finish();
+    }
+    catch(const std::exception& e)
+    {
+        result.ok = false;
+        result.error = e.what();
+    }
+    return result;
+}
+
+SchematicFuzzer::Params SchematicFuzzer::variant(uint64_t seed, size_t steps)
+{
+    Params params;
+    params.seed = seed;
+    params.steps = steps;
+    Random rng(seed ^ 0x9e3779b97f4a7c15ull);
+    params.grid = 8 + rng.below(17);
+    params.lazy = rng.chance(50);
+    params.parallel = rng.chance(30);
+    params.concurrent_readers = rng.chance(30);
+    params.undo_limit = rng.chance(50) ? 1+rng.below(20) : 0;
+    return params;
+}
+
+string SchematicFuzzer::describe(const Params& params)
+{
+    std::ostringstream out;
+    out << "seed " << params.seed << ", " << params.steps << " steps, grid " << params.grid
+        << (params.lazy ? ", lazy" : "") << (params.parallel ? ", parallel" : "")
+        << (params.concurrent_readers ? ", concurrent readers" : "");
+    if(params.undo_limit) out << ", undo limit " << params.undo_limit;
+    return out.str();
+}
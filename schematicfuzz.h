@@ -0,0 +1,65 @@
+#ifndef SCHEMATICFUZZ_H
+#define SCHEMATICFUZZ_H
+
+#include <string>
+#include <cstdint>
+#include "schematic.h"
+#include "utils.h"
+
+
+/* Random edit sequences with differential verification.
+ *
+ * Usage: SchematicFuzzer::run(SchematicFuzzer::variant(seed)) makes `steps` random
+ * calls (wires added one by one and in batches, removed, ports, undo/redo, lazy mode,
+ * compaction, snapshots and queries) on a small integer grid, on a Schematic with
+ * set_verification(true), so every net update is checked against a full recompute
+ * (see Schematic::verify_nets()), and the nets are verified once more at the end.
+ *
+ * Calls are only made on valid targets, so any exception stops the run and fails
+ * it. The one expected rejection, get_netname() on a wire added with traverse=false
+ * before the next update_nets(), is checked for and counted. The log has one line
+ * per call, so a failing run can be read back or reproduced from its seed. The same
+ * parameters give the same run on every platform.
+ *
+ * run_differential() makes one random sequence of calls on four schematics, eager
+ * and lazy, each resolving serially and on a thread pool, and fails if their nets
+ * (wires and how they split into nets) or ports ever differ, or if a parallel one
+ * names its nets unlike the serial one in the same mode. Lazy mode can name nets
+ * unlike eager mode (see Schematic::set_lazy()), so those names aren't compared.
+ * Its calls pick wires by position and always traverse, and leave out undo and
+ * redo, whose steps are coarser in lazy mode; `lazy`, `parallel` and
+ * `concurrent_readers` are not used.
+ */
+class SchematicFuzzer
+{
+public:
+    struct Params
+    {
+        uint64_t seed = 1;
+        size_t steps = 1000;
+        int grid = 16;                  // coordinates are 0..grid-1
+        bool lazy = false;              // toggle lazy mode during the run
+        bool parallel = false;          // resolve on a thread pool
+        bool concurrent_readers = false;
+        size_t undo_limit = 0;
+    };
+
+    struct Result
+    {
+        bool ok = true;
+        size_t steps = 0;               // calls made, including the failing one
+        size_t rejected = 0;            // expected std::invalid_argument rejections
+        std::string error;
+        Estd::Vec<std::string> log;
+    };
+
+    static Result run(const Params& params);
+    static Result run_differential(const Params& params);
+
+    // Parameters for `seed`, with the options picked from the seed
+    static Params variant(uint64_t seed, size_t steps=1000);
+    static std::string describe(const Params& params);
+};
+
+
+#endif // SCHEMATICFUZZ_H
@@ -0,0 +1,316 @@
+#include "schematicgen.h"
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <unordered_set>
+#include <cmath>
+#include <stdexcept>
+
+using std::string;
+using Pattern = SchematicGenerator::Pattern;
+using Segment = std::pair<Coordinate2,Coordinate2>;
+
+namespace
+{
+
+// std::mt19937_64 gives the same sequence everywhere, the std distributions don't
+class Random
+{
+public:
+    Random(uint64_t seed) : _rng{seed} {}
+    size_t below(size_t n) {return static_cast<size_t>(_rng() % n);}
+    template<typename T>
+    void shuffle(std::vector<T>& v)
+    {
+        for(size_t i=v.size(); i>1; i--) std::swap(v[i-1],v[below(i)]);
+    }
+private:
+    std::mt19937_64 _rng;
+};
+
+// One net, drawn from (0,0) to (width,height)
+struct Net
+{
+    std::vector<Segment> wires;
+    std::vector<Coordinate2> ports;
+    double width = 0;
+    double height = 0;
+};
+
+void add(Net& net, double x1, double y1, double x2, double y2)
+{
+    net.wires.push_back({Coordinate2(x1,y1),Coordinate2(x2,y2)});
+    net.width = std::max({net.width,x1,x2});
+    net.height = std::max({net.height,y1,y2});
+}
+
+// Row major over an m by m lattice, a wire right and a wire up from each point
+Net grid_net(size_t count)
+{
+    Net net;
+    size_t m = 2;
+    while(2*m*(m-1) < count) m++;
+    for(size_t y=0; y<m; y++)
+    {
+        for(size_t x=0; x<m; x++)
+        {
+            if(x+1 < m && net.wires.size() < count) add(net,x,y,x+1,y);
+            if(y+1 < m && net.wires.size() < count) add(net,x,y,x,y+1);
+        }
+    }
+    return net;
+}
+
+Net bus_net(size_t count)
+{
+    Net net;
+    for(size_t j=0; j<count; j++)
+    {
+        double x = j/2;
+        if(j%2 == 0) add(net,x,0,x+1,0);
+        else add(net,x+1,0,x+1,1);
+    }
+    return net;
+}
+
+// Trunk at x=3 from y=0 to y=length, branches of length 1 to 3 at random free slots
+Net star_net(size_t count, Random& rng)
+{
+    Net net;
+    size_t length = count/2+1;
+    add(net,3,0,3,length);
+    std::vector<std::pair<size_t,int>> slots;   // y, side
+    for(size_t y=1; y<length; y++)
+    {
+        slots.push_back({y,-1});
+        slots.push_back({y,1});
+    }
+    rng.shuffle(slots);
+    for(size_t i=0; i+1<count; i++)
+    {
+        double len = 1+rng.below(3);
+        double y = slots[i].first;
+        add(net,3,y,3+slots[i].second*len,y);
+    }
+    net.width = 6;
+    return net;
+}
+
+/* Grow a tree from the middle of a square: pick a point already on the tree (a
+ * vertex, or a point inside a wire for a T junction), and draw a wire of length 1 to
+ * 3 from it that doesn't touch the tree anywhere else.
+ */
+Net forest_net(size_t count, Random& rng)
+{
+    Net net;
+    int64_t side = 2*static_cast<int64_t>(std::ceil(std::sqrt(double(count))))+2;
+    std::vector<std::pair<int64_t,int64_t>> points{{side/2,side/2}};
+    std::unordered_set<int64_t> used{side/2*(side+1)+side/2};
+    const int64_t dx[4] = {1,0,-1,0}, dy[4] = {0,1,0,-1};
+    for(size_t attempts=0; net.wires.size()<count && attempts<1000*count; attempts++)
+    {
+        auto p = points[rng.below(points.size())];
+        int d = rng.below(4);
+        int64_t len = 1+rng.below(3);
+        bool free = true;
+        for(int64_t k=1; k<=len && free; k++)
+        {
+            int64_t x = p.first+k*dx[d], y = p.second+k*dy[d];
+            free = x >= 0 && y >= 0 && x <= side && y <= side && !used.count(y*(side+1)+x);
+        }
+        if(!free) continue;
+        for(int64_t k=1; k<=len; k++)
+        {
+            int64_t x = p.first+k*dx[d], y = p.second+k*dy[d];
+            used.insert(y*(side+1)+x);
+            points.push_back({x,y});
+        }
+        add(net,p.first,p.second,p.first+len*dx[d],p.second+len*dy[d]);
+    }
+    net.width = net.height = side;
+    return net;
+}
+
+// Staircase of unit wires with ports on both ends and on every other corner
+Net ports_net(size_t count)
+{
+    Net net;
+    double x = 0, y = 0;
+    net.ports.push_back(Coordinate2(x,y));
+    for(size_t j=0; j<count; j++)
+    {
+        if(j%2 == 0) {add(net,x,y,x+1,y); x++;}
+        else
+        {
+            add(net,x,y,x,y+1);
+            y++;
+            net.ports.push_back(Coordinate2(x,y));
+        }
+    }
+    if(count%2 == 1) net.ports.push_back(Coordinate2(x,y));
+    return net;
+}
+
+Net chain_net(size_t count, bool vertical, Random& rng)
+{
+    Net net;
+    std::vector<size_t> order(count);
+    for(size_t i=0; i<count; i++) order[i] = i;
+    rng.shuffle(order);
+    for(size_t i : order)
+    {
+        if(vertical) add(net,0,i,0,i+1);
+        else add(net,i,0,i+1,0);
+    }
+    return net;
+}
+
+// SchematicTestFixtureWithWires, moved to the origin
+const double TILE[][4] = {
+    { 4, 0,  4,  5}, { 4, 0, 17, 0},
+    {23, 0, 33,  0}, {33, 0, 33, 4},
+    {33,10, 33, 18}, {22,18, 33,18},
+    { 4,18,  7, 18}, { 4,11,  4,18}, { 7,18, 13,18}, { 7,18,  7,25}, {13,18,16,18},
+    {13,18, 13, 21}, {13,21, 27,21}, {36,21, 36,25}, {36,31, 36,37}, {23,37,27,37},
+    {27,21, 36, 21}, {27,37, 36,37}, {27,21, 27,37},
+    { 7,37, 10, 37}, { 7,31,  7,34}, { 7,34,  7,37}, { 0,34,  7,34}, { 0,34, 0,43},
+    { 0,43, 10, 43}, {10,37, 17,37}, {10,37, 10,43},
+    {48,18, 48, 27}, {48,27, 51,27}, {51,22, 51,27}, {51,22, 65,22}, {65,18,65,22},
+    {65, 6, 65, 12}, {48, 6, 65, 6}, {48, 6, 48,12},
+};
+const size_t TILE_WIRES = sizeof(TILE)/sizeof(TILE[0]);
+const size_t TILE_NETS = 7;
+
+Net tile_net()
+{
+    Net net;
+    for(auto& w : TILE) add(net,w[0],w[1],w[2],w[3]);
+    return net;
+}
+
+}  // namespace
+
+SchematicGenerator::Design SchematicGenerator::generate(const Params& params)
+{
+    Random rng(params.seed);
+    size_t nwires = params.wires;
+    size_t nnets = params.nets ? params.nets : (nwires+63)/64;
+    nnets = std::min(nnets,nwires);
+    if(params.pattern == Pattern::TILED) nnets = (nwires+TILE_WIRES-1)/TILE_WIRES;
+
+    std::vector<Net> nets;
+    nets.reserve(nnets);
+    for(size_t i=0; i<nnets; i++)
+    {
+        size_t count = nwires/nnets + (i < nwires%nnets ? 1 : 0);
+        switch(params.pattern)
+        {
+        case Pattern::GRID:   nets.push_back(grid_net(count)); break;
+        case Pattern::BUS:    nets.push_back(bus_net(count)); break;
+        case Pattern::STAR:   nets.push_back(star_net(count,rng)); break;
+        case Pattern::FOREST: nets.push_back(forest_net(count,rng)); break;
+        case Pattern::PORTS:  nets.push_back(ports_net(count)); break;
+        case Pattern::CHAIN:  nets.push_back(chain_net(count,i%2 == 1,rng)); break;
+        case Pattern::TILED:  nets.push_back(tile_net()); break;
+        }
+    }
+
+    // Pack the boxes in rows about as wide as the whole design is tall
+    const double gap = 2;
+    double area = 0;
+    for(auto& net : nets) area += (net.width+gap)*(net.height+gap);
+    double row_width = std::ceil(std::sqrt(area));
+
+    Design design;
+    design.name = pattern_name(params.pattern) + "_" + std::to_string(params.wires) + "_" + std::to_string(params.seed);
+    design.nets = params.pattern == Pattern::TILED ? nnets*TILE_NETS : nnets;
+    double x = 0, y = 0, row_height = 0;
+    for(size_t i=0; i<nets.size(); i++)
+    {
+        Net& net = nets[i];
+        if(x > 0 && x+net.width > row_width)
+        {
+            x = 0;
+            y += row_height+gap;
+            row_height = 0;
+        }
+        for(auto& w : net.wires)
+        {
+            design.wires.push_back({Coordinate2(w.first.x+x,w.first.y+y),Coordinate2(w.second.x+x,w.second.y+y)});
+        }
+        for(auto& p : net.ports)
+        {
+            design.ports.push_back({Coordinate2(p.x+x,p.y+y),"net" + std::to_string(i)});
+        }
+        x += net.width+gap;
+        row_height = std::max(row_height,net.height);
+    }
+    return design;
+}
+
+void SchematicGenerator::add_to(const Design& design, Schematic& sch, bool bulk)
+{
+    // Like WireListReader: merge after the last wire, then add the ports and resolve
+    if(bulk) sch.add_wires(design.wires);
+    else
+    {
+        for(size_t i=0; i<design.wires.size(); i++)
+        {
+            auto& w = design.wires[i];
+            sch.add_wire(w.first,w.second,i+1 == design.wires.size());
+        }
+    }
+    for(auto& port : design.ports) sch.add_port_node(port,false);
+    if(!design.ports.empty()) sch.update_nets();
+}
+
+void SchematicGenerator::write(const Design& design, std::ostream& out)
+{
+    // All coordinates are integers
+    auto num = [](double v) {return static_cast<long long>(v);};
+    out << "# " << design.wires.size() << " wires, " << design.ports.size() << " ports, "
+        << design.nets << " nets\n";
+    out << "name " << design.name << '\n';
+    for(auto& w : design.wires)
+    {
+        out << "wire " << num(w.first.x) << ' ' << num(w.first.y) << ' '
+            << num(w.second.x) << ' ' << num(w.second.y) << '\n';
+    }
+    for(auto& p : design.ports)
+    {
+        out << "port " << num(p.first.x) << ' ' << num(p.first.y) << ' ' << p.second << '\n';
+    }
+}
+
+void SchematicGenerator::write_file(const Design& design, const string& path)
+{
+    std::ofstream out(path,std::ios::binary | std::ios::trunc);
+    if(!out) throw std::runtime_error("Could not open wire list file.");
+    write(design,out);
+    out.flush();
+    if(!out) throw std::runtime_error("Could not write wire list file.");
+}
+
+string SchematicGenerator::pattern_name(Pattern pattern)
+{
+    switch(pattern)
+    {
+    case Pattern::GRID:   return "grid";
+    case Pattern::BUS:    return "bus";
+    case Pattern::STAR:   return "star";
+    case Pattern::FOREST: return "forest";
+    case Pattern::PORTS:  return "ports";
+    case Pattern::CHAIN:  return "chain";
+    case Pattern::TILED:  return "tiled";
+    }
+    return "";
+}
+
+Pattern SchematicGenerator::pattern(const string& name)
+{
+    for(Pattern p : {Pattern::GRID,Pattern::BUS,Pattern::STAR,Pattern::FOREST,Pattern::PORTS,Pattern::CHAIN,Pattern::TILED})
+    {
+        if(pattern_name(p) == name) return p;
+    }
+    throw std::invalid_argument("Unknown schematic pattern: " + name);
+}
@@ -0,0 +1,72 @@
+#ifndef SCHEMATICGEN_H
+#define SCHEMATICGEN_H
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <utility>
+#include "coordinate2.h"
+#include "schematic.h"
+#include "utils.h"
+
+
+/* Seeded synthetic schematics for scale testing.
+ *
+ * Usage: SchematicGenerator::generate({Pattern::GRID,100000,500,7}) makes a design of
+ * 100000 wires in 500 nets, which can be added to a Schematic with add_to() or saved
+ * as a wire list (see WireListReader) with write_file(). The same parameters give the
+ * same design on every platform.
+ *
+ * Every net is drawn in its own box, and the boxes are packed in rows with a gap
+ * between them, so the nets never touch and the design resolves to exactly `nets`
+ * nets. Wires are split as evenly as possible between the nets, and all coordinates
+ * are integers.
+ *   GRID    square meshes of unit wires (T and cross junctions everywhere)
+ *   BUS     long straight buses made of unit wires, with a tap at every joint
+ *   STAR    a trunk with branches on both sides, many in pairs (T and star junctions)
+ *   FOREST  random trees grown on the integer grid
+ *   PORTS   staircases with a port on every other corner and on both ends (each
+ *           add_port_node() looks up the wire under the port, so adding very large
+ *           PORTS designs takes a while)
+ *   CHAIN   straight lines of unit wires added in random order (every wire is merged
+ *           with its neighbours, and only one wire per net is left)
+ *   TILED   copies of a 35 wire, 7 net layout (nmtest's SchematicTestFixtureWithWires).
+ *           The wire count is rounded up to whole tiles and `nets` is ignored.
+ * `nets`==0 picks one net per 64 wires.
+ */
+class SchematicGenerator
+{
+public:
+    enum class Pattern {GRID, BUS, STAR, FOREST, PORTS, CHAIN, TILED};
+
+    struct Params
+    {
+        Pattern pattern = Pattern::GRID;
+        size_t wires = 1000;
+        size_t nets = 0;
+        uint64_t seed = 1;
+    };
+
+    struct Design
+    {
+        std::string name;
+        Estd::Vec<std::pair<Coordinate2,Coordinate2>> wires;
+        Estd::Vec<Schematic::Port> ports;
+        size_t nets = 0;        // number of nets once resolved
+    };
+
+    static Design generate(const Params& params);
+
+    // Add with Schematic::add_wires() (bulk) or one add_wire() per wire, then the ports
+    static void add_to(const Design& design, Schematic& sch, bool bulk=true);
+
+    // Wire list text, as read by WireListReader
+    static void write(const Design& design, std::ostream& out);
+    static void write_file(const Design& design, const std::string& path);
+
+    static std::string pattern_name(Pattern pattern);
+    static Pattern pattern(const std::string& name);
+};
+
+
+#endif // SCHEMATICGEN_H
@@ -0,0 +1,329 @@
+#include "segmentbatch.h"
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include "memoryusage.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEGMENTBATCH_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+// Segments per call of a kernel, small enough for a buffer on the stack
+constexpr size_t BLOCK = 256;
+
+using Kernel = void (*)(const double* ax, const double* ay, const double* bx, const double* by,
+                        size_t n, double px, double py, double* out);
+// hit[i] = 1 if segment i is closer than sqrt(tol2), comparing cross^2 with tol2*len2
+// instead of dividing
+using WithinKernel = void (*)(const double* ax, const double* ay, const double* bx, const double* by,
+                              size_t n, double px, double py, double tol2, uint8_t* hit);
+
+// Same steps as segment_distance_sq(), computing every case and picking one
+void kernel_scalar(const double* ax, const double* ay, const double* bx, const double* by,
+                   size_t n, double px, double py, double* out)
+{
+    for(size_t i=0; i<n; i++)
+    {
+        double dx = bx[i]-ax[i], dy = by[i]-ay[i];
+        double wx = px-ax[i], wy = py-ay[i];
+        double t = wx*dx+wy*dy;
+        double len2 = dx*dx+dy*dy;
+        double ex = px-bx[i], ey = py-by[i];
+        double cross = wx*dy-wy*dx;
+        if(t <= 0) out[i] = wx*wx+wy*wy;
+        else if(t >= len2) out[i] = ex*ex+ey*ey;
+        else out[i] = cross*cross/len2;
+    }
+}
+
+void within_scalar(const double* ax, const double* ay, const double* bx, const double* by,
+                   size_t n, double px, double py, double tol2, uint8_t* hit)
+{
+    for(size_t i=0; i<n; i++)
+    {
+        double dx = bx[i]-ax[i], dy = by[i]-ay[i];
+        double wx = px-ax[i], wy = py-ay[i];
+        double t = wx*dx+wy*dy;
+        double len2 = dx*dx+dy*dy;
+        double ex = px-bx[i], ey = py-by[i];
+        double cross = wx*dy-wy*dx;
+        if(t <= 0) hit[i] = wx*wx+wy*wy < tol2;
+        else if(t >= len2) hit[i] = ex*ex+ey*ey < tol2;
+        else hit[i] = cross*cross < tol2*len2;
+    }
+}
+
+#ifdef SEGMENTBATCH_X86
+__attribute__((target("sse2")))
+void kernel_sse2(const double* ax, const double* ay, const double* bx, const double* by,
+                 size_t n, double px, double py, double* out)
+{
+    const __m128d vpx = _mm_set1_pd(px), vpy = _mm_set1_pd(py), zero = _mm_setzero_pd();
+    size_t i = 0;
+    for(; i+2 <= n; i+=2)
+    {
+        __m128d vax = _mm_loadu_pd(ax+i), vay = _mm_loadu_pd(ay+i);
+        __m128d vbx = _mm_loadu_pd(bx+i), vby = _mm_loadu_pd(by+i);
+        __m128d dx = _mm_sub_pd(vbx,vax), dy = _mm_sub_pd(vby,vay);
+        __m128d wx = _mm_sub_pd(vpx,vax), wy = _mm_sub_pd(vpy,vay);
+        __m128d t = _mm_add_pd(_mm_mul_pd(wx,dx),_mm_mul_pd(wy,dy));
+        __m128d len2 = _mm_add_pd(_mm_mul_pd(dx,dx),_mm_mul_pd(dy,dy));
+        __m128d ex = _mm_sub_pd(vpx,vbx), ey = _mm_sub_pd(vpy,vby);
+        __m128d cross = _mm_sub_pd(_mm_mul_pd(wx,dy),_mm_mul_pd(wy,dx));
+        __m128d da = _mm_add_pd(_mm_mul_pd(wx,wx),_mm_mul_pd(wy,wy));
+        __m128d db = _mm_add_pd(_mm_mul_pd(ex,ex),_mm_mul_pd(ey,ey));
+        __m128d dl = _mm_div_pd(_mm_mul_pd(cross,cross),len2);
+        // No blendv before SSE4.1: select with and/andnot/or
+        __m128d past_b = _mm_cmpge_pd(t,len2);
+        __m128d d = _mm_or_pd(_mm_and_pd(past_b,db),_mm_andnot_pd(past_b,dl));
+        __m128d before_a = _mm_cmple_pd(t,zero);
+        d = _mm_or_pd(_mm_and_pd(before_a,da),_mm_andnot_pd(before_a,d));
+        _mm_storeu_pd(out+i,d);
+    }
+    kernel_scalar(ax+i,ay+i,bx+i,by+i,n-i,px,py,out+i);
+}
+
+__attribute__((target("sse2")))
+void within_sse2(const double* ax, const double* ay, const double* bx, const double* by,
+                 size_t n, double px, double py, double tol2, uint8_t* hit)
+{
+    const __m128d vpx = _mm_set1_pd(px), vpy = _mm_set1_pd(py), zero = _mm_setzero_pd();
+    const __m128d vtol2 = _mm_set1_pd(tol2);
+    size_t i = 0;
+    for(; i+2 <= n; i+=2)
+    {
+        __m128d vax = _mm_loadu_pd(ax+i), vay = _mm_loadu_pd(ay+i);
+        __m128d vbx = _mm_loadu_pd(bx+i), vby = _mm_loadu_pd(by+i);
+        __m128d dx = _mm_sub_pd(vbx,vax), dy = _mm_sub_pd(vby,vay);
+        __m128d wx = _mm_sub_pd(vpx,vax), wy = _mm_sub_pd(vpy,vay);
+        __m128d t = _mm_add_pd(_mm_mul_pd(wx,dx),_mm_mul_pd(wy,dy));
+        __m128d len2 = _mm_add_pd(_mm_mul_pd(dx,dx),_mm_mul_pd(dy,dy));
+        __m128d ex = _mm_sub_pd(vpx,vbx), ey = _mm_sub_pd(vpy,vby);
+        __m128d cross = _mm_sub_pd(_mm_mul_pd(wx,dy),_mm_mul_pd(wy,dx));
+        __m128d ha = _mm_cmplt_pd(_mm_add_pd(_mm_mul_pd(wx,wx),_mm_mul_pd(wy,wy)),vtol2);
+        __m128d hb = _mm_cmplt_pd(_mm_add_pd(_mm_mul_pd(ex,ex),_mm_mul_pd(ey,ey)),vtol2);
+        __m128d hl = _mm_cmplt_pd(_mm_mul_pd(cross,cross),_mm_mul_pd(vtol2,len2));
+        __m128d past_b = _mm_cmpge_pd(t,len2);
+        __m128d h = _mm_or_pd(_mm_and_pd(past_b,hb),_mm_andnot_pd(past_b,hl));
+        __m128d before_a = _mm_cmple_pd(t,zero);
+        h = _mm_or_pd(_mm_and_pd(before_a,ha),_mm_andnot_pd(before_a,h));
+        int bits = _mm_movemask_pd(h);
+        hit[i] = bits & 1;
+        hit[i+1] = (bits >> 1) & 1;
+    }
+    within_scalar(ax+i,ay+i,bx+i,by+i,n-i,px,py,tol2,hit+i);
+}
+
+__attribute__((target("avx2")))
+void kernel_avx2(const double* ax, const double* ay, const double* bx, const double* by,
+                 size_t n, double px, double py, double* out)
+{
+    const __m256d vpx = _mm256_set1_pd(px), vpy = _mm256_set1_pd(py), zero = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i+4 <= n; i+=4)
+    {
+        __m256d vax = _mm256_loadu_pd(ax+i), vay = _mm256_loadu_pd(ay+i);
+        __m256d vbx = _mm256_loadu_pd(bx+i), vby = _mm256_loadu_pd(by+i);
+        __m256d dx = _mm256_sub_pd(vbx,vax), dy = _mm256_sub_pd(vby,vay);
+        __m256d wx = _mm256_sub_pd(vpx,vax), wy = _mm256_sub_pd(vpy,vay);
+        __m256d t = _mm256_add_pd(_mm256_mul_pd(wx,dx),_mm256_mul_pd(wy,dy));
+        __m256d len2 = _mm256_add_pd(_mm256_mul_pd(dx,dx),_mm256_mul_pd(dy,dy));
+        __m256d ex = _mm256_sub_pd(vpx,vbx), ey = _mm256_sub_pd(vpy,vby);
+        __m256d cross = _mm256_sub_pd(_mm256_mul_pd(wx,dy),_mm256_mul_pd(wy,dx));
+        __m256d da = _mm256_add_pd(_mm256_mul_pd(wx,wx),_mm256_mul_pd(wy,wy));
+        __m256d db = _mm256_add_pd(_mm256_mul_pd(ex,ex),_mm256_mul_pd(ey,ey));
+        __m256d dl = _mm256_div_pd(_mm256_mul_pd(cross,cross),len2);
+        __m256d d = _mm256_blendv_pd(dl,db,_mm256_cmp_pd(t,len2,_CMP_GE_OQ));
+        d = _mm256_blendv_pd(d,da,_mm256_cmp_pd(t,zero,_CMP_LE_OQ));
+        _mm256_storeu_pd(out+i,d);
+    }
+    kernel_scalar(ax+i,ay+i,bx+i,by+i,n-i,px,py,out+i);
+}
+
+__attribute__((target("avx2")))
+void within_avx2(const double* ax, const double* ay, const double* bx, const double* by,
+                 size_t n, double px, double py, double tol2, uint8_t* hit)
+{
+    const __m256d vpx = _mm256_set1_pd(px), vpy = _mm256_set1_pd(py), zero = _mm256_setzero_pd();
+    const __m256d vtol2 = _mm256_set1_pd(tol2);
+    size_t i = 0;
+    for(; i+4 <= n; i+=4)
+    {
+        __m256d vax = _mm256_loadu_pd(ax+i), vay = _mm256_loadu_pd(ay+i);
+        __m256d vbx = _mm256_loadu_pd(bx+i), vby = _mm256_loadu_pd(by+i);
+        __m256d dx = _mm256_sub_pd(vbx,vax), dy = _mm256_sub_pd(vby,vay);
+        __m256d wx = _mm256_sub_pd(vpx,vax), wy = _mm256_sub_pd(vpy,vay);
+        __m256d t = _mm256_add_pd(_mm256_mul_pd(wx,dx),_mm256_mul_pd(wy,dy));
+        __m256d len2 = _mm256_add_pd(_mm256_mul_pd(dx,dx),_mm256_mul_pd(dy,dy));
+        __m256d ex = _mm256_sub_pd(vpx,vbx), ey = _mm256_sub_pd(vpy,vby);
+        __m256d cross = _mm256_sub_pd(_mm256_mul_pd(wx,dy),_mm256_mul_pd(wy,dx));
+        __m256d ha = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(wx,wx),_mm256_mul_pd(wy,wy)),vtol2,_CMP_LT_OQ);
+        __m256d hb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(ex,ex),_mm256_mul_pd(ey,ey)),vtol2,_CMP_LT_OQ);
+        __m256d hl = _mm256_cmp_pd(_mm256_mul_pd(cross,cross),_mm256_mul_pd(vtol2,len2),_CMP_LT_OQ);
+        __m256d h = _mm256_blendv_pd(hl,hb,_mm256_cmp_pd(t,len2,_CMP_GE_OQ));
+        h = _mm256_blendv_pd(h,ha,_mm256_cmp_pd(t,zero,_CMP_LE_OQ));
+        int bits = _mm256_movemask_pd(h);
+        for(int k=0; k<4; k++) hit[i+k] = (bits >> k) & 1;
+    }
+    within_scalar(ax+i,ay+i,bx+i,by+i,n-i,px,py,tol2,hit+i);
+}
+#endif
+
+SegmentBatch::Isa detect_isa()
+{
+#ifdef SEGMENTBATCH_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return SegmentBatch::Isa::AVX2;
+    if(__builtin_cpu_supports("sse2")) return SegmentBatch::Isa::SSE2;
+#endif
+    return SegmentBatch::Isa::SCALAR;
+}
+
+Kernel kernel_for(SegmentBatch::Isa isa)
+{
+    switch(isa)
+    {
+#ifdef SEGMENTBATCH_X86
+    case SegmentBatch::Isa::AVX2: return kernel_avx2;
+    case SegmentBatch::Isa::SSE2: return kernel_sse2;
+#endif
+    default: return kernel_scalar;
+    }
+}
+
+WithinKernel within_kernel_for(SegmentBatch::Isa isa)
+{
+    switch(isa)
+    {
+#ifdef SEGMENTBATCH_X86
+    case SegmentBatch::Isa::AVX2: return within_avx2;
+    case SegmentBatch::Isa::SSE2: return within_sse2;
+#endif
+    default: return within_scalar;
+    }
+}
+
+struct Dispatch
+{
+    std::atomic<SegmentBatch::Isa> isa{SegmentBatch::best_isa()};
+    std::atomic<Kernel> kernel{kernel_for(SegmentBatch::best_isa())};
+    std::atomic<WithinKernel> within{within_kernel_for(SegmentBatch::best_isa())};
+};
+
+// Made on first use, so batches work during static initialization of other files
+Dispatch& dispatch()
+{
+    static Dispatch d;
+    return d;
+}
+}
+
+
+SegmentBatch::Isa SegmentBatch::best_isa()
+{
+    static const Isa best = detect_isa();
+    return best;
+}
+
+SegmentBatch::Isa SegmentBatch::isa()
+{
+    return dispatch().isa.load(std::memory_order_relaxed);
+}
+
+void SegmentBatch::set_isa(Isa isa)
+{
+    if(static_cast<int>(isa) > static_cast<int>(best_isa())) isa = best_isa();
+    Dispatch& d = dispatch();
+    d.isa.store(isa,std::memory_order_relaxed);
+    d.kernel.store(kernel_for(isa),std::memory_order_relaxed);
+    d.within.store(within_kernel_for(isa),std::memory_order_relaxed);
+}
+
+const char* SegmentBatch::isa_name(Isa isa)
+{
+    switch(isa)
+    {
+    case Isa::AVX2: return "avx2";
+    case Isa::SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+void SegmentBatch::clear()
+{
+    _ax.clear();
+    _ay.clear();
+    _bx.clear();
+    _by.clear();
+}
+
+void SegmentBatch::reserve(size_t n)
+{
+    _ax.reserve(n);
+    _ay.reserve(n);
+    _bx.reserve(n);
+    _by.reserve(n);
+}
+
+void SegmentBatch::push_back(Coordinate2 a, Coordinate2 b)
+{
+    _ax.push_back(a.x);
+    _ay.push_back(a.y);
+    _bx.push_back(b.x);
+    _by.push_back(b.y);
+}
+
+void SegmentBatch::distances_sq(Coordinate2 p, double* out) const
+{
+    Kernel kernel = dispatch().kernel.load(std::memory_order_relaxed);
+    kernel(_ax.data(),_ay.data(),_bx.data(),_by.data(),size(),p.x,p.y,out);
+}
+
+Estd::Vec<double> SegmentBatch::distances_sq(Coordinate2 p) const
+{
+    Estd::Vec<double> d(size());
+    distances_sq(p,d.data());
+    return d;
+}
+
+void SegmentBatch::_within(Coordinate2 p, double tol2, size_t begin, size_t n, uint8_t* hit) const
+{
+    WithinKernel kernel = dispatch().within.load(std::memory_order_relaxed);
+    kernel(_ax.data()+begin,_ay.data()+begin,_bx.data()+begin,_by.data()+begin,n,p.x,p.y,tol2,hit);
+}
+
+size_t SegmentBatch::first_within(Coordinate2 p, double tol) const
+{
+    uint8_t hit[BLOCK];
+    for(size_t begin=0; begin<size(); begin+=BLOCK)
+    {
+        size_t n = std::min(BLOCK,size()-begin);
+        _within(p,tol*tol,begin,n,hit);
+        if(auto* first = static_cast<const uint8_t*>(std::memchr(hit,1,n))) return begin+(first-hit);
+    }
+    return npos;
+}
+
+Estd::Vec<size_t> SegmentBatch::all_within(Coordinate2 p, double tol) const
+{
+    uint8_t hit[BLOCK];
+    Estd::Vec<size_t> hits;
+    for(size_t begin=0; begin<size(); begin+=BLOCK)
+    {
+        size_t n = std::min(BLOCK,size()-begin);
+        _within(p,tol*tol,begin,n,hit);
+        for(size_t i=0; i<n; i++)
+        {
+            if(hit[i]) hits.push_back(begin+i);
+        }
+    }
+    return hits;
+}
+
+size_t SegmentBatch::heap_bytes() const
+{
+    return Estd::heap_bytes(_ax)+Estd::heap_bytes(_ay)+Estd::heap_bytes(_bx)+Estd::heap_bytes(_by);
+}
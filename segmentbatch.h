@@ -0,0 +1,71 @@
+#ifndef SEGMENTBATCH_H
+#define SEGMENTBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "coordinate2.h"
+#include "utils.h"
+
+
+/* Squared distance from p to the segment a-b, without square roots. Compare it with
+ * tol*tol instead of comparing distance_from_line() with tol.
+ */
+inline double segment_distance_sq(Coordinate2 p, Coordinate2 a, Coordinate2 b)
+{
+    double dx = b.x-a.x, dy = b.y-a.y;
+    double wx = p.x-a.x, wy = p.y-a.y;
+    double t = wx*dx+wy*dy;                 // projection of p, times the length squared
+    if(t <= 0) return wx*wx+wy*wy;          // before a (and zero-length segments)
+    double len2 = dx*dx+dy*dy;
+    double ex = p.x-b.x, ey = p.y-b.y;
+    if(t >= len2) return ex*ex+ey*ey;       // past b
+    double cross = wx*dy-wy*dx;
+    return cross*cross/len2;
+}
+
+/* Point-to-segment distances for many segments at once.
+ *
+ * Usage: push_back() the segments, then first_within(p,tol) or all_within(p,tol)
+ * pick segments as distance_from_line(p,a,b) < tol would, comparing squares without
+ * square roots or divisions, and distances_sq() gives every squared distance (see
+ * segment_distance_sq()). The segments are stored as four coordinate arrays
+ * (structure of arrays), so the kernels run 4 segments at a time with AVX2 or 2
+ * with SSE2. The instruction set is picked at runtime from what the CPU supports;
+ * set_isa() forces a lower one, for tests and benchmarks. All of them take the same
+ * steps as segment_distance_sq(). Without GCC or Clang on x86, only the scalar
+ * kernel is built.
+ */
+class SegmentBatch
+{
+public:
+    enum class Isa {SCALAR, SSE2, AVX2};
+    static constexpr size_t npos = SIZE_MAX;
+
+    static Isa best_isa();                  // the best one this CPU supports
+    static Isa isa();                       // the one in use
+    static void set_isa(Isa isa);           // capped at best_isa()
+    static const char* isa_name(Isa isa);
+
+    void clear();
+    void reserve(size_t n);
+    void push_back(Coordinate2 a, Coordinate2 b);
+    size_t size() const {return _ax.size();}
+    bool empty() const {return _ax.empty();}
+
+    void distances_sq(Coordinate2 p, double* out) const;    // size() values
+    Estd::Vec<double> distances_sq(Coordinate2 p) const;
+    // Index of the first segment closer than `tol` to p, or npos
+    size_t first_within(Coordinate2 p, double tol) const;
+    // Indices of all segments closer than `tol` to p, in order
+    Estd::Vec<size_t> all_within(Coordinate2 p, double tol) const;
+
+    size_t heap_bytes() const;
+
+private:
+    std::vector<double> _ax,_ay,_bx,_by;
+    void _within(Coordinate2 p, double tol2, size_t begin, size_t n, uint8_t* hit) const;
+};
+
+
+#endif // SEGMENTBATCH_H
@@ -0,0 +1,538 @@
+#include "sessiontrace.h"
+#include "schematicfile.h"
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+using std::string;
+using Estd::Vec;
+using Wire = Schematic::Wire;
+using Segment = std::pair<Coordinate2,Coordinate2>;
+using Clock = std::chrono::steady_clock;
+
+constexpr char SessionTrace::MAGIC[8];
+
+namespace
+{
+
+// FNV-1a over the net names and the wires of each net
+class Digest
+{
+public:
+    uint64_t value = 1469598103934665603ull;
+    void add(const void* data, size_t size)
+    {
+        auto p = static_cast<const unsigned char*>(data);
+        for(size_t i=0; i<size; i++) value = (value ^ p[i]) * 1099511628211ull;
+    }
+};
+
+std::pair<uint64_t,size_t> net_digest(Schematic& sch)
+{
+    Digest d;
+    Vec<string> names = sch.get_all_netnames();
+    for(auto& name : names)
+    {
+        d.add(name.data(),name.size()+1);
+        for(auto& w : sch.select_net(name))
+        {
+            int32_t ids[2] = {w.first,w.second};
+            d.add(ids,sizeof(ids));
+        }
+    }
+    return {d.value,names.size()};
+}
+
+class TraceReader
+{
+public:
+    TraceReader(const char* data, size_t size) : _p{data},_end{data+size} {}
+    bool done() const {return _p == _end;}
+    uint8_t get_byte()
+    {
+        _check(1);
+        return static_cast<uint8_t>(*_p++);
+    }
+    uint64_t get_size()
+    {
+        uint64_t v = 0;
+        for(int shift=0; shift<64; shift+=7)
+        {
+            uint8_t b = get_byte();
+            v |= uint64_t(b & 0x7F) << shift;
+            if(!(b & 0x80)) return v;
+        }
+        _malformed();
+    }
+    int64_t get_int()
+    {
+        uint64_t z = get_size();
+        return static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+    }
+    uint64_t get_u64()
+    {
+        uint64_t v;
+        _check(sizeof(v));
+        std::memcpy(&v,_p,sizeof(v));
+        _p += sizeof(v);
+        return v;
+    }
+    double get_double()
+    {
+        double v;
+        _check(sizeof(v));
+        std::memcpy(&v,_p,sizeof(v));
+        _p += sizeof(v);
+        return v;
+    }
+    Coordinate2 get_coord()
+    {
+        double x = get_double();
+        double y = get_double();
+        return Coordinate2(x,y);
+    }
+    string get_string()
+    {
+        uint64_t size = get_size();
+        _check(size);
+        string s(_p,size);
+        _p += size;
+        return s;
+    }
+    Wire get_wire()
+    {
+        int first = static_cast<int>(get_int());
+        return {first,static_cast<int>(get_int())};
+    }
+    // Element count, checked against the bytes left
+    uint64_t get_count(size_t element_size)
+    {
+        uint64_t n = get_size();
+        if(n > static_cast<size_t>(_end-_p)/element_size) _malformed();
+        return n;
+    }
+
+private:
+    const char* _p;
+    const char* _end;
+    void _check(size_t n) const {if(static_cast<size_t>(_end-_p) < n) _malformed();}
+    [[noreturn]] static void _malformed() {throw std::runtime_error("Session trace is malformed.");}
+};
+
+} // namespace
+
+void SessionTrace::Histogram::add(double ns)
+{
+    int i = ns > 1 ? static_cast<int>(std::ceil(4*std::log2(ns))) : 0;
+    _buckets[std::min(i,BUCKETS-1)]++;
+    _count++;
+    _total += ns;
+    _max = std::max(_max,ns);
+}
+
+double SessionTrace::Histogram::bucket_limit(int i)
+{
+    return std::exp2(i/4.0);
+}
+
+double SessionTrace::Histogram::percentile(double p) const
+{
+    if(_count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p*_count));
+    uint64_t seen = 0;
+    for(int i=0; i<BUCKETS; i++)
+    {
+        seen += _buckets[i];
+        if(seen >= rank && seen > 0) return std::min(bucket_limit(i),_max);
+    }
+    return _max;
+}
+
+SessionTrace::SessionTrace(const string& path) : _path{path} {}
+
+SessionTrace::~SessionTrace()
+{
+    try {stop();}
+    catch(std::runtime_error&) {}  // nothing better to do in a destructor
+}
+
+/*
+ * Start recording `sch`: write the header and the starting state, then attach. The
+ * state is saved with SchematicFile to a temporary file and copied into the trace.
+ */
+void SessionTrace::start(Schematic& sch)
+{
+    stop();
+    if(sch._trace) sch._trace->stop();
+
+    string tmp = _path + ".tmp";
+    SchematicFile::save(sch,tmp);
+    std::ifstream in(tmp,std::ios::binary);
+    string initial((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+    in.close();
+    std::remove(tmp.c_str());
+
+    _file = std::fopen(_path.c_str(),"wb");
+    if(!_file) throw std::runtime_error("Could not open session trace.");
+    Header header{};
+    std::memcpy(header.magic,MAGIC,sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = SchematicFile::BYTE_ORDER_MARK;
+    header.initial_bytes = initial.size();
+    header.lazy = sch.lazy();
+    header.undo_limit = static_cast<uint32_t>(sch._undo_limit);
+    header.undo_depth = static_cast<uint32_t>(sch._undo.size());
+    header.redo_depth = static_cast<uint32_t>(sch._redo.size());
+    _pending.assign(reinterpret_cast<const char*>(&header),sizeof(header));
+    _pending += initial;
+    _flush();
+    _calls = 0;
+    _depth = 0;
+    _sch = &sch;
+    sch._trace = this;
+}
+
+void SessionTrace::stop()
+{
+    if(!_sch) return;
+    Schematic& sch = *_sch;
+    sch._trace = nullptr;
+    _sch = nullptr;
+    try {
+        auto digest = net_digest(sch);
+        _op(END);
+        _pending.append(reinterpret_cast<const char*>(&digest.first),sizeof(digest.first));
+        _put(static_cast<uint64_t>(digest.second));
+        _flush();
+    } catch(...) {_close(); throw;}
+    _close();
+}
+
+void SessionTrace::_flush()
+{
+    if(!_file) return;
+    if(std::fwrite(_pending.data(),1,_pending.size(),_file) != _pending.size())
+    {
+        throw std::runtime_error("Could not write session trace.");
+    }
+    _pending.clear();
+}
+
+void SessionTrace::_close()
+{
+    if(_file) std::fclose(_file);
+    _file = nullptr;
+    _pending.clear();
+}
+
+// End of an outer call: append its duration to the record
+void SessionTrace::_finish(Clock::time_point start)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-start).count();
+    _put(static_cast<uint64_t>(ns));
+    _calls++;
+}
+
+// Start of a record. Written out here and not in _finish(), which runs in a destructor.
+void SessionTrace::_op(Op op)
+{
+    if(_pending.size() >= (1<<20)) _flush();
+    _pending.push_back(static_cast<char>(op));
+}
+
+void SessionTrace::_put(uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        _pending.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    _pending.push_back(static_cast<char>(v));
+}
+
+void SessionTrace::_put_int(int64_t v) {_put((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));}
+
+void SessionTrace::_put(Coordinate2 p)
+{
+    _pending.append(reinterpret_cast<const char*>(&p.x),sizeof(p.x));
+    _pending.append(reinterpret_cast<const char*>(&p.y),sizeof(p.y));
+}
+
+void SessionTrace::_put(const string& s)
+{
+    _put(static_cast<uint64_t>(s.size()));
+    _pending.append(s);
+}
+
+void SessionTrace::_add_wire(Coordinate2 a, Coordinate2 b, bool traverse)
+{
+    _flag(ADD_WIRE,traverse);
+    _put(a);
+    _put(b);
+}
+
+void SessionTrace::_add_wires(const Vec<Segment>& segments, bool traverse)
+{
+    _flag(ADD_WIRES,traverse);
+    _put(static_cast<uint64_t>(segments.size()));
+    for(auto& s : segments)
+    {
+        _put(s.first);
+        _put(s.second);
+    }
+}
+
+void SessionTrace::_remove_wire(Wire w, bool traverse)
+{
+    _flag(REMOVE_WIRE,traverse);
+    _put_int(w.first);
+    _put_int(w.second);
+}
+
+void SessionTrace::_add_port(const Schematic::Port& port, bool traverse)
+{
+    _flag(ADD_PORT,traverse);
+    _put(port.first);
+    _put(port.second);
+}
+
+void SessionTrace::_remove_port(int pid, bool traverse)
+{
+    _flag(REMOVE_PORT,traverse);
+    _put_int(pid);
+}
+
+void SessionTrace::_remove_ports(const string& port_name, bool traverse)
+{
+    _flag(REMOVE_PORTS,traverse);
+    _put(port_name);
+}
+
+void SessionTrace::_flag(Op op, bool flag)
+{
+    _op(op);
+    _pending.push_back(flag ? 1 : 0);
+}
+
+void SessionTrace::_count(Op op, uint64_t n)
+{
+    _op(op);
+    _put(n);
+}
+
+void SessionTrace::_wire(Op op, Wire w)
+{
+    _op(op);
+    _put_int(w.first);
+    _put_int(w.second);
+}
+
+void SessionTrace::_point(Op op, Coordinate2 p)
+{
+    _op(op);
+    _put(p);
+}
+
+void SessionTrace::_name(Op op, const string& name)
+{
+    _op(op);
+    _put(name);
+}
+
+/*
+ * Replay a trace onto a fresh schematic loaded from its starting state, timing every
+ * call. Query results are thrown away; the final nets are checked against the
+ * digest at the end of the trace.
+ */
+SessionTrace::Report SessionTrace::replay(const string& path)
+{
+    std::ifstream in(path,std::ios::binary);
+    if(!in) throw std::runtime_error("Could not open session trace.");
+    string data((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+    Header header;
+    if(data.size() < sizeof(header)) throw std::runtime_error("Session trace is malformed.");
+    std::memcpy(&header,data.data(),sizeof(header));
+    if(std::memcmp(header.magic,MAGIC,sizeof(MAGIC)) != 0) throw std::runtime_error("Not a session trace.");
+    if(header.byte_order != SchematicFile::BYTE_ORDER_MARK) throw std::runtime_error("Session trace has another byte order.");
+    if(header.version != VERSION) throw std::runtime_error("Unsupported session trace version.");
+    if(header.initial_bytes > data.size()-sizeof(header)) throw std::runtime_error("Session trace is malformed.");
+
+    Schematic sch;
+    {
+        string tmp = path + ".replay.nms";
+        std::ofstream out(tmp,std::ios::binary | std::ios::trunc);
+        out.write(data.data()+sizeof(header),header.initial_bytes);
+        out.close();
+        if(!out) throw std::runtime_error("Could not write session trace state.");
+        try {SchematicFile::load(sch,tmp);}
+        catch(...) {std::remove(tmp.c_str()); throw;}
+        std::remove(tmp.c_str());
+    }
+    sch.set_undo_limit(header.undo_limit);
+    sch.set_lazy(header.lazy != 0);
+
+    Report report;
+    report.undo_depth = header.undo_depth;
+    report.redo_depth = header.redo_depth;
+    size_t start = sizeof(header)+header.initial_bytes;
+    TraceReader r(data.data()+start,data.size()-start);
+    while(!r.done())
+    {
+        Op op = static_cast<Op>(r.get_byte());
+        if(op == END)
+        {
+            uint64_t digest = r.get_u64();
+            size_t nets = r.get_size();
+            auto replayed = net_digest(sch);
+            report.complete = true;
+            report.nets = replayed.second;
+            report.nets_match = replayed.first == digest && replayed.second == nets;
+            break;
+        }
+        if(op == 0 || op > END) throw std::runtime_error("Session trace has an unknown call.");
+
+        // Read the arguments first, so that only the call is timed
+        bool flag = false;
+        Coordinate2 a, b;
+        Wire w;
+        string name;
+        Vec<Segment> segments;
+        uint64_t n = 0;
+        switch(op)
+        {
+        case ADD_WIRE: flag = r.get_byte(); a = r.get_coord(); b = r.get_coord(); break;
+        case ADD_WIRES:
+            flag = r.get_byte();
+            n = r.get_count(4*sizeof(double));
+            segments.reserve(n);
+            for(uint64_t i=0; i<n; i++)
+            {
+                Coordinate2 s1 = r.get_coord();
+                segments.push_back({s1,r.get_coord()});
+            }
+            break;
+        case REMOVE_WIRE: flag = r.get_byte(); w = r.get_wire(); break;
+        case ADD_PORT: flag = r.get_byte(); a = r.get_coord(); name = r.get_string(); break;
+        case REMOVE_PORT: flag = r.get_byte(); n = r.get_int(); break;
+        case REMOVE_PORTS: flag = r.get_byte(); name = r.get_string(); break;
+        case SET_LAZY: flag = r.get_byte(); break;
+        case SET_UNDO_LIMIT: n = r.get_size(); break;
+        case GET_NETNAME: case TRY_GET_NETNAME: w = r.get_wire(); break;
+        case SELECT_NET: case TRY_SELECT_NET: case SELECT_PORTS: name = r.get_string(); break;
+        case SELECT_NET_AT: case SELECT_WIRE: case SELECT_WIRES: case SELECT_PORT: a = r.get_coord(); break;
+        default: break;
+        }
+        double recorded = static_cast<double>(r.get_size());
+
+        auto t0 = Clock::now();
+        try {
+            switch(op)
+            {
+            case ADD_WIRE: sch.add_wire(a,b,flag); break;
+            case ADD_WIRES: sch.add_wires(segments,flag); break;
+            case REMOVE_WIRE: sch.remove_wire(w,flag); break;
+            case UPDATE_NETS: sch.update_nets(); break;
+            case SET_LAZY: sch.set_lazy(flag); break;
+            case ADD_PORT: sch.add_port_node({a,name},flag); break;
+            case REMOVE_PORT: sch.remove_port_node(static_cast<int>(static_cast<int64_t>(n)),flag); break;
+            case REMOVE_PORTS: sch.remove_port_nodes(name,flag); break;
+            case UNDO: sch.undo(); break;
+            case REDO: sch.redo(); break;
+            case SET_UNDO_LIMIT: sch.set_undo_limit(n); break;
+            case COMPACT: sch.compact(); break;
+            case GET_ALL_WIRES: sch.get_all_wires(); break;
+            case GET_ALL_NETNAMES: sch.get_all_netnames(); break;
+            case GET_NETNAME: sch.get_netname(w); break;
+            case SELECT_NET: sch.select_net(name); break;
+            case SELECT_NET_AT: sch.select_net(a); break;
+            case SELECT_WIRE: sch.select_wire(a); break;
+            case SELECT_WIRES: sch.select_wires(a); break;
+            case SELECT_PORT: sch.select_port_node(a); break;
+            case SELECT_PORTS: sch.select_port_nodes(name); break;
+            case SNAPSHOT: sch.snapshot(); break;
+            case TRY_GET_NETNAME: sch.try_get_netname(w); break;
+            case TRY_SELECT_NET: sch.try_select_net(name); break;
+            default: break;
+            }
+        } catch(std::exception&) {report.errors++;}
+        double ns = std::chrono::duration<double,std::nano>(Clock::now()-t0).count();
+        report.recorded[op].add(recorded);
+        report.replayed[op].add(ns);
+        report.calls++;
+    }
+    return report;
+}
+
+const char* SessionTrace::op_name(Op op)
+{
+    switch(op)
+    {
+    case ADD_WIRE: return "add_wire";
+    case ADD_WIRES: return "add_wires";
+    case REMOVE_WIRE: return "remove_wire";
+    case UPDATE_NETS: return "update_nets";
+    case SET_LAZY: return "set_lazy";
+    case ADD_PORT: return "add_port_node";
+    case REMOVE_PORT: return "remove_port_node";
+    case REMOVE_PORTS: return "remove_port_nodes";
+    case UNDO: return "undo";
+    case REDO: return "redo";
+    case SET_UNDO_LIMIT: return "set_undo_limit";
+    case COMPACT: return "compact";
+    case GET_ALL_WIRES: return "get_all_wires";
+    case GET_ALL_NETNAMES: return "get_all_netnames";
+    case GET_NETNAME: return "get_netname";
+    case SELECT_NET: return "select_net";
+    case SELECT_NET_AT: return "select_net(p)";
+    case SELECT_WIRE: return "select_wire";
+    case SELECT_WIRES: return "select_wires";
+    case SELECT_PORT: return "select_port_node";
+    case SELECT_PORTS: return "select_port_nodes";
+    case SNAPSHOT: return "snapshot";
+    case TRY_GET_NETNAME: return "try_get_netname";
+    case TRY_SELECT_NET: return "try_select_net";
+    default: return "?";
+    }
+}
+
+// Human readable latency summary per call type, in microseconds
+void SessionTrace::print(const Report& report, std::ostream& out, bool histograms)
+{
+    auto us = [](double ns) {return ns*1e-3;};
+    out << std::fixed << std::setprecision(1);
+    out << "calls " << report.calls << ", errors " << report.errors << ", ";
+    if(!report.complete) out << "no end of trace, nets not checked\n";
+    else out << report.nets << " nets, " << (report.nets_match ? "final nets match" : "FINAL NETS DIFFER") << "\n";
+    if(report.undo_depth > 0 || report.redo_depth > 0)
+    {
+        out << "recorded with " << report.undo_depth << " undo and " << report.redo_depth
+            << " redo steps of history, which the replay does not have\n";
+    }
+    out << std::left << std::setw(18) << "call" << std::right << std::setw(10) << "count"
+        << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "max us"
+        << std::setw(16) << "recorded p99" << std::setw(16) << "recorded max" << "\n";
+    for(int op=1; op<OP_COUNT; op++)
+    {
+        const Histogram& h = report.replayed[op];
+        const Histogram& rec = report.recorded[op];
+        if(h.count() == 0) continue;
+        out << std::left << std::setw(18) << op_name(static_cast<Op>(op)) << std::right
+            << std::setw(10) << h.count() << std::setw(12) << us(h.percentile(0.5))
+            << std::setw(12) << us(h.percentile(0.99)) << std::setw(12) << us(h.max())
+            << std::setw(16) << us(rec.percentile(0.99)) << std::setw(16) << us(rec.max()) << "\n";
+        if(!histograms) continue;
+        // One row per power of two
+        for(int p=0; p<Histogram::BUCKETS/4; p++)
+        {
+            uint64_t count = 0;
+            for(int i=4*p; i<4*p+4; i++) count += h.bucket(i);
+            if(count == 0) continue;
+            int bar = static_cast<int>(std::ceil(40.0*count/h.count()));
+            out << "    <= " << std::setw(12) << us(Histogram::bucket_limit(4*p+3)) << " us "
+                << std::setw(10) << count << " " << string(bar,'#') << "\n";
+        }
+    }
+}
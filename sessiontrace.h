@@ -0,0 +1,167 @@
+#ifndef SESSIONTRACE_H
+#define SESSIONTRACE_H
+
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <array>
+#include <ostream>
+#include "schematic.h"
+
+
+/* Recorder and replayer for editing sessions.
+ *
+ * Usage: SessionTrace trace(path); trace.start(sch) saves the state of `sch` into the
+ * trace and from then on appends every public Schematic call made on it (edits and
+ * queries, with their arguments) and how long the call took. stop() adds a digest of
+ * the final nets. Calls made by the schematic itself (e.g. the update_nets() inside
+ * add_wire()) are part of the outer call and not recorded on their own.
+ *
+ * SessionTrace::replay(path) loads the saved state, makes the same calls again and
+ * reports a latency histogram per call type, for the recorded and the replayed
+ * calls, and whether the final nets match. Calls that threw when recorded throw
+ * again and are counted as errors. A trace without an end (the recorder was not
+ * stopped) replays as far as it goes, without the check.
+ *
+ * start() resolves the nets of `sch`, so that the replay starts from the same state;
+ * stop() resolves the nets again for the digest. The undo history is not part of
+ * the saved state: start() keeps it and records its depth, and on replay an undo()
+ * or redo() reaching into it does nothing (see Report::undo_depth). A trace
+ * follows one schematic at a time, stop() or destroy it before the schematic. The
+ * trace is not thread-safe: record the thread that edits the schematic. Errors
+ * writing or reading the trace throw std::runtime_error.
+ *
+ * Trace layout (native byte order): Header, a SchematicFile of the starting state
+ * (initial_bytes long), then records of
+ *   uint8 Op, arguments, varint duration in ns
+ * where ints are zigzag varints, sizes are varints, coordinates are two doubles and
+ * strings are a varint size and the bytes. END has the net digest and net count.
+ */
+class SessionTrace
+{
+public:
+    static constexpr char MAGIC[8] = {'N','M','T','R','A','C','E','\0'};
+    static constexpr uint32_t VERSION = 2;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t initial_bytes;     // size of the saved starting state
+        uint32_t lazy;
+        uint32_t undo_limit;
+        uint32_t undo_depth;        // undo and redo steps `sch` had at start()
+        uint32_t redo_depth;
+    };
+    enum Op : uint8_t {ADD_WIRE=1, ADD_WIRES, REMOVE_WIRE, UPDATE_NETS, SET_LAZY, ADD_PORT,
+                       REMOVE_PORT, REMOVE_PORTS, UNDO, REDO, SET_UNDO_LIMIT, COMPACT,
+                       GET_ALL_WIRES, GET_ALL_NETNAMES, GET_NETNAME, SELECT_NET, SELECT_NET_AT,
+                       SELECT_WIRE, SELECT_WIRES, SELECT_PORT, SELECT_PORTS, SNAPSHOT,
+                       TRY_GET_NETNAME, TRY_SELECT_NET, END, OP_COUNT};
+
+    // Latencies in buckets of a quarter power of two, from 1 ns to about 18 minutes
+    class Histogram
+    {
+    public:
+        static constexpr int BUCKETS = 4*40;
+        void add(double ns);
+        uint64_t count() const {return _count;}
+        double total() const {return _total;}
+        double max() const {return _max;}
+        double percentile(double p) const;        // upper bound of the bucket
+        uint64_t bucket(int i) const {return _buckets[i];}
+        static double bucket_limit(int i);        // upper bound of bucket i
+    private:
+        std::array<uint64_t,BUCKETS> _buckets{};
+        uint64_t _count = 0;
+        double _total = 0;
+        double _max = 0;
+    };
+
+    struct Report
+    {
+        std::array<Histogram,OP_COUNT> recorded;
+        std::array<Histogram,OP_COUNT> replayed;
+        uint64_t calls = 0;
+        uint64_t errors = 0;        // calls that threw
+        bool complete = false;      // the trace has an end
+        bool nets_match = false;    // final nets are the recorded ones (if complete)
+        size_t nets = 0;
+        size_t undo_depth = 0;      // undo history of the recorded schematic, not replayed
+        size_t redo_depth = 0;
+    };
+
+    SessionTrace(const std::string& path);
+    ~SessionTrace();
+    SessionTrace(const SessionTrace&) = delete;
+    SessionTrace& operator=(const SessionTrace&) = delete;
+
+    void start(Schematic& sch);
+    void stop();
+    uint64_t calls() const {return _calls;}
+
+    static Report replay(const std::string& path);
+    static void print(const Report& report, std::ostream& out, bool histograms=true);
+    static const char* op_name(Op op);
+
+    // Guards one public Schematic call, see Schematic's hooks
+    class Call
+    {
+    public:
+        explicit Call(SessionTrace* trace) : _trace{trace},_outer{trace && trace->_depth++ == 0}
+        {
+            if(_outer) _start = std::chrono::steady_clock::now();
+        }
+        ~Call()
+        {
+            if(!_trace) return;
+            if(_outer) _trace->_finish(_start);
+            _trace->_depth--;
+        }
+        Call(const Call&) = delete;
+        Call& operator=(const Call&) = delete;
+        explicit operator bool() const {return _outer;}
+        SessionTrace* operator->() const {return _trace;}
+    private:
+        SessionTrace* _trace;
+        bool _outer;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+private:
+    friend class Schematic;
+    std::string _path;
+    Schematic* _sch = nullptr;
+    std::FILE* _file = nullptr;
+    std::string _pending;           // records not written yet
+    int _depth = 0;                 // nesting of Schematic calls
+    uint64_t _calls = 0;
+
+    void _flush();
+    void _close();
+    void _finish(std::chrono::steady_clock::time_point start);
+    void _op(Op op);
+    void _put(uint64_t v);
+    void _put_int(int64_t v);
+    void _put(Coordinate2 p);
+    void _put(const std::string& s);
+
+    // Called by Schematic at the start of each public call
+    void _add_wire(Coordinate2 a, Coordinate2 b, bool traverse);
+    void _add_wires(const Estd::Vec<std::pair<Coordinate2,Coordinate2>>& segments, bool traverse);
+    void _remove_wire(Schematic::Wire w, bool traverse);
+    void _add_port(const Schematic::Port& port, bool traverse);
+    void _remove_port(int pid, bool traverse);
+    void _remove_ports(const std::string& port_name, bool traverse);
+    void _flag(Op op, bool flag);
+    void _count(Op op, uint64_t n);
+    void _wire(Op op, Schematic::Wire w);
+    void _point(Op op, Coordinate2 p);
+    void _name(Op op, const std::string& name);
+    void _call(Op op) {_op(op);}
+};
+
+
+#endif // SESSIONTRACE_H
@@ -8,14 +8,30 @@
 #include <utility>
 #include <algorithm>
 #include <set>
+#include <cstdint>
+#include <atomic>
+#include <unordered_map>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+#include <climits>
+#include <optional>
 #include "utils.h"
+#include "threadpool.h"
 #include "coordinate2.h"
+#include "instrument.h"
+#include "memoryusage.h"
+#include "timeline.h"
+#include "segmentbatch.h"
 
 
 class GraphNode
 {
 private:
     int _id;
+    // Only the owning graph may renumber a node, see AbstractGraph::compact()
+    template<typename NodeT> friend class AbstractGraph;
+    void _set_id(int id) {_id = id;}
 public:
     GraphNode(int id): _id{id} {}
     int get_id() const {return _id;}
@@ -61,12 +77,301 @@ public:
         if((id >= 0)&&(id < _pool_size)) _free_ids.push(id);
         else throw std::out_of_range("Id returned to pool was not from pool originally.");
     }
+    // Forget all returned ids, the next id handed out will be `size`.
+    // Used after renumbering the ids in use to 0..size-1.
+    inline void reset(int size)
+    {
+        if(size < 0) throw std::out_of_range("Id pool size cannot be negative.");
+        _free_ids = std::queue<int>();
+        _pool_size = size;
+    }
+    // Take `id` out of the pool, e.g. to restore a deleted node with its old id.
+    // Returns false if `id` is already in use.
+    inline bool take(int id)
+    {
+        if(id < 0) throw std::out_of_range("Id taken from pool cannot be negative.");
+        while(_pool_size <= id) _free_ids.push(_pool_size++);
+        bool found = false;
+        std::queue<int> rest;
+        for(; !_free_ids.empty(); _free_ids.pop())
+        {
+            if(!found && _free_ids.front() == id) found = true;
+            else rest.push(_free_ids.front());
+        }
+        _free_ids = std::move(rest);
+        return found;
+    }
+    int size() const {return _pool_size;}
+    // Returned ids, in the order they will be handed out again
+    Estd::Vec<int> free_ids() const
+    {
+        Estd::Vec<int> ids;
+        std::queue<int> q = _free_ids;
+        for(; !q.empty(); q.pop()) ids.push_back(q.front());
+        return ids;
+    }
+    // Restore a pool saved with size() and free_ids()
+    void assign(int size, const Estd::Vec<int>& free_ids)
+    {
+        reset(size);
+        for(int id : free_ids) put_back(id);
+    }
+    size_t heap_bytes() const {return Estd::heap_bytes(_free_ids);}
 private:
     std::queue<int> _free_ids;
     int _pool_size;
 };
 
 
+// Heap bytes of a graph by structure, see AbstractGraph::memory_usage()
+struct GraphMemory
+{
+    size_t nodes = 0;           // node list and the nodes
+    size_t node_index = 0;      // node id -> position in the node list
+    size_t adjacency = 0;       // adjacency lists
+    size_t trees = 0;           // spanning trees and node id -> tree id
+    size_t id_pool = 0;         // returned ids
+    size_t total() const {return nodes+node_index+adjacency+trees+id_pool;}
+};
+
+
+/*
+ * Read-only adjacency of a frozen graph, compressed.
+ * Nodes are numbered by ascending id, and each adjacency list is stored sorted as
+ * varint deltas: the first adjacent node relative to the node itself (zigzag), each
+ * next one relative to the one before. Lists are decoded front to back with
+ * for_each_adjacent(), which is all a traversal needs. Node ids are not stored if
+ * they are 0..N-1 (as after AbstractGraph::compact()).
+ *
+ * Queries taking ids throw std::invalid_argument for ids that are not in the graph.
+ * Trees from get_spanning_trees() come in order of their lowest id and list their
+ * nodes in DFS preorder, taking adjacent nodes in ascending id order.
+ */
+class CompressedAdjacency
+{
+public:
+    CompressedAdjacency() : _offsets{0} {}
+    explicit CompressedAdjacency(const std::map<int,Estd::Vec<int>>& adjacency)
+    {
+        const int n = adjacency.size();
+        bool identity = adjacency.empty() || adjacency.rbegin()->first == n-1;
+        if(!identity) for(auto& pair : adjacency) _ids.push_back(pair.first);
+        _offsets.reserve(adjacency.size()+1);
+        _offsets.push_back(0);
+        std::vector<int> adj;
+        int i = 0;
+        for(auto& pair : adjacency)
+        {
+            adj.clear();
+            for(int id : pair.second)
+            {
+                int k = identity ? (id >= 0 && id < n ? id : -1) : _index(id);
+                if(k < 0) throw std::invalid_argument("Adjacent id is not in the graph.");
+                adj.push_back(k);
+            }
+            std::sort(adj.begin(),adj.end());
+            adj.erase(std::unique(adj.begin(),adj.end()),adj.end());
+            for(size_t k=0; k<adj.size(); k++)
+            {
+                if(k == 0)
+                {
+                    int64_t d = static_cast<int64_t>(adj[0]) - i;
+                    _put(static_cast<uint64_t>(d < 0 ? -2*d-1 : 2*d));
+                }
+                else _put(adj[k]-adj[k-1]-1);
+            }
+            _edges += adj.size();
+            if(_data.size() > UINT32_MAX) throw std::length_error("Graph too large to compress.");
+            _offsets.push_back(_data.size());
+            i++;
+        }
+        _edges /= 2;
+        _data.shrink_to_fit();
+    }
+
+    size_t size() const {return _offsets.size()-1;}
+    size_t edge_count() const {return _edges;}
+    bool contains(int id) const {return _index(id) >= 0;}
+    int get_id(size_t index) const {return _ids.empty() ? static_cast<int>(index) : _ids[index];}
+
+    // Call f(index) for each adjacent node of the node at `index`, in ascending order
+    template<typename F>
+    void for_each_adjacent(size_t index, F f) const
+    {
+        Cursor c = _cursor(index);
+        size_t k;
+        while(_next(c,k)) f(k);
+    }
+
+    size_t degree(int id) const
+    {
+        size_t i = _checked_index(id);
+        size_t n = 0;
+        for(size_t b=_offsets[i]; b<_offsets[i+1]; b++) n += (_data[b] & 0x80) == 0;  // one per varint
+        return n;
+    }
+    Estd::Vec<int> get_adjacent(int id) const
+    {
+        Estd::Vec<int> adj;
+        for_each_adjacent(_checked_index(id),[&](size_t k) {adj.push_back(get_id(k));});
+        return adj;
+    }
+    bool adjacent(int id1, int id2) const
+    {
+        Cursor c = _cursor(_checked_index(id1));
+        size_t j = _checked_index(id2);
+        size_t k;
+        while(_next(c,k))
+        {
+            if(k >= j) return k == j;  // sorted
+        }
+        return false;
+    }
+    // Nodes reachable from `id` (including itself), in ascending id order
+    Estd::Vec<int> get_reachable(int id) const
+    {
+        std::vector<char> visited(size(),0);
+        std::vector<size_t> tree;
+        _dfs_preorder(_checked_index(id),visited,tree);
+        std::sort(tree.begin(),tree.end());
+        Estd::Vec<int> ids(tree.size());
+        for(size_t k=0; k<tree.size(); k++) ids[k] = get_id(tree[k]);
+        return ids;
+    }
+    bool reachable(int id1, int id2) const
+    {
+        size_t i = _checked_index(id1);
+        size_t j = _checked_index(id2);
+        if(i == j) return true;
+        // Search from both ends at once, so a small tree finishes early
+        std::vector<char> seen(size(),0);
+        std::vector<size_t> front[2] = {{i},{j}};
+        seen[i] = 1;
+        seen[j] = 2;
+        while(!front[0].empty() && !front[1].empty())
+        {
+            int side = front[0].size() <= front[1].size() ? 0 : 1;
+            std::vector<size_t> next;
+            bool met = false;
+            for(size_t u : front[side])
+            {
+                for_each_adjacent(u,[&](size_t v) {
+                    if(seen[v] == side+1) return;
+                    if(seen[v] != 0) {met = true; return;}
+                    seen[v] = side+1;
+                    next.push_back(v);
+                });
+                if(met) return true;
+            }
+            front[side] = std::move(next);
+        }
+        return false;
+    }
+    Estd::Vec<Estd::Vec<int>> get_spanning_trees() const
+    {
+        Estd::Vec<Estd::Vec<int>> trees;
+        std::vector<char> visited(size(),0);
+        std::vector<size_t> tree;
+        for(size_t i=0; i<size(); i++)
+        {
+            if(visited[i]) continue;
+            tree.clear();
+            _dfs_preorder(i,visited,tree);
+            Estd::Vec<int> ids(tree.size());
+            for(size_t k=0; k<tree.size(); k++) ids[k] = get_id(tree[k]);
+            trees.push_back(std::move(ids));
+        }
+        return trees;
+    }
+
+    // Bytes held, not counting sizeof(*this)
+    size_t memory_usage() const
+    {
+        return _ids.capacity()*sizeof(int) + _offsets.capacity()*sizeof(uint32_t) + _data.capacity();
+    }
+
+private:
+    std::vector<int> _ids;              // index -> id, empty if ids are 0..N-1
+    std::vector<uint32_t> _offsets;     // adjacency of index i is _data[_offsets[i].._offsets[i+1])
+    std::vector<uint8_t> _data;
+    size_t _edges = 0;
+
+    int _index(int id) const
+    {
+        if(_ids.empty()) return (id >= 0 && id < static_cast<int>(size())) ? id : -1;
+        auto itr = std::lower_bound(_ids.begin(),_ids.end(),id);
+        return (itr != _ids.end() && *itr == id) ? static_cast<int>(itr-_ids.begin()) : -1;
+    }
+    size_t _checked_index(int id) const
+    {
+        int i = _index(id);
+        if(i < 0) throw std::invalid_argument("Supplied id is not in the graph.");
+        return i;
+    }
+    void _put(uint64_t v)
+    {
+        while(v >= 0x80)
+        {
+            _data.push_back(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+        }
+        _data.push_back(static_cast<uint8_t>(v));
+    }
+    static uint64_t _get(const uint8_t*& p)
+    {
+        uint64_t v = *p & 0x7F;
+        for(int shift=7; *p++ & 0x80; shift+=7) v |= static_cast<uint64_t>(*p & 0x7F) << shift;
+        return v;
+    }
+    // Decoding position in one adjacency list
+    struct Cursor
+    {
+        const uint8_t* p;
+        const uint8_t* end;
+        int64_t k;          // last adjacent node, or the node itself before the first
+        bool first;
+    };
+    Cursor _cursor(size_t index) const
+    {
+        return {_data.data()+_offsets[index],_data.data()+_offsets[index+1],static_cast<int64_t>(index),true};
+    }
+    static bool _next(Cursor& c, size_t& k)
+    {
+        if(c.p == c.end) return false;
+        uint64_t v = _get(c.p);
+        if(c.first) c.k += (v & 1) ? -static_cast<int64_t>(v >> 1)-1 : static_cast<int64_t>(v >> 1);
+        else c.k += static_cast<int64_t>(v) + 1;
+        c.first = false;
+        k = static_cast<size_t>(c.k);
+        return true;
+    }
+    // Append the DFS preorder of the tree rooted at `root` to `tree`
+    void _dfs_preorder(size_t root, std::vector<char>& visited, std::vector<size_t>& tree) const
+    {
+        std::vector<Cursor> parents{_cursor(root)};
+        visited[root] = 1;
+        tree.push_back(root);
+        while(!parents.empty())
+        {
+            size_t next;
+            bool found = false;
+            while(_next(parents.back(),next))
+            {
+                if(!visited[next]) {found = true; break;}
+            }
+            if(!found)
+            {
+                parents.pop_back();
+                continue;
+            }
+            visited[next] = 1;
+            tree.push_back(next);
+            parents.push_back(_cursor(next));
+        }
+    }
+};
+
+
 /* AbstractGraph manages a collection of Nodes and their connections in an
  * adjacency list.
  *
@@ -78,6 +383,15 @@ private:
  *
  * Internally, each id has a Estd::Vector of adjacent nodes (an adjacency list) which
  * is updated to reflect the current state of the graph.
+ *
+ * Two version counters let callers cache query results. geometry_version() changes
+ * whenever nodes or edges are added or removed. structure_version() also changes
+ * when nodes are renumbered by compact(). Both only ever increase.
+ *
+ * With set_journal(), every primitive change (node added or deleted, edge connected
+ * or disconnected) is appended to a journal, and replay() applies or reverts an
+ * entry. Deleting a node records its edges first, so a journal can be undone by
+ * replaying it backwards. compact() is not recorded.
  */
 template<typename NodeT>
 class AbstractGraph
@@ -117,6 +431,40 @@ public:
     // Get info, traversal required
     virtual bool reachable(int id1,int id2,bool force_traverse=false) {return _are_nodes_reachable(id1,id2,force_traverse);}
     virtual Estd::Vec<int> get_reachable(int id,bool force_traverse=false) {return _get_reachable_nodes(id,force_traverse);}
+
+    // As above, but a miss (an id not in the graph) gives nullptr or std::nullopt
+    const Estd::Vec<int>* try_get_adjacent(int id) const
+    {
+        auto itr = _adjacent.find(id);
+        return itr == _adjacent.end() ? nullptr : &itr->second;
+    }
+    std::optional<bool> try_adjacent(int id1,int id2) const
+    {
+        const Estd::Vec<int>* adj = try_get_adjacent(id1);
+        if(!adj || !_has_node(id2)) return std::nullopt;
+        return find(adj->begin(),adj->end(),id2) != adj->end();
+    }
+    std::optional<bool> try_reachable(int id1,int id2,bool force_traverse=false)
+    {
+        if(force_traverse || _node_tree_id.empty()) _traverse_graph();
+        auto itr1 = _node_tree_id.find(id1);
+        auto itr2 = _node_tree_id.find(id2);
+        if(itr1 == _node_tree_id.end() || itr2 == _node_tree_id.end()) return std::nullopt;
+        return itr1->second == itr2->second;
+    }
+    std::optional<Estd::Vec<int>> try_get_reachable(int id,bool force_traverse=false)
+    {
+        if(force_traverse) _traverse_graph();
+        if(!_has_node(id)) return std::nullopt;
+        auto itr = _node_tree_id.find(id);
+        if(itr == _node_tree_id.end()) return std::nullopt;
+        Estd::Vec<int> reachables;
+        for(auto& pair : _node_tree_id)
+        {
+            if(pair.second == itr->second) reachables.push_back(pair.first);
+        }
+        return reachables;
+    }
     virtual Estd::Vec<Estd::Vec<int>> get_spanning_trees(bool force_traverse=false)
     {
         using Estd::Vec;
@@ -129,16 +477,100 @@ public:
 
     // Graph traversal, depth-first search
     virtual void traverse_graph() {_traverse_graph();}
+
+    // Renumber nodes densely, see _compact_ids()
+    virtual std::map<int,int> compact() {return _compact_ids();}
+
+    // Traverse on a thread pool (default: the shared one) from `min_nodes` nodes up
+    void set_parallel_traversal(size_t min_nodes, Estd::ThreadPool* pool=nullptr)
+    {
+        _parallel_min_nodes = min_nodes;
+        _pool = pool;
+    }
+    size_t parallel_traversal_min_nodes() const {return _parallel_min_nodes;}
+
+    uint64_t structure_version() const {return _structure_version;}
+    uint64_t geometry_version() const {return _geometry_version;}
     virtual Estd::Vec<std::pair<int,int>> get_all_edges() {return _get_edge_list();}
 
-    const Estd::Vec<int>& get_adjacent(int id)
+    // Hot path counters, see instrument.h
+    const GraphStats& stats() const {return _stats;}
+    void reset_stats() {_stats = GraphStats();}
+
+    // Heap bytes by structure, see memoryusage.h for what is exact and what is estimated
+    GraphMemory memory_usage() const
     {
-        try{
-            return _adjacent.at(id);
-        }catch (std::out_of_range)
+        GraphMemory m;
+        m.nodes = Estd::heap_bytes(_nodes);
+        m.node_index = Estd::heap_bytes(_node_slot);
+        m.adjacency = Estd::heap_bytes(_adjacent);
+        m.trees = Estd::heap_bytes(_trees)+Estd::heap_bytes(_node_tree_id);
+        m.id_pool = Estd::heap_bytes(_idpool);
+        return m;
+    }
+
+    // Adjacency lists as flat arrays (CSR), with nodes indexed by position in the node list
+    struct DenseAdjacency
+    {
+        std::vector<int> ids;       // index -> node id
+        std::vector<int> index;     // node id -> index, -1 if not in the graph
+        std::vector<int> offsets;   // adjacent nodes of i are targets[offsets[i]..offsets[i+1])
+        std::vector<int> targets;   // adjacent node indices, -1 if not in the graph
+    };
+    DenseAdjacency get_dense_adjacency() const {return _dense_adjacency();}
+    CompressedAdjacency get_compressed_adjacency() const {return CompressedAdjacency(_adjacent);}
+    const IdPool& get_id_pool() const {return _idpool;}
+
+    // One primitive change, see set_journal()
+    struct JournalEntry
+    {
+        enum Type {ADD_NODE, DELETE_NODE, CONNECT, DISCONNECT};
+        Type type;
+        int id1;                                // node id, or first end of the edge
+        int id2;                                // second end of the edge
+        int index;                              // position in the node list (node entries)
+        std::shared_ptr<const NodeT> node;      // copy of the node (node entries)
+        size_t heap_bytes() const {return Estd::heap_bytes(node);}
+    };
+    // Record changes in `journal` (nullptr to stop recording)
+    void set_journal(Estd::Vec<JournalEntry>* journal) {_journal = journal;}
+    // Apply `entry`, or revert it if `inverse`. Replaying is not recorded.
+    void replay(const JournalEntry& entry, bool inverse, bool traverse=true)
+    {
+        Estd::Vec<JournalEntry>* journal = _journal;
+        _journal = nullptr;
+        bool add = (entry.type == JournalEntry::ADD_NODE) != inverse;
+        bool connect = (entry.type == JournalEntry::CONNECT) != inverse;
+        switch(entry.type)
         {
-            throw std::invalid_argument("Supplied id1 is not in the graph.");
+        case JournalEntry::ADD_NODE:
+        case JournalEntry::DELETE_NODE:
+            if(add)
+            {
+                if(!_idpool.take(entry.id1)) throw std::invalid_argument("Node id is already in the graph.");
+                int index = std::min<int>(entry.index,_nodes.size());
+                _nodes.insert(_nodes.begin()+index,std::make_unique<NodeT>(*entry.node));
+                _index_nodes(index);
+                _adjacent.insert(std::pair(entry.id1,Estd::Vec<int>{}));
+                _bump_versions();
+                if(traverse) _traverse_graph();
+            }
+            else _delete_node(entry.id1,traverse);
+            break;
+        case JournalEntry::CONNECT:
+        case JournalEntry::DISCONNECT:
+            if(connect) _connect_nodes(entry.id1,entry.id2,traverse);
+            else _disconnect_nodes(entry.id1,entry.id2,traverse);
+            break;
         }
+        _journal = journal;
+    }
+
+    const Estd::Vec<int>& get_adjacent(int id)
+    {
+        const Estd::Vec<int>* adj = try_get_adjacent(id);
+        if(!adj) throw std::invalid_argument("Supplied id1 is not in the graph.");
+        return *adj;
     }
     virtual std::map<int,Estd::Vec<int>> get_adjacency_lists() const
     {
@@ -177,9 +609,12 @@ protected:
 
         // add to nodes
         _nodes.push_back(std::move(nn));
+        _index_nodes(_nodes.size()-1);
 
         // Create a new entry in `adjacent` with an empty list
         _adjacent.insert(std::pair(nodeid,Estd::Vec<int>{}));
+        _bump_versions();
+        _record(JournalEntry::ADD_NODE,nodeid,-1,_nodes.size()-1);
 
         if(traverse) _traverse_graph();
 
@@ -194,9 +629,12 @@ protected:
 
         // add to nodes
         _nodes.push_back(std::move(nn));
+        _index_nodes(_nodes.size()-1);
 
         // Create a new entry in `adjacent` with an empty list
         _adjacent.insert(std::pair(nodeid,Estd::Vec<int>{}));
+        _bump_versions();
+        _record(JournalEntry::ADD_NODE,nodeid,-1,_nodes.size()-1);
 
         if(traverse) _traverse_graph();
     }
@@ -216,6 +654,8 @@ protected:
         // Connect
         _adjacent[id1].push_back(id2);
         _adjacent[id2].push_back(id1);
+        _bump_versions();
+        _record(JournalEntry::CONNECT,id1,id2);
 
         if(traverse) _traverse_graph();
     }
@@ -235,34 +675,32 @@ protected:
         // Update id2 list (if not found, do nothing)
         auto p2 = find(_adjacent[id2].begin(),_adjacent[id2].end(),id1);
         if(p2 != _adjacent[id2].end()) _adjacent[id2].erase(p2);
+        _bump_versions();
+        _record(JournalEntry::DISCONNECT,id1,id2);
 
         if(traverse) _traverse_graph();
     }
     void _delete_node(int id, bool traverse)
     {
-        try {  // Checks that id is in graph, throws invalid_argument otherwise
-            // For each node in the adjacency list `_adjacent[id]`, call disconnect_vertices()
-            Estd::Vec<int> adj_id = _adjacent.at(id);  // Copy this so we don't modify while looping
-            for(auto id_other : adj_id)
-            {
-                _disconnect_nodes(id,id_other,false);
-            }
-        } catch (std::out_of_range) {
-            throw std::invalid_argument("Supplied id is not in the graph.");
+        // For each node in the adjacency list `_adjacent[id]`, call disconnect_vertices()
+        const Estd::Vec<int>* adj = try_get_adjacent(id);
+        if(!adj) throw std::invalid_argument("Supplied id is not in the graph.");
+        Estd::Vec<int> adj_id = *adj;  // Copy this so we don't modify while looping
+        for(auto id_other : adj_id)
+        {
+            _disconnect_nodes(id,id_other,false);
         }
 
         // Now that the node is isolated, we delete it from the list of vertices
-        for(auto itr = _nodes.begin(); itr != _nodes.end(); ++itr)
-        {
-            if((*itr)->get_id() == id)
-            {
-                _nodes.erase(itr);
-                break;
-            }
-        }
+        size_t index = _node_slot[id];
+        _record(JournalEntry::DELETE_NODE,id,-1,index);
+        _nodes.erase(_nodes.begin()+index);
+        _node_slot[id] = -1;
+        _index_nodes(index);
 
         // Remove the entry in `adjacent` for this id
         _adjacent.erase(id);
+        _bump_versions();
 
         // Retraverse if asked for
         if(traverse) _traverse_graph();
@@ -271,126 +709,282 @@ protected:
         _idpool.put_back(id);
     }
 
-    bool _are_nodes_reachable(int id1, int id2, bool force_traverse)
+    /* Delete isolated nodes, in the order given, with a single pass over the node
+     * list. The graph, id pool and journal end up as if _delete_node() had been
+     * called on each in turn. No traversal.
+     */
+    void _delete_isolated_nodes(const std::vector<int>& ids)
+    {
+        if(ids.empty()) return;
+        // Position of each node when it is deleted: its position now, less the nodes
+        // before it deleted earlier (counted with a Fenwick tree over positions)
+        std::vector<int> deleted(_nodes.size()+1,0);
+        size_t first = _nodes.size();
+        for(int id : ids)
+        {
+            if(!_has_node(id)) throw std::invalid_argument("Supplied id is not in the graph.");
+            if(!_adjacent[id].empty()) throw std::invalid_argument("Node is not isolated.");
+            size_t slot = _node_slot[id];
+            size_t earlier = 0;
+            for(size_t i=slot; i>0; i-=i&-i) earlier += deleted[i];
+            for(size_t i=slot+1; i<deleted.size(); i+=i&-i) deleted[i]++;
+            _record(JournalEntry::DELETE_NODE,id,-1,slot-earlier,_nodes[slot].get());
+            _adjacent.erase(id);
+            _idpool.put_back(id);
+            first = std::min(first,slot);
+        }
+        for(int id : ids) _node_slot[id] = -1;
+        _nodes.erase(std::remove_if(_nodes.begin()+first,_nodes.end(),[this](const GraphNodeP& n) {
+            return _node_slot[n->get_id()] < 0;}),_nodes.end());
+        _index_nodes(first);
+        _bump_versions();
+    }
+
+    /* Renumber all nodes to 0..N-1 in ascending order of their current id.
+     * Adjacency lists, spanning trees and the id pool are remapped in place, so
+     * no traversal is needed afterwards. Since the mapping preserves id order,
+     * sorted edge lists stay sorted and edges (id1<id2) keep their orientation.
+     * Returns the map of old id -> new id.
+     */
+    std::map<int,int> _compact_ids()
     {
-        if(force_traverse) _traverse_graph();  // Update node_tree_id
-        if(_node_tree_id.empty()) _traverse_graph();
-        try {
-            return _node_tree_id.at(id1) == _node_tree_id.at(id2);
-        } catch (std::out_of_range) {
-            throw std::invalid_argument("One of the supplied ids is not in the graph.");
+        std::map<int,int> id_map;
+        if(_adjacent.empty())
+        {
+            _idpool.reset(0);
+            return id_map;
+        }
+
+        // Already dense, nothing to renumber
+        if(_adjacent.rbegin()->first == static_cast<int>(_adjacent.size())-1)
+        {
+            for(auto& pair : _adjacent) id_map.emplace_hint(id_map.end(),pair.first,pair.first);
+            _idpool.reset(_adjacent.size());
+            return id_map;
+        }
+        _structure_version++;
+
+        // Table indexed by old id, -1 for ids not in use
+        Estd::Vec<int> table(_adjacent.rbegin()->first+1,-1);
+        int new_id = 0;
+        for(auto& pair : _adjacent)
+        {
+            table[pair.first] = new_id;
+            id_map.emplace_hint(id_map.end(),pair.first,new_id);
+            new_id++;
+        }
+
+        for(auto& n : _nodes) n->_set_id(table[n->get_id()]);
+        _node_slot.clear();
+        _index_nodes(0);
+
+        std::map<int,Estd::Vec<int>> adjacent;
+        for(auto& pair : _adjacent)
+        {
+            for(auto& adj : pair.second) adj = table[adj];
+            adjacent.emplace_hint(adjacent.end(),table[pair.first],std::move(pair.second));
+        }
+        _adjacent = std::move(adjacent);
+
+        // Trees may be stale if the last change was made with traverse=false,
+        // in which case they are rebuilt instead of remapped
+        bool stale = _node_tree_id.size() != _adjacent.size();
+        std::map<int,int> node_tree_id;
+        for(auto itr = _node_tree_id.begin(); !stale && itr != _node_tree_id.end(); ++itr)
+        {
+            if(itr->first >= table.size() || table[itr->first] < 0) stale = true;
+            else node_tree_id.emplace_hint(node_tree_id.end(),table[itr->first],itr->second);
         }
+        if(!stale)
+        {
+            _node_tree_id = std::move(node_tree_id);
+            for(auto& pair : _trees)
+            {
+                for(auto& n : pair.second) n = table[n];
+            }
+        }
+
+        _idpool.reset(new_id);
+        if(stale && !_node_tree_id.empty()) _traverse_graph();
+        return id_map;
     }
 
+    bool _are_nodes_reachable(int id1, int id2, bool force_traverse)
+    {
+        std::optional<bool> reachable = try_reachable(id1,id2,force_traverse);
+        if(!reachable) throw std::invalid_argument("One of the supplied ids is not in the graph.");
+        return *reachable;
+    }
+
+    /*
+     * Graph traversal by depth-first search.
+     * Trees are numbered in the order of their first node in _nodes, and each tree
+     * lists its nodes in DFS preorder, taking adjacent nodes in adjacency list order.
+     * Graphs with at least `_parallel_min_nodes` nodes are labelled on a thread pool
+     * instead (see _parallel_trees()), which gives exactly the same trees.
+     */
     void _traverse_graph()
     {
-        /* Set Up */
-        using CItr = typename Estd::Vec<GraphNodeP>::const_iterator;  // Iterators are safe, underlying vector won't change
+        NM_TIME(_stats.traversals);
+        DenseAdjacency dense = _dense_adjacency();
+        std::vector<std::vector<int>> trees;
+        if(dense.ids.size() >= _parallel_min_nodes)
+        {
+            // Only large graphs start the shared pool
+            Estd::ThreadPool& pool = _pool ? *_pool : Estd::ThreadPool::shared();
+            if(pool.size() > 1) trees = _parallel_trees(dense,pool);
+            else trees = _serial_trees(dense);
+        }
+        else trees = _serial_trees(dense);
 
-        Estd::Vec<int> parents;           // Stack of parents to return to
-        std::map<CItr,int> vert_dfs_id;   // New ids in traversal order
-        int dfs_id = 0;               // running id value, gets incremented
-        int tree_id = -1;             // Tree id for new spanning trees
+        // Publish as node id -> tree id and tree id -> node ids
         _node_tree_id.clear();        // remap node id -> tree id
         _trees.clear();               // rebuild trees
-
-        // Make bimap for id <-> iterator
-        std::map<CItr,int> vert_itr_id;   // iterator -> id
-        std::map<int,CItr> vert_id_itr;   // id -> iterator
-        std::map<int,bool> visited;       // Visited nodes map
-        for(auto vitr = _nodes.begin(); vitr != _nodes.end(); ++vitr)
-        {
-            vert_itr_id[vitr] = (*vitr)->get_id();
-            vert_id_itr[(*vitr)->get_id()] = vitr;
-            visited[(*vitr)->get_id()] = false;
-        }
-
-        /*
-         * Graph traversal by depth-first search
-         * Loop over all _nodes
-         * Mark the first node as visited, check if it has any adjacent _nodes
-         *   If adjacents, check if they are visited
-         *      For any unvisited adjacents, set them as the next node to visit, push current node into parent
-         *   If no more adjacents, pop parents
-         *      If no more parents, increment until we find an unvisited node
-         */
-        CItr current_itr = _nodes.cbegin();
-        CItr next_itr = _nodes.cend();
-        int current_id = 0;              // Current id, for convenience
-        while(current_itr != _nodes.cend())
-        {
-            // 1. Initialize
-            current_id = vert_itr_id[current_itr];
-            next_itr = _nodes.cend();
-            Estd::Vec<int> current_adjs = _adjacent[current_id];
-
-            // 2. Check: Is `parents` empty and all nodes are visited?
-            if(parents.empty())
+        std::vector<int> tree_of(dense.ids.size());
+        for(int t=0; t<trees.size(); t++)
+        {
+            Estd::Vec<int> members(trees[t].size());
+            for(int k=0; k<trees[t].size(); k++)
             {
-                // Check if all true (w/ lambda)
-                if(Estd::all_of(visited, [](const std::pair<int,bool>& r){return r.second;}))
-                {
-                    current_itr = _nodes.cend();
-                    continue;
-                }
-
-                // 2.b. If no parents and unvisited, start a new tree
-                if(!visited[current_id])
-                {
-                    tree_id++;  // This marks the start of a new tree
-                }
+                members[k] = dense.ids[trees[t][k]];
+                tree_of[trees[t][k]] = t;
             }
+            _trees.emplace_hint(_trees.end(),t,std::move(members));
+        }
+        for(int id=0; id<dense.index.size(); id++)
+        {
+            if(dense.index[id] >= 0) _node_tree_id.emplace_hint(_node_tree_id.end(),id,tree_of[dense.index[id]]);
+        }
+    }
+
+    DenseAdjacency _dense_adjacency() const
+    {
+        DenseAdjacency dense;
+        int n = _nodes.size();
+        int max_id = -1;
+        dense.ids.resize(n);
+        for(int i=0; i<n; i++)
+        {
+            dense.ids[i] = _nodes[i]->get_id();
+            max_id = std::max(max_id,dense.ids[i]);
+        }
+        dense.index.assign(max_id+1,-1);
+        for(int i=0; i<n; i++) dense.index[dense.ids[i]] = i;
+        auto index_of = [&dense,max_id](int id) {return (id >= 0 && id <= max_id) ? dense.index[id] : -1;};
+
+        dense.offsets.assign(n+1,0);
+        for(auto& pair : _adjacent)
+        {
+            int i = index_of(pair.first);
+            if(i >= 0) dense.offsets[i+1] = pair.second.size();
+        }
+        for(int i=0; i<n; i++) dense.offsets[i+1] += dense.offsets[i];
+        dense.targets.resize(dense.offsets[n]);
+        for(auto& pair : _adjacent)
+        {
+            int i = index_of(pair.first);
+            if(i < 0) continue;
+            int k = dense.offsets[i];
+            for(auto adj : pair.second) dense.targets[k++] = index_of(adj);
+        }
+        return dense;
+    }
 
-            // 3. Mark node as visited if not already
-            if(!visited[current_id])
+    // Append the DFS preorder of the tree rooted at `root` to `tree`
+    static void _dfs_preorder(const DenseAdjacency& dense, int root,
+                              std::vector<char>& visited, std::vector<int>& tree)
+    {
+        std::vector<std::pair<int,int>> parents;  // (node, next adjacency position)
+        visited[root] = 1;
+        tree.push_back(root);
+        parents.push_back({root,dense.offsets[root]});
+        while(!parents.empty())
+        {
+            auto& [current,k] = parents.back();
+            int end = dense.offsets[current+1];
+            while(k < end && (dense.targets[k] < 0 || visited[dense.targets[k]])) k++;
+            if(k == end)
             {
-                visited[current_id] = true;
-                vert_dfs_id[current_itr]=dfs_id;
-                dfs_id++;
-                _node_tree_id[current_id] = tree_id;
-                _trees[tree_id].push_back(current_id);
+                parents.pop_back();
+                continue;
             }
+            int next = dense.targets[k];
+            visited[next] = 1;
+            tree.push_back(next);
+            parents.push_back({next,dense.offsets[next]});
+        }
+    }
 
-            // 4. Check for unvisited adjacent nodes
-            for(auto vadj_id : current_adjs)
+    static std::vector<std::vector<int>> _serial_trees(const DenseAdjacency& dense)
+    {
+        std::vector<std::vector<int>> trees;
+        std::vector<char> visited(dense.ids.size(),0);
+        for(int i=0; i<dense.ids.size(); i++)
+        {
+            if(visited[i]) continue;
+            trees.emplace_back();
+            _dfs_preorder(dense,i,visited,trees.back());
+        }
+        return trees;
+    }
+
+    /*
+     * Parallel connected components, then parallel DFS per component.
+     * Components are found with a lock-free union-find over all edges, always linking
+     * the larger root to the smaller one, so each root ends up being the first node
+     * of its component in _nodes. Trees are then numbered by root and each thread
+     * runs the same DFS as _serial_trees() on whole trees, so the result does not
+     * depend on the thread count or scheduling.
+     */
+    static std::vector<std::vector<int>> _parallel_trees(const DenseAdjacency& dense, Estd::ThreadPool& pool)
+    {
+        const size_t n = dense.ids.size();
+        const size_t grain = 4096;
+        std::vector<std::atomic<int>> parent(n);
+        pool.for_each_chunk(n,grain,[&](size_t b, size_t e) {
+            for(size_t i=b; i<e; i++) parent[i].store(i,std::memory_order_relaxed);
+        });
+        auto find = [&parent](int x) {
+            int p = parent[x].load();
+            while(p != x)
             {
-                if(!visited[vadj_id])
-                {
-                    // Unvisited adjacent node
-                    // Set as the next
-                    parents.push_back(current_id);
-                    next_itr = vert_id_itr[vadj_id];
-                    break; // break out of for loop
-                }
+                int gp = parent[p].load();
+                if(gp != p) parent[x].compare_exchange_weak(p,gp);  // path halving
+                x = gp;
+                p = parent[x].load();
             }
-            // 5. Check for a parent, and if one is found, pop it
-            if(next_itr == _nodes.end())
+            return x;
+        };
+        pool.for_each_chunk(n,grain,[&](size_t b, size_t e) {
+            for(size_t u=b; u<e; u++)
             {
-                // All (if any) adjacent nodes are visited
-                // Check for parent, pop
-                if(parents.size() > 0)
+                for(int k=dense.offsets[u]; k<dense.offsets[u+1]; k++)
                 {
-                    next_itr = vert_id_itr[parents.back()];
-                    parents.pop_back();
+                    int v = dense.targets[k];
+                    if(v <= static_cast<int>(u)) continue;  // each edge once
+                    while(true)
+                    {
+                        int ru = find(u);
+                        int rv = find(v);
+                        if(ru == rv) break;
+                        if(ru < rv) std::swap(ru,rv);
+                        if(parent[ru].compare_exchange_strong(ru,rv)) break;
+                    }
                 }
             }
-            // 6. If no adjacent nodes or parent, increment the iterator
-            if(next_itr == _nodes.end())
-            {
-                next_itr = std::next(current_itr);
-            }
+        });
 
-            // 7. Update current itr
-            current_itr = next_itr;
+        std::vector<int> roots;
+        for(size_t i=0; i<n; i++)
+        {
+            if(find(i) == static_cast<int>(i)) roots.push_back(i);
         }
-
-        // cout << "Map from old to new ids after traversal:\n";
-        // for(auto vitr = vertices.cbegin(); vitr != vertices.cend(); ++vitr)
-        // {
-        //     cout << vitr->get_id() << "  -->  " << vert_dfs_id[vitr];
-        //     cout << "\t\ttree " << node_tree_id[vitr->get_id()] << endl;
-        // }
-
+        std::vector<std::vector<int>> trees(roots.size());
+        std::vector<char> visited(n,0);  // components are disjoint, so threads never share an entry
+        pool.for_each_chunk(roots.size(),64,[&](size_t b, size_t e) {
+            for(size_t t=b; t<e; t++) _dfs_preorder(dense,roots[t],visited,trees[t]);
+        });
+        return trees;
     }
 
     /*********************************/
@@ -398,61 +992,51 @@ protected:
     bool _are_nodes_adjacent(int id1,int id2)
     {
         // Check if id2 is in the graph (check for id1 is implicit
-        if(!(any_of(_nodes,MatchingId{id2}))) { throw std::invalid_argument("Supplied id2 is not in the graph."); }
-
-        try
-        {
-            Estd::Vec<int>& id1_adj = _adjacent.at(id1);
-            return find(id1_adj.begin(),id1_adj.end(),id2) != id1_adj.end();
-        }
-        catch(std::out_of_range)
-        {
-            throw std::invalid_argument("Supplied id1 is not in the graph.");
-        }
+        if(!_has_node(id2)) { throw std::invalid_argument("Supplied id2 is not in the graph."); }
+        std::optional<bool> adjacent = try_adjacent(id1,id2);
+        if(!adjacent) throw std::invalid_argument("Supplied id1 is not in the graph.");
+        return *adjacent;
     }
     bool _is_node_isolated(int id)
     {
-        try
-        {
-            Estd::Vec<int>& id_adj = _adjacent.at(id);
-            return id_adj.size() == 0;
-        }
-        catch(std::out_of_range){ throw std::invalid_argument("Supplied id is not in the graph."); }
+        const Estd::Vec<int>* adj = try_get_adjacent(id);
+        if(!adj) throw std::invalid_argument("Supplied id is not in the graph.");
+        return adj->empty();
     }
     Estd::Vec<int> _get_reachable_nodes(int id, bool force_traverse)
     {
-        if(force_traverse) _traverse_graph();
+        std::optional<Estd::Vec<int>> reachables = try_get_reachable(id,force_traverse);
+        if(reachables) return std::move(*reachables);
         // Check if id exists
-        if(!(any_of(_nodes,MatchingId{id}))) { throw std::invalid_argument("Supplied id is not in the graph."); }
-
-        int tree_id = -1;
-        try{
-            tree_id = _node_tree_id.at(id);
-        }catch(std::out_of_range){
-            throw std::invalid_argument("Could not find node id in tree map, traversal might be stale.");
-        }
-
-        // Select all vertices matching that tree id
-        Estd::Vec<int> reachables;
-        for(auto& pair : _node_tree_id)
-        {
-            if(pair.second == tree_id) reachables.push_back(pair.first);
-        }
-        return reachables;
+        if(!_has_node(id)) { throw std::invalid_argument("Supplied id is not in the graph."); }
+        throw std::invalid_argument("Could not find node id in tree map, traversal might be stale.");
     }
 
-    const NodeT& _get_node(int id)
+    const NodeT& _get_node(int id) const
+    {
+        if(!_has_node(id)) throw std::invalid_argument("Supplied id is not in the graph.");
+        return *_nodes[_node_slot[id]];
+    }
+    bool _has_node(int id) const
+    {
+        return id >= 0 && id < static_cast<int>(_node_slot.size()) && _node_slot[id] >= 0;
+    }
+    // Update _node_slot for the nodes from position `from` in _nodes on
+    void _index_nodes(size_t from)
     {
-        for(auto& v : _nodes)
+        for(size_t i=from; i<_nodes.size(); i++)
         {
-            if(v->get_id() == id) return *v;
+            int id = _nodes[i]->get_id();
+            if(id >= static_cast<int>(_node_slot.size())) _node_slot.resize(id+1,-1);
+            _node_slot[id] = i;
         }
-        throw std::invalid_argument("Supplied id is not in the graph.");
     }
 
     // Get Estd::Vector of edges as (id1,id2)
     Estd::Vec<std::pair<int,int>> _get_edge_list()
     {
+        NM_COUNT(_stats.linear_scans,1);
+        NM_COUNT(_stats.linear_scan_items,_nodes.size());
         Estd::Vec<std::pair<int,int>> edges;
         // Go through adjacency lists
         // If node id > this, add (this,other) to edges
@@ -466,11 +1050,50 @@ protected:
         return edges;
     }
 
+    /* Replace the whole graph with `nodes`, the adjacency given as CSR arrays by
+     * position in `nodes` (see DenseAdjacency) and the id pool, without any checks.
+     * The trees are rebuilt on the next query that needs them.
+     */
+    void _assign(Estd::Vec<GraphNodeP> nodes, const uint32_t* offsets, const uint32_t* targets, IdPool idpool)
+    {
+        _adjacent.clear();
+        for(size_t i=0; i<nodes.size(); i++)
+        {
+            Estd::Vec<int> adj(offsets[i+1]-offsets[i]);
+            for(uint32_t k=offsets[i]; k<offsets[i+1]; k++) adj[k-offsets[i]] = nodes[targets[k]]->get_id();
+            _adjacent.emplace(nodes[i]->get_id(),std::move(adj));
+        }
+        _nodes = std::move(nodes);
+        _node_slot.clear();
+        _index_nodes(0);
+        _idpool = std::move(idpool);
+        _node_tree_id.clear();
+        _trees.clear();
+        _bump_versions();
+    }
+
+    void _bump_versions() {_structure_version++; _geometry_version++;}
+    void _record(typename JournalEntry::Type type, int id1, int id2, int index=-1, const NodeT* deleted=nullptr)
+    {
+        if(!_journal) return;
+        std::shared_ptr<const NodeT> node;
+        if(deleted) node = std::make_shared<const NodeT>(*deleted);
+        else if(index >= 0) node = std::make_shared<const NodeT>(*_nodes[index]);
+        _journal->push_back({type,id1,id2,index,std::move(node)});
+    }
+
     IdPool _idpool;                    // Id pool  -- only protected for add() methods
     Estd::Vec<GraphNodeP> _nodes;      // Node vector
+    std::vector<int> _node_slot;       // node id -> position in _nodes, -1 if none
     std::map<int,Estd::Vec<int>> _adjacent;       // Adjacent vertices of each node by id
+    GraphStats _stats;
 
 private:
+    uint64_t _structure_version = 0;
+    uint64_t _geometry_version = 0;
+    size_t _parallel_min_nodes = 1<<16;
+    Estd::ThreadPool* _pool = nullptr;
+    Estd::Vec<JournalEntry>* _journal = nullptr;
     std::map<int,int> _node_tree_id;        // Map of node id -> tree id
     std::map<int,Estd::Vec<int>> _trees;  // Spanning trees map (as vertices)
 };
@@ -527,6 +1150,25 @@ public:
     VertexGraph() {}
     virtual ~VertexGraph() {}
 
+    // Vertex positions in node list order (the order of get_all_ids())
+    Estd::Vec<Coordinate2> get_positions() const
+    {
+        Estd::Vec<Coordinate2> positions(_nodes.size());
+        for(size_t i=0; i<_nodes.size(); i++) positions[i] = _nodes[i]->get_pos();
+        return positions;
+    }
+    /* Replace the graph with vertices `ids` at (xy[2i],xy[2i+1]), the adjacency as
+     * CSR arrays by vertex index, and the id pool. The input must already follow the
+     * vertex graph rules (as written by a saved graph), it is not checked.
+     */
+    void assign(size_t n, const int32_t* ids, const double* xy, const uint32_t* offsets,
+                const uint32_t* targets, IdPool idpool)
+    {
+        Estd::Vec<VertexP> nodes(n);
+        for(size_t i=0; i<n; i++) nodes[i] = std::make_unique<GraphVertex>(ids[i],Coordinate2(xy[2*i],xy[2*i+1]));
+        _assign(std::move(nodes),offsets,targets,std::move(idpool));
+    }
+
     /*
      * Add a vertex to a vertex graph.
      * Cases:
@@ -539,6 +1181,8 @@ public:
     int add(Coordinate2 p, bool traverse=true)
     {
         // First check if this position is already present
+        NM_COUNT(_stats.linear_scans,1);
+        NM_COUNT(_stats.linear_scan_items,_nodes.size());
         for(auto& other : _nodes)
         {
             if(other->get_pos() == p)
@@ -554,15 +1198,17 @@ public:
 
         // Now check if this new vertex is on an existing edge
         Estd::Vec<Edge> edges = _get_edge_list();
-        for(auto& edge : edges)
+        SegmentBatch segments;
+        segments.reserve(edges.size());
+        for(auto& edge : edges) segments.push_back(pos(edge.first),pos(edge.second));
+        // ignore case when node lies on intersection of multiple edges
+        size_t i = segments.first_within(p,p.prec());
+        if(i != SegmentBatch::npos)
         {
-            if(_on_edge(nodeid,edge))
-            {
-                _disconnect_nodes(edge.first,edge.second,false);
-                _connect_nodes(nodeid,edge.first,false);
-                _connect_nodes(nodeid,edge.second,true);
-                break;  // ignore case when node lies on intersection of multiple edges
-            }
+            Edge edge = edges[i];
+            _disconnect_nodes(edge.first,edge.second,false);
+            _connect_nodes(nodeid,edge.first,false);
+            _connect_nodes(nodeid,edge.second,true);
         }
 
         return nodeid;
@@ -570,6 +1216,9 @@ public:
     virtual void connect(int id1,int id2,bool traverse=true)
     {
         if(adjacent(id1,id2)) return;
+        Timeline::Scope timeline("VertexGraph::connect","graph");
+        Timeline::Phases steps("graph");
+        steps.next("collinear scan");
 
         // Connect vertices, but only if the new edge would not be collinear with another
         // To do this, check if (id1,id2,idx) are collinear, where idx is any other
@@ -583,6 +1232,8 @@ public:
 
         Estd::Vec<GraphVertex> collinear_vtxs;
         Estd::Vec<Coordinate2> collinear_coords;
+        NM_COUNT(_stats.linear_scans,1);
+        NM_COUNT(_stats.linear_scan_items,_nodes.size());
         for(auto& other : _nodes)
         {
             // collinear() is pretty light, run it on all vertices
@@ -605,6 +1256,7 @@ public:
         }
 
         // If no collinear points in graph, simple connection
+        steps.next("connect");
         if(collinear_vtxs.empty()){ _connect_nodes(id1,id2,false);}
         else
         {
@@ -635,6 +1287,7 @@ public:
         }
 
         // Finish up
+        steps.next(traverse ? "traverse" : nullptr);
         if(traverse) _traverse_graph();
     }
     virtual void disconnect(int id1,int id2,bool traverse=true)
@@ -654,52 +1307,236 @@ public:
     // Only performs a check on a single spanning tree, `treeid`.
     void merge_unbranched_collinear_edges()
     {
-        /* To check for unbranching collinear edges, iterate over the nodes
-         * in the spanning tree.
+        /* A node is degenerate if it has exactly two adjacent nodes and the three
+         * are collinear. Degenerate nodes are removed one at a time, always the first
+         * one in node order, and their adjacent nodes connected instead. Removing a
+         * node only changes its two adjacent nodes, so after a removal only those two
+         * are checked again instead of rescanning every node.
          */
-        while(_remove_one_degenerate_node());
+        NM_TIME(_stats.merges);
+        Timeline::Scope timeline("merge_unbranched_collinear_edges","graph");
+        Timeline::Phases steps("graph");
+        steps.next("find and merge");
+        std::vector<int> ids(_nodes.size());       // node order -> id
+        std::vector<int> rank(_node_slot.size());  // id -> node order
+        for(size_t i=0; i<_nodes.size(); i++)
+        {
+            ids[i] = _nodes[i]->get_id();
+            rank[ids[i]] = i;
+        }
+        std::set<int> unchecked;
+        for(size_t i=0; i<ids.size(); i++) unchecked.insert(unchecked.end(),i);
+        std::vector<int> removed;
+        while(!unchecked.empty())
+        {
+            int id1 = ids[*unchecked.begin()];
+            unchecked.erase(unchecked.begin());
+            Estd::Vec<int> adj = _adjacent[id1];
+            if(adj.size() != 2) continue;
+            Coordinate2 p1 = _get_node(id1).get_pos();
+            Coordinate2 p2 = _get_node(adj[0]).get_pos();
+            Coordinate2 p3 = _get_node(adj[1]).get_pos();
+            if(collinear(p1,p2,p3))
+            {
+                // Isolate it now, and take the isolated nodes out of the node list
+                // together at the end
+                _disconnect_nodes(id1,adj[0],false);
+                _disconnect_nodes(id1,adj[1],false);
+                _connect_nodes(adj[0],adj[1],false);
+                removed.push_back(id1);
+                unchecked.insert(rank[adj[0]]);
+                unchecked.insert(rank[adj[1]]);
+            }
+        }
+        NM_COUNT(_stats.merged_vertices,removed.size());
+        steps.next("delete merged");
+        _delete_isolated_nodes(removed);
+        steps.next("traverse");
         _traverse_graph();
     }
 
-private:
-    bool _on_edge(int id, Edge edge)
+    /* Spatial index for adding many vertices and edges at once, see
+     * Schematic::add_wires().
+     *
+     * add() and connect() do exactly what VertexGraph::add(p,false) and
+     * VertexGraph::connect(id1,id2,false) do, and select_edge(p) returns the first
+     * edge of get_all_edges() within p.prec() of p, but they look vertices and edges
+     * up in a uniform grid instead of scanning the whole graph. The grid is built
+     * when the builder is made and only follows the builder's own changes, so don't
+     * change the graph in other ways while a builder is in use. Like the other
+     * traverse=false methods, the builder leaves the trees stale.
+     */
+    class BulkBuilder
     {
-        Coordinate2 p1 = _get_node(id).get_pos();
-        Coordinate2 p2 = _get_node(edge.first).get_pos();
-        Coordinate2 p3 = _get_node(edge.second).get_pos();
-        double tol = p1.prec();
-        if(distance_from_line(p1,p2,p3) < tol) return true;
-        return false;
-    }
+    public:
+        BulkBuilder(VertexGraph& graph, double cell_size) : _g{graph},_inv_cell{1.0/cell_size}
+        {
+            if(!(cell_size > 0) || !std::isfinite(_inv_cell)) throw std::invalid_argument("Cell size must be positive.");
+            _nodes.reserve(2*_g._nodes.size());
+            _edges.reserve(2*_g._nodes.size());
+            for(auto& n : _g._nodes) _insert_node(n->get_id());
+            for(auto& e : _g._get_edge_list()) _edge_cells(e,[this,&e](std::vector<Edge>& cell) {cell.push_back(e);});
+        }
 
-    bool _remove_one_degenerate_node()
-    {
-        /* For each node, check if it has exactly two (2) adjacent nodes. If
-         * it does, check if those three are collinear. If they are, mark the
-         * center node as degenerate.
-         *
-         * When a degenerate node is found, remove it and connect its adjacent nodes,
-         * and return true. Else return false.
-         */
-        for(auto& n : _nodes)
+        Coordinate2 pos(int id) const {return _g._get_node(id).get_pos();}
+
+        Edge select_edge(Coordinate2 p) const
         {
-            int id1 = n->get_id();
-            Estd::Vec<int> adj = _adjacent[id1];
-            if(adj.size() == 2)
+            double tol = p.prec();
+            Edge best{-1,-1};
+            size_t best_k = 0;
+            _for_cells(p,p,tol,[&](uint64_t key) {
+                auto itr = _edges.find(key);
+                if(itr == _edges.end()) return;
+                for(auto& e : itr->second)
+                {
+                    if(best.first >= 0 && e.first > best.first) continue;
+                    if(segment_distance_sq(p,pos(e.first),pos(e.second)) >= tol*tol) continue;
+                    // get_all_edges() order: lower id, then position in its adjacency list
+                    const Estd::Vec<int>& adj = _g._adjacent.at(e.first);
+                    size_t k = std::find(adj.begin(),adj.end(),e.second)-adj.begin();
+                    if(best.first < 0 || e.first < best.first || k < best_k)
+                    {
+                        best = e;
+                        best_k = k;
+                    }
+                }
+            });
+            return best;
+        }
+
+        int add(Coordinate2 p)
+        {
+            // Same position as an existing vertex
+            int existing = -1;
+            _for_cells(p,p,p.prec(),[&](uint64_t key) {
+                auto itr = _nodes.find(key);
+                if(itr == _nodes.end()) return;
+                for(int id : itr->second)
+                {
+                    // First match in node order, as in VertexGraph::add()
+                    if(pos(id) == p && (existing < 0 || _g._node_slot[id] < _g._node_slot[existing])) existing = id;
+                }
+            });
+            if(existing >= 0) return existing;
+
+            Edge split = select_edge(p);
+            int nodeid = _g._idpool.get();
+            _g._add_node(std::move(std::make_unique<GraphVertex>(nodeid,p)),false);
+            _insert_node(nodeid);
+            if(split.first >= 0)
             {
-                Coordinate2 p1 = _get_node(id1).get_pos();
-                Coordinate2 p2 = _get_node(adj[0]).get_pos();
-                Coordinate2 p3 = _get_node(adj[1]).get_pos();
-                if(collinear(p1,p2,p3))
+                _disconnect(split.first,split.second);
+                _connect(nodeid,split.first);
+                _connect(nodeid,split.second);
+            }
+            return nodeid;
+        }
+
+        void connect(int id1,int id2)
+        {
+            if(_g.adjacent(id1,id2)) return;
+            Coordinate2 p1 = pos(id1);
+            Coordinate2 p2 = pos(id2);
+            double tol = p1.prec();
+            double dp = p1.distance(p2);
+
+            // Vertices collinear with and between p1 and p2 lie within 2*tol/dp of the
+            // line through them. Very short wires fall back to checking every vertex.
+            std::vector<int> between;
+            auto check = [&](int id) {
+                if(id == id1 || id == id2) return;
+                Coordinate2 p = pos(id);
+                if(collinear(p1,p2,p,tol) && p1.distance(p) < dp && p2.distance(p) < dp) between.push_back(id);
+            };
+            double margin = tol + (dp > 0 ? 2*tol/dp : 0);
+            if(dp > 0 && margin*_inv_cell < 16)
+            {
+                _for_cells(p1,p2,margin,[&](uint64_t key) {
+                    auto itr = _nodes.find(key);
+                    if(itr != _nodes.end()) for(int id : itr->second) check(id);
+                });
+                // Node order, as in VertexGraph::connect()
+                std::sort(between.begin(),between.end(),[this](int a, int b) {return _g._node_slot[a] < _g._node_slot[b];});
+                between.erase(std::unique(between.begin(),between.end()),between.end());
+            }
+            else for(auto& n : _g._nodes) check(n->get_id());
+
+            if(between.empty()) {_connect(id1,id2); return;}
+            between.push_back(id1);
+            between.push_back(id2);
+            std::vector<double> dists;
+            for(int id : between) dists.push_back(std::pow(p1.x-pos(id).x,2)+std::pow(p1.y-pos(id).y,2));
+            std::vector<size_t> sorted_idxs = Estd::argsort(dists);
+            for(size_t i=0; i+1<sorted_idxs.size(); i++) _connect(between[sorted_idxs[i]],between[sorted_idxs[i+1]]);
+        }
+
+    private:
+        VertexGraph& _g;
+        double _inv_cell;
+        std::unordered_map<uint64_t,std::vector<int>> _nodes;    // cell -> vertex ids
+        std::unordered_map<uint64_t,std::vector<Edge>> _edges;   // cell -> edges (id1<id2) crossing it
+
+        static uint64_t _key(int64_t cx, int64_t cy) {return (uint64_t(cx) * 0x9E3779B97F4A7C15ull) ^ uint64_t(cy);}
+        int64_t _cell(double v) const {return static_cast<int64_t>(std::floor(v*_inv_cell));}
+
+        // Call f(key) for every cell within `margin` of the segment a-b
+        template<typename F>
+        void _for_cells(Coordinate2 a, Coordinate2 b, double margin, F f) const
+        {
+            bool steep = std::abs(b.y-a.y) > std::abs(b.x-a.x);
+            double u0 = steep ? a.y : a.x, v0 = steep ? a.x : a.y;
+            double u1 = steep ? b.y : b.x, v1 = steep ? b.x : b.y;
+            if(u1 < u0) {std::swap(u0,u1); std::swap(v0,v1);}
+            double slope = (u1 > u0) ? (v1-v0)/(u1-u0) : 0;
+            int64_t c_end = _cell(u1+margin);
+            NM_COUNT(_g._stats.spatial_queries,1);
+            for(int64_t c = _cell(u0-margin); c <= c_end; c++)
+            {
+                // v range of the segment within this column
+                double lo = std::max(u0,c/_inv_cell), hi = std::min(u1,(c+1)/_inv_cell);
+                if(lo > hi) lo = hi = (c/_inv_cell < u0) ? u0 : u1;
+                double va = v0 + slope*(lo-u0), vb = v0 + slope*(hi-u0);
+                int64_t r_end = _cell(std::max(va,vb)+margin);
+                int64_t r_begin = _cell(std::min(va,vb)-margin);
+                NM_COUNT(_g._stats.spatial_cells,r_end-r_begin+1);
+                for(int64_t r = r_begin; r <= r_end; r++)
                 {
-                    _delete_node(id1,false); // no need to traverse
-                    _connect_nodes(adj[0],adj[1],false);
-                    return true;
+                    f(steep ? _key(r,c) : _key(c,r));
                 }
             }
         }
-        return false;
-    }
+        template<typename F>
+        void _edge_cells(const Edge& e, F f)
+        {
+            Coordinate2 a = pos(e.first), b = pos(e.second);
+            _for_cells(a,b,std::max(a.prec(),b.prec()),[&](uint64_t key) {f(_edges[key]);});
+        }
+        void _insert_node(int id)
+        {
+            Coordinate2 p = pos(id);
+            _nodes[_key(_cell(p.x),_cell(p.y))].push_back(id);
+        }
+        void _connect(int id1,int id2)
+        {
+            if(_g._are_nodes_adjacent(id1,id2)) return;
+            _g._connect_nodes(id1,id2,false);
+            Edge e{std::min(id1,id2),std::max(id1,id2)};
+            _edge_cells(e,[&e](std::vector<Edge>& cell) {
+                if(std::find(cell.begin(),cell.end(),e) == cell.end()) cell.push_back(e);
+            });
+        }
+        void _disconnect(int id1,int id2)
+        {
+            _g._disconnect_nodes(id1,id2,false);
+            Edge e{std::min(id1,id2),std::max(id1,id2)};
+            _edge_cells(e,[&e](std::vector<Edge>& cell) {
+                auto itr = std::find(cell.begin(),cell.end(),e);
+                if(itr != cell.end()) cell.erase(itr);
+            });
+        }
+    };
+
 };
 
 
@@ -0,0 +1,122 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+namespace Estd
+{
+
+/* Fixed-size pool of worker threads for data-parallel loops.
+ *
+ * Usage: pool.for_each_chunk(n, grain, f) calls f(begin,end) on chunks of [0,n)
+ * of at most `grain` indices, spread over the workers and the calling thread, and
+ * returns when all chunks are done. Only one loop runs at a time; calling
+ * for_each_chunk() from inside f deadlocks.
+ *
+ * A pool of size 1 has no workers and runs everything on the calling thread.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads=0)
+    {
+        if(threads == 0) threads = std::max(1u,std::thread::hardware_concurrency());
+        for(unsigned i=1; i<threads; i++) _workers.emplace_back([this]{_work_loop();});
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _start_cv.notify_all();
+        for(auto& t : _workers) t.join();
+    }
+
+    // Number of threads taking part in a loop, including the caller
+    unsigned size() const {return _workers.size()+1;}
+
+    template<typename F>
+    void for_each_chunk(size_t n, size_t grain, F f)
+    {
+        if(n == 0) return;
+        if(grain == 0) grain = 1;
+        if(_workers.empty() || n <= grain)
+        {
+            for(size_t b=0; b<n; b+=grain) f(b,std::min(n,b+grain));
+            return;
+        }
+        std::atomic<size_t> next{0};
+        std::function<void()> job = [&]() {
+            size_t b;
+            while((b = next.fetch_add(grain)) < n) f(b,std::min(n,b+grain));
+        };
+        _run(job);
+    }
+
+    // Pool shared by callers that don't bring their own
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    void _run(const std::function<void()>& job)
+    {
+        std::lock_guard<std::mutex> run_lock(_run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _pending = _workers.size();
+            _generation++;
+        }
+        _start_cv.notify_all();
+        job();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock,[this]{return _pending == 0;});
+        _job = nullptr;
+    }
+    void _work_loop()
+    {
+        unsigned long seen = 0;
+        while(true)
+        {
+            const std::function<void()>* job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _start_cv.wait(lock,[&]{return _stop || _generation != seen;});
+                if(_stop) return;
+                seen = _generation;
+                job = _job;
+            }
+            (*job)();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(--_pending == 0) _done_cv.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::mutex _run_mutex;                  // one loop at a time
+    std::mutex _mutex;
+    std::condition_variable _start_cv;
+    std::condition_variable _done_cv;
+    const std::function<void()>* _job = nullptr;
+    unsigned long _generation = 0;
+    size_t _pending = 0;
+    bool _stop = false;
+};
+
+}  // namespace Estd
+
+#endif // THREADPOOL_H
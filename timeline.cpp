@@ -0,0 +1,111 @@
+#include "timeline.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+
+namespace
+{
+std::mutex g_mutex;                         // guards everything below
+std::vector<Timeline::Event> g_ring;
+size_t g_capacity = 0;
+size_t g_next = 0;                          // slot of the next event
+uint64_t g_added = 0;                       // since start()
+
+std::atomic<uint32_t> g_threads{0};
+thread_local uint32_t t_thread = g_threads.fetch_add(1,std::memory_order_relaxed);
+
+void write_string(std::ostream& out, const char* s)
+{
+    out << '"';
+    for(; *s; s++)
+    {
+        if(*s == '"' || *s == '\\') out << '\\';
+        out << *s;
+    }
+    out << '"';
+}
+}
+
+int64_t Timeline::now()
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-epoch).count();
+}
+
+void Timeline::start(size_t capacity)
+{
+    if(capacity == 0) throw std::invalid_argument("Timeline capacity must be positive.");
+    now();  // fix the epoch before the first event
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_ring = std::vector<Timeline::Event>();
+    g_ring.reserve(capacity);
+    g_capacity = capacity;
+    g_next = 0;
+    g_added = 0;
+    _recording.store(true,std::memory_order_relaxed);
+}
+
+void Timeline::stop()
+{
+    _recording.store(false,std::memory_order_relaxed);
+}
+
+void Timeline::_add(const char* name, const char* category, int64_t start, int64_t end)
+{
+    Event e{name,category,start,end-start,t_thread};
+    std::lock_guard<std::mutex> lock(g_mutex);
+    // Scopes still open at stop() are dropped
+    if(g_capacity == 0 || !recording()) return;
+    if(g_ring.size() < g_capacity) g_ring.push_back(e);
+    else g_ring[g_next] = e;
+    g_next = (g_next+1) % g_capacity;
+    g_added++;
+}
+
+Estd::Vec<Timeline::Event> Timeline::events()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Estd::Vec<Event> events;
+    events.reserve(g_ring.size());
+    // Once full, the oldest event is at g_next
+    size_t oldest = (g_ring.size() == g_capacity) ? g_next : 0;
+    events.insert(events.end(),g_ring.begin()+oldest,g_ring.end());
+    events.insert(events.end(),g_ring.begin(),g_ring.begin()+oldest);
+    return events;
+}
+
+uint64_t Timeline::dropped()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_added-g_ring.size();
+}
+
+void Timeline::write(std::ostream& out)
+{
+    Estd::Vec<Event> all = events();
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    char times[64];
+    for(size_t i=0; i<all.size(); i++)
+    {
+        const Event& e = all[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":";
+        write_string(out,e.name);
+        out << ",\"cat\":";
+        write_string(out,e.category);
+        std::snprintf(times,sizeof(times),"%.3f,\"dur\":%.3f",e.start_ns/1e3,e.duration_ns/1e3);
+        out << ",\"ph\":\"X\",\"ts\":" << times << ",\"pid\":1,\"tid\":" << e.thread << "}";
+    }
+    out << "\n]}\n";
+}
+
+void Timeline::write_file(const std::string& path)
+{
+    std::ofstream out(path);
+    if(!out) throw std::runtime_error("Could not open timeline file.");
+    write(out);
+    out.flush();
+    if(!out) throw std::runtime_error("Could not write timeline file.");
+}
@@ -0,0 +1,115 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <ostream>
+#include "utils.h"
+#include "instrument.h"
+
+
+/* Timeline of schematic and graph operations, for chrome://tracing or Perfetto.
+ *
+ * Usage: Timeline::start() turns recording on at any time, in a running process;
+ * from then on every Timeline::Scope and Timeline::Phases step adds an event (name,
+ * start, duration, thread) to a ring buffer holding the last `capacity` events.
+ * Timeline::write_file(path) saves the buffer as Chrome trace JSON, and
+ * Timeline::stop() turns recording off again. The buffer is kept until the next
+ * start(), so it can be written after stopping.
+ *
+ * Recorded: add_wire(), remove_wire(), update_nets(), _update_trees(),
+ * merge_unbranched_collinear_edges() and VertexGraph::connect(), each with its
+ * major phases as nested events. While recording is off a scope costs one relaxed
+ * atomic load. Recording is thread-safe; event names must be string literals.
+ */
+class Timeline
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    struct Event
+    {
+        const char* name;
+        const char* category;
+        int64_t start_ns;       // since the first call to now()
+        int64_t duration_ns;
+        uint32_t thread;        // small id, in order of first event
+    };
+
+    static void start(size_t capacity=DEFAULT_CAPACITY);   // clears the buffer
+    static void stop();
+    static bool recording() {return _recording.load(std::memory_order_relaxed);}
+
+    static Estd::Vec<Event> events();       // oldest first
+    static uint64_t dropped();              // overwritten since start()
+
+    // Chrome trace JSON ("X" events, times in microseconds)
+    static void write(std::ostream& out);
+    static void write_file(const std::string& path);
+
+    static int64_t now();
+
+    // Adds an event lasting until it is destroyed
+    class Scope
+    {
+    public:
+        explicit Scope(const char* name, const char* category="schematic")
+            : _name{name},_category{category},_on{recording()}
+        {
+            if(_on) _start = now();
+        }
+        ~Scope() {if(_on) _add(_name,_category,_start,now());}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* _name;
+        const char* _category;
+        bool _on;
+        int64_t _start = 0;
+    };
+
+    // Consecutive phases of a function: next() ends the current phase. With
+    // NM_INSTRUMENT, next(name,&timer) also adds the phase to a stats Timer, so one
+    // call marks the phase for both (see instrument.h).
+    class Phases
+    {
+    public:
+        explicit Phases(const char* category="schematic") : _category{category},_on{recording()} {}
+        ~Phases() {next(nullptr);}
+        void next(const char* name)
+        {
+            if(!_on) return;
+            int64_t t = now();
+            if(_name) _add(_name,_category,_start,t);
+            _name = name;
+            _start = t;
+        }
+        void next(const char* name, Estd::Timer* timer)
+        {
+#ifdef NM_INSTRUMENT
+            _timer.next(timer);
+#else
+            (void)timer;
+#endif
+            next(name);
+        }
+        Phases(const Phases&) = delete;
+        Phases& operator=(const Phases&) = delete;
+    private:
+        const char* _category;
+        bool _on;
+        const char* _name = nullptr;
+        int64_t _start = 0;
+#ifdef NM_INSTRUMENT
+        Estd::PhaseTimer _timer;
+#endif
+    };
+
+private:
+    static inline std::atomic<bool> _recording{false};
+    static void _add(const char* name, const char* category, int64_t start, int64_t end);
+};
+
+
+#endif // TIMELINE_H
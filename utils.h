@@ -15,13 +15,34 @@ namespace Estd
 
 using namespace std;
 
-template<typename T>
+/* A vector whose operator[] is bounds checked (as at(), throwing std::out_of_range)
+ * if `Checked`. The default is checked, and unchecked with NM_UNCHECKED_VEC (the
+ * release application and benchmarks, see CMakeLists.txt; tests always build
+ * checked), where operator[] is the plain vector access the compiler can
+ * vectorize. Code must not rely on operator[] throwing; check indices from
+ * outside explicitly.
+ */
+#ifdef NM_UNCHECKED_VEC
+constexpr bool VEC_CHECKED = false;
+#else
+constexpr bool VEC_CHECKED = true;
+#endif
+
+template<typename T, bool Checked = VEC_CHECKED>
 class Vec : public std::vector<T> {
 public:
     using vector<T>::vector;  // use the construcors from vector (under the name Vec)
 
-    T& operator[](int i) {return vector<T>::at(i);}
-    const T& operator[](int i) const {return vector<T>::at(i);}
+    T& operator[](int i) noexcept(!Checked)
+    {
+        if constexpr(Checked) return vector<T>::at(i);
+        else return vector<T>::operator[](i);
+    }
+    const T& operator[](int i) const noexcept(!Checked)
+    {
+        if constexpr(Checked) return vector<T>::at(i);
+        else return vector<T>::operator[](i);
+    }
 };
 
 // Sort full container
@@ -0,0 +1,167 @@
+#include "wirelist.h"
+#include <fstream>
+#include <vector>
+#include <charconv>
+#include <string_view>
+#include <stdexcept>
+#include <cstring>
+
+using std::string;
+using Estd::Vec;
+using Segment = std::pair<Coordinate2,Coordinate2>;
+
+namespace
+{
+
+// One line of the input, parsed field by field
+class LineParser
+{
+public:
+    LineParser(const char* begin, const char* end, uint64_t line) : _p{begin},_end{end},_line{line} {}
+
+    bool at_end()
+    {
+        _skip_space();
+        return _p == _end;
+    }
+    // Next field, empty at the end of the line
+    std::string_view word()
+    {
+        _skip_space();
+        const char* start = _p;
+        while(_p != _end && *_p != ' ' && *_p != '\t') _p++;
+        return std::string_view(start,_p-start);
+    }
+    double number()
+    {
+        _skip_space();
+        double value = 0;
+        auto result = std::from_chars(_p,_end,value);
+        if(result.ec != std::errc() || (result.ptr != _end && *result.ptr != ' ' && *result.ptr != '\t'))
+            error("expected a number");
+        _p = result.ptr;
+        return value;
+    }
+    // Rest of the line without surrounding space
+    string rest()
+    {
+        _skip_space();
+        const char* last = _end;
+        while(last != _p && (last[-1] == ' ' || last[-1] == '\t')) last--;
+        string s(_p,last);
+        _p = _end;
+        return s;
+    }
+    [[noreturn]] void error(const string& what) const
+    {
+        throw std::runtime_error("Wire list line " + std::to_string(_line) + ": " + what + ".");
+    }
+
+private:
+    const char* _p;
+    const char* _end;
+    uint64_t _line;
+    void _skip_space() {while(_p != _end && (*_p == ' ' || *_p == '\t')) _p++;}
+};
+
+} // namespace
+
+
+WireListReader::WireListReader(size_t batch_size, size_t chunk_bytes)
+    : _batch_size{batch_size},_chunk_bytes{chunk_bytes}
+{
+    if(batch_size == 0 || chunk_bytes == 0) throw std::invalid_argument("Batch and chunk sizes must be positive.");
+}
+
+WireListReader::Stats WireListReader::read_file(Schematic& sch, const string& path) const
+{
+    std::ifstream in(path,std::ios::binary);
+    if(!in) throw std::runtime_error("Could not open wire list file.");
+    return read(sch,in);
+}
+
+WireListReader::Stats WireListReader::read(Schematic& sch, std::istream& in) const
+{
+    Stats stats;
+    Vec<Segment> batch;
+    batch.reserve(_batch_size);
+    Vec<Schematic::Port> ports;
+
+    auto parse_line = [&](const char* begin, const char* end) {
+        stats.lines++;
+        if(end != begin && end[-1] == '\r') end--;
+        LineParser line(begin,end,stats.lines);
+        if(line.at_end()) return;
+        std::string_view kind = line.word();
+        if(kind[0] == '#') return;
+        if(kind == "wire" || kind == "W")
+        {
+            double x1 = line.number();
+            double y1 = line.number();
+            double x2 = line.number();
+            double y2 = line.number();
+            if(!line.at_end()) line.error("unexpected text after wire");
+            // Keep the last batch back, so that it is added with traverse=true
+            if(batch.size() == _batch_size)
+            {
+                sch.add_wires(batch,false);
+                batch.clear();
+            }
+            batch.push_back({Coordinate2(x1,y1),Coordinate2(x2,y2)});
+            stats.wires++;
+        }
+        else if(kind == "port" || kind == "P")
+        {
+            double x = line.number();
+            double y = line.number();
+            string name = line.rest();
+            if(name.empty()) line.error("missing port name");
+            if(netname_is_int(name)) line.error("port names must not be integers");
+            ports.push_back({Coordinate2(x,y),name});
+            stats.ports++;
+        }
+        else if(kind == "name")
+        {
+            sch.name = line.rest();
+        }
+        else line.error("unknown record '" + string(kind) + "'");
+    };
+
+    // Read chunks, carrying a partial line over to the next chunk. A line longer
+    // than a chunk grows the buffer.
+    std::vector<char> buffer(_chunk_bytes);
+    size_t carry = 0;
+    try
+    {
+        while(in)
+        {
+            if(carry == buffer.size()) buffer.resize(2*buffer.size());
+            in.read(buffer.data()+carry,buffer.size()-carry);
+            size_t got = in.gcount();
+            if(got == 0) break;
+            stats.bytes += got;
+            const char* p = buffer.data();
+            const char* end = buffer.data()+carry+got;
+            while(const char* nl = static_cast<const char*>(std::memchr(p,'\n',end-p)))
+            {
+                parse_line(p,nl);
+                p = nl+1;
+            }
+            carry = end-p;
+            std::memmove(buffer.data(),p,carry);
+        }
+        if(carry > 0) parse_line(buffer.data(),buffer.data()+carry);  // no final newline
+    }
+    catch(...)
+    {
+        // Earlier batches went in with traverse=false; add the wires read so far as
+        // the last batch, which merges and resolves, so that the schematic is consistent
+        if(!batch.empty()) sch.add_wires(batch,true);
+        throw;
+    }
+
+    if(!batch.empty()) sch.add_wires(batch,true);
+    for(auto& port : ports) sch.add_port_node(port,false);
+    if(!ports.empty()) sch.update_nets();
+    return stats;
+}
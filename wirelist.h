@@ -0,0 +1,51 @@
+#ifndef WIRELIST_H
+#define WIRELIST_H
+
+#include <string>
+#include <istream>
+#include <cstdint>
+#include "schematic.h"
+
+
+/* Streaming reader for text wire lists.
+ *
+ * Usage: WireListReader().read_file(sch,path) adds the wires and ports of a wire list
+ * to `sch`. The input is read in chunks of `chunk_bytes` and the wires are added in
+ * batches of `batch_size` with Schematic::add_wires(), so memory use is the graph plus
+ * one chunk and one batch, however long the file is. Ports are kept until all the
+ * wires are in and then added together, followed by a single update_nets().
+ *
+ * One record per line, fields separated by spaces or tabs:
+ *   # comment
+ *   name <schematic name>
+ *   wire x1 y1 x2 y2        (or W)
+ *   port x y <port name>    (or P)
+ * Blank lines are skipped. Port names follow the usual rules: they are lowercased and
+ * must not be integers.
+ *
+ * Syntax errors throw std::runtime_error giving the line number. The wires before
+ * the error stay in the schematic, merged and with the nets resolved as after a
+ * complete read; the ports are not added.
+ */
+class WireListReader
+{
+public:
+    struct Stats
+    {
+        uint64_t bytes = 0;
+        uint64_t lines = 0;
+        uint64_t wires = 0;
+        uint64_t ports = 0;
+    };
+
+    WireListReader(size_t batch_size=1<<16, size_t chunk_bytes=1<<20);
+    Stats read(Schematic& sch, std::istream& in) const;
+    Stats read_file(Schematic& sch, const std::string& path) const;
+
+private:
+    size_t _batch_size;
+    size_t _chunk_bytes;
+};
+
+
+#endif // WIRELIST_H